@@ -0,0 +1,163 @@
+/* arrays.c
+ * Benchmarks for array templates
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdsl/mdsl.h>
+
+#include "bench.h"
+
+//Elements the size of a typical work item
+typedef struct
+{
+	void *ptr;
+	unsigned long seq;
+	int kind;
+} BenchItem;
+
+mdsl_declare_queue(BenchItem, BenchQueue, bench_queue);
+mdsl_declare_ring(BenchItem, BenchRing, bench_ring);
+
+static const size_t bench_depths[] = {16, 1000, 100000, 0};
+
+//Producer and consumer at constant depth: after filling up, every
+//operation pushes one element and pops one. With bursts, up to
+//burst elements are pushed, then as many popped.
+#define BENCH_STEADY(array_type_name, array, n, depth, burst, sum) \
+	do { \
+		size_t i_, j_, n_burst_; \
+		BenchItem item_ = {NULL, 0, 0}; \
+		for (i_ = 0; i_ < (depth); i_++) \
+		{ \
+			item_.seq = i_; \
+			array_type_name ## _push((array), item_); \
+		} \
+		for (i_ = 0; i_ < (n); i_ += n_burst_) \
+		{ \
+			n_burst_ = 1 + bench_rand() % (burst); \
+			for (j_ = 0; j_ < n_burst_; j_++) \
+			{ \
+				item_.seq = i_ + j_; \
+				array_type_name ## _push((array), item_); \
+			} \
+			for (j_ = 0; j_ < n_burst_; j_++) \
+				(sum) += array_type_name ## _pop((array)).seq; \
+		} \
+	} while (0)
+
+static void bench_steady(size_t n, size_t burst)
+{
+	char name[64];
+	int d, kind;
+
+	for (d = 0; bench_depths[d]; d++)
+	{
+		size_t depth = bench_depths[d];
+
+		for (kind = 0; kind < 2; kind++)
+		{
+			BenchQueue queue[1];
+			BenchRing ring[1];
+			unsigned long sum = 0;
+			size_t n_allocs;
+			double start, secs;
+
+			bench_seed(d + 1);
+			if (kind == 0)
+			{
+				bench_queue_init(queue);
+				n_allocs = bench_n_allocs;
+				start = bench_now();
+				BENCH_STEADY(bench_queue, queue, n, depth, burst, sum);
+				secs = bench_now() - start;
+				bench_queue_destroy(queue);
+			}
+			else
+			{
+				bench_ring_init(ring);
+				n_allocs = bench_n_allocs;
+				start = bench_now();
+				BENCH_STEADY(bench_ring, ring, n, depth, burst, sum);
+				secs = bench_now() - start;
+				bench_ring_destroy(ring);
+			}
+
+			snprintf(name, sizeof(name), "%s, depth %lu: push+pop",
+					kind ? "ring" : "queue", (unsigned long) depth);
+			bench_report(name, n, secs);
+			printf("%-40s %12.3f allocs/op\n", name,
+					(double) (bench_n_allocs - n_allocs) / n);
+
+			//Keeps the work from being optimized away
+			if (sum == 1)
+				printf("\n");
+		}
+	}
+}
+
+static void bench_fifo(size_t n)
+{
+	bench_steady(n, 1);
+}
+
+static void bench_bursts(size_t n)
+{
+	bench_steady(n, 64);
+}
+
+typedef struct
+{
+	const char *name;
+	void (*func)(size_t n);
+} Benchmark;
+
+static const Benchmark benchmarks[] =
+{
+	{"fifo", bench_fifo},
+	{"bursts", bench_bursts},
+	{NULL, NULL}
+};
+
+int main(int argc, char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : "all";
+	size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000;
+	int i, found = 0;
+
+	for (i = 0; benchmarks[i].name; i++)
+	{
+		if (strcmp(name, "all") == 0 || strcmp(name, benchmarks[i].name) == 0)
+		{
+			printf("== %s (%lu operations)\n", benchmarks[i].name,
+					(unsigned long) n);
+			benchmarks[i].func(n);
+			found = 1;
+		}
+	}
+
+	if (! found)
+	{
+		fprintf(stderr, "Usage: %s [all", argv[0]);
+		for (i = 0; benchmarks[i].name; i++)
+			fprintf(stderr, "|%s", benchmarks[i].name);
+		fprintf(stderr, "] [n_operations]\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,409 @@
+/* bench.h
+ * Common code for benchmarks
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+//Time in seconds
+static inline double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Counts calls to malloc() and realloc(), including those made by the library
+static size_t bench_n_allocs = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_realloc(void *mem, size_t size);
+
+void *malloc(size_t size)
+{
+	bench_n_allocs++;
+	return __libc_malloc(size);
+}
+
+void *realloc(void *mem, size_t size)
+{
+	bench_n_allocs++;
+	return __libc_realloc(mem, size);
+}
+#endif
+
+//Bytes of heap in use, 0 if unknown
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+
+static inline size_t bench_heap_used()
+{
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+#else
+static inline size_t bench_heap_used()
+{
+	return 0;
+}
+#endif
+
+//xorshift64*, deterministic across runs
+static uint64_t bench_rand_state = 88172645463325252ULL;
+
+static inline uint64_t bench_rand()
+{
+	bench_rand_state ^= bench_rand_state >> 12;
+	bench_rand_state ^= bench_rand_state << 25;
+	bench_rand_state ^= bench_rand_state >> 27;
+	return bench_rand_state * 2685821657736338717ULL;
+}
+
+static inline void bench_seed(uint64_t seed)
+{
+	bench_rand_state = seed ? seed : 88172645463325252ULL;
+}
+
+//A set of keys stored back to back
+typedef struct
+{
+	char *data;
+	size_t *offsets;
+	size_t *lens;
+	size_t n;
+} BenchKeys;
+
+static inline void bench_keys_init(BenchKeys *keys, size_t n, size_t total_len)
+{
+	keys->data = (char *) mdsl_alloc(total_len ? total_len : 1);
+	keys->offsets = (size_t *) mdsl_alloc(sizeof(size_t) * (n ? n : 1));
+	keys->lens = (size_t *) mdsl_alloc(sizeof(size_t) * (n ? n : 1));
+	keys->n = n;
+}
+
+static inline const char *bench_key(BenchKeys *keys, size_t i)
+{
+	return keys->data + keys->offsets[i];
+}
+
+static inline void bench_keys_destroy(BenchKeys *keys)
+{
+	free(keys->data);
+	free(keys->offsets);
+	free(keys->lens);
+}
+
+//Random binary keys of length between min_len and max_len
+static inline void bench_keys_random
+	(BenchKeys *keys, size_t n, size_t min_len, size_t max_len)
+{
+	size_t i, j, offset = 0;
+	bench_keys_init(keys, n, n * max_len);
+	for (i = 0; i < n; i++)
+	{
+		size_t len = min_len + bench_rand() % (max_len - min_len + 1);
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		for (j = 0; j < len; j++)
+			keys->data[offset + j] = bench_rand();
+		offset += len;
+	}
+}
+
+//Base64 session tokens of given length, e.g. "q9Zr-xT0bW..."
+static inline void bench_keys_tokens(BenchKeys *keys, size_t n, size_t len)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		"abcdefghijklmnopqrstuvwxyz0123456789-_";
+	size_t i, j;
+	bench_keys_init(keys, n, n * len);
+	for (i = 0; i < n; i++)
+	{
+		keys->offsets[i] = i * len;
+		keys->lens[i] = len;
+		for (j = 0; j < len; j++)
+			keys->data[i * len + j] = digits[bench_rand() % 64];
+	}
+}
+
+//Keys resembling routing table entries, e.g. "route/10.12.0.0/16"
+static inline void bench_keys_routes(BenchKeys *keys, size_t n)
+{
+	size_t i, offset = 0;
+	size_t max_len = 32;
+	bench_keys_init(keys, n, n * max_len);
+	for (i = 0; i < n; i++)
+	{
+		uint64_t r = bench_rand();
+		int len = snprintf(keys->data + offset, max_len, 
+				"route/%d.%d.%d.%d/%d",
+				(int) (r % 224), (int) ((r >> 8) % 256), 
+				(int) ((r >> 16) % 256), (int) ((r >> 24) % 256),
+				(int) (8 + (r >> 32) % 25));
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		offset += len;
+	}
+}
+
+//Binary address prefixes. Prefixes are whole bytes, between min_len and
+//max_len bytes long, weighted towards the longer ones like routing tables.
+static inline void bench_keys_addr_prefixes
+	(BenchKeys *keys, size_t n, size_t min_len, size_t max_len)
+{
+	size_t i, j, offset = 0;
+	bench_keys_init(keys, n, n * max_len);
+	for (i = 0; i < n; i++)
+	{
+		size_t a = bench_rand() % (max_len - min_len + 1);
+		size_t b = bench_rand() % (max_len - min_len + 1);
+		size_t len = min_len + (a > b ? a : b);
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		//Small alphabet in leading bytes so that prefixes nest
+		for (j = 0; j < len; j++)
+			keys->data[offset + j] = bench_rand() % (j < 2 ? 16 : 256);
+		offset += len;
+	}
+}
+
+//URL paths like "/api/v2/users/17", built from a small set of segments
+static inline void bench_keys_url_paths(BenchKeys *keys, size_t n)
+{
+	static const char *segments[] = {"api", "v1", "v2", "users", "items",
+		"static", "img", "css", "js", "admin", "search", "cart", "orders", 
+		"blog", "posts", "tags"};
+	size_t i, j, offset = 0;
+	size_t max_len = 64;
+	bench_keys_init(keys, n, n * max_len);
+	for (i = 0; i < n; i++)
+	{
+		size_t n_segments = 1 + bench_rand() % 5;
+		size_t len = 0;
+		for (j = 0; j < n_segments; j++)
+		{
+			uint64_t r = bench_rand();
+			if (j >= 2 && r % 2)
+				len += snprintf(keys->data + offset + len, max_len - len, 
+						"/%d", (int) ((r >> 8) % 1000));
+			else
+				len += snprintf(keys->data + offset + len, max_len - len,
+						"/%s", segments[(r >> 8) % 16]);
+		}
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		offset += len;
+	}
+}
+
+//Object store paths like "bucket-3/logs/2020/aqkxjv.../part-0017.gz",
+//with shared leading directories and a long unique name
+static inline void bench_keys_paths
+	(BenchKeys *keys, size_t n, size_t min_len, size_t max_len)
+{
+	static const char *dirs[] = {"logs", "images", "backups", "2019", "2020",
+		"eu-west", "us-east", "raw", "processed", "tmp"};
+	size_t i, j, offset = 0;
+	bench_keys_init(keys, n, n * (max_len + 1));
+	for (i = 0; i < n; i++)
+	{
+		char *key = keys->data + offset;
+		uint64_t r = bench_rand();
+		size_t len = snprintf(key, max_len + 1, "bucket-%d/%s/%s/", 
+				(int) (r % 8), dirs[(r >> 8) % 10], dirs[(r >> 16) % 10]);
+		size_t target = min_len + bench_rand() % (max_len - min_len + 1);
+		for (j = len; j + 13 < target; j++)
+			key[j] = 'a' + bench_rand() % 26;
+		len = j;
+		len += snprintf(key + len, max_len + 1 - len, "/part-%04d.gz", 
+				(int) (bench_rand() % 10000));
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		offset += len;
+	}
+}
+
+//Pronounceable lowercase words of 3 to 10 letters, e.g. "tavorek"
+static inline void bench_keys_words(BenchKeys *keys, size_t n)
+{
+	static const char consonants[] = "bcdfghjklmnprstvwz";
+	static const char vowels[] = "aeiou";
+	size_t i, j, offset = 0;
+	bench_keys_init(keys, n, n * 10);
+	for (i = 0; i < n; i++)
+	{
+		size_t len = 3 + bench_rand() % 8;
+		for (j = 0; j < len; j++)
+			keys->data[offset + j] = j % 2 
+				? vowels[bench_rand() % 5] : consonants[bench_rand() % 18];
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		offset += len;
+	}
+}
+
+//Log lines like "2020-03-14 09:26:53 WARN worker-7: tavorek subo ...",
+//with words drawn from the vocabulary, common words much more often
+static inline char *bench_text_log(BenchKeys *words, size_t len)
+{
+	static const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "ERROR"};
+	char *text = (char *) mdsl_alloc(len + 256);
+	size_t offset = 0;
+	while (offset < len)
+	{
+		uint64_t r = bench_rand();
+		size_t n_words = 4 + r % 12;
+		offset += sprintf(text + offset, 
+				"2020-%02d-%02d %02d:%02d:%02d %s worker-%d:",
+				(int) (1 + (r >> 8) % 12), (int) (1 + (r >> 12) % 28),
+				(int) ((r >> 20) % 24), (int) ((r >> 28) % 60), 
+				(int) ((r >> 36) % 60), levels[(r >> 44) % 5], 
+				(int) ((r >> 48) % 32));
+		while (n_words-- > 0 && offset < len + 128)
+		{
+			double u = (double) (bench_rand() >> 11) / (1ULL << 53);
+			size_t k = (size_t) (u * u * u * words->n);
+			text[offset++] = ' ';
+			memcpy(text + offset, bench_key(words, k), words->lens[k]);
+			offset += words->lens[k];
+		}
+		text[offset++] = '\n';
+	}
+	text[len] = 0;
+	return text;
+}
+
+//Queries that extend randomly chosen keys by extra random bytes, 
+//up to max_len bytes in total.
+static inline void bench_keys_extend
+	(BenchKeys *res, BenchKeys *keys, size_t n, size_t max_len, 
+	 const char *alphabet)
+{
+	size_t i, offset = 0;
+	size_t alphabet_len = alphabet ? strlen(alphabet) : 256;
+	bench_keys_init(res, n, n * max_len);
+	for (i = 0; i < n; i++)
+	{
+		size_t k = bench_rand() % keys->n;
+		size_t len = keys->lens[k];
+		memcpy(res->data + offset, bench_key(keys, k), len);
+		for (; len < max_len; len++)
+		{
+			size_t r = bench_rand() % alphabet_len;
+			res->data[offset + len] = alphabet ? alphabet[r] : (char) r;
+		}
+		res->offsets[i] = offset;
+		res->lens[i] = len;
+		offset += len;
+	}
+}
+
+//Random permutation of 0..n-1
+static inline size_t *bench_shuffle(size_t n)
+{
+	size_t *order = (size_t *) mdsl_alloc(sizeof(size_t) * (n ? n : 1));
+	size_t i;
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n; i > 1; i--)
+	{
+		size_t j = bench_rand() % i;
+		size_t tmp = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = tmp;
+	}
+	return order;
+}
+
+//Sorts keys in lexicographic byte order and removes duplicates
+static BenchKeys *bench_sort_keys_target;
+
+static int bench_key_cmp(const void *a, const void *b)
+{
+	BenchKeys *keys = bench_sort_keys_target;
+	size_t ia = *((const size_t *) a), ib = *((const size_t *) b);
+	size_t la = keys->lens[ia], lb = keys->lens[ib];
+	int res = memcmp(bench_key(keys, ia), bench_key(keys, ib), 
+			la < lb ? la : lb);
+	if (res)
+		return res;
+	return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static inline void bench_keys_sort(BenchKeys *keys)
+{
+	size_t *order = (size_t *) mdsl_alloc(sizeof(size_t) * (keys->n + 1));
+	size_t *offsets = (size_t *) mdsl_alloc(sizeof(size_t) * (keys->n + 1));
+	size_t *lens = (size_t *) mdsl_alloc(sizeof(size_t) * (keys->n + 1));
+	size_t i, n = 0, offset = 0, total_len = 0;
+
+	for (i = 0; i < keys->n; i++)
+	{
+		order[i] = i;
+		total_len += keys->lens[i];
+	}
+	bench_sort_keys_target = keys;
+	qsort(order, keys->n, sizeof(size_t), bench_key_cmp);
+
+	//Lay out the keys in sorted order too
+	char *data = (char *) mdsl_alloc(total_len + 1);
+	for (i = 0; i < keys->n; i++)
+	{
+		if (i > 0 && bench_key_cmp(order + i, order + i - 1) == 0)
+			continue;
+		offsets[n] = offset;
+		lens[n] = keys->lens[order[i]];
+		memcpy(data + offset, bench_key(keys, order[i]), lens[n]);
+		offset += lens[n];
+		n++;
+	}
+
+	free(order);
+	free(keys->data);
+	keys->data = data;
+	free(keys->offsets);
+	free(keys->lens);
+	keys->offsets = offsets;
+	keys->lens = lens;
+	keys->n = n;
+}
+
+static int bench_double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+//Sorts latencies of single operations in seconds and prints percentiles
+static inline void bench_report_latency
+	(const char *name, double *samples, size_t n)
+{
+	qsort(samples, n, sizeof(double), bench_double_cmp);
+	printf("%-40s p50 %8.1f ns   p99 %8.1f ns   p99.9 %8.1f ns\n", name,
+			samples[n / 2] * 1e9, samples[n * 99 / 100] * 1e9, 
+			samples[n * 999 / 1000] * 1e9);
+	fflush(stdout);
+}
+
+#define bench_report(name, n_ops, secs) \
+	do { \
+		printf("%-40s %12.1f ns/op %14.0f ops/s\n", \
+				(name), (secs) * 1e9 / (n_ops), (n_ops) / (secs)); \
+		fflush(stdout); \
+	} while (0)
@@ -0,0 +1,507 @@
+/* bytemap.c
+ * Benchmarks for ByteMap, the child table of dictionary nodes, and the
+ * public maps with small integer keys built on it
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdsl/incl.h> //< Private header file
+
+#include <mdsl/private.h>
+
+#include "bench.h"
+
+//Enough maps to defeat branch prediction, few enough to stay in cache
+#define BENCH_N_MAPS 64
+#define BENCH_N_QUERIES 4096
+
+//One size per mode, from a single child to Node256
+static const int bench_sizes[] = {1, 3, 12, 40, 128, 240, 0};
+static const char *bench_mode_names[] =
+	{"empty", "single", "node4", "node16", "node48", "bitmap", "node256"};
+
+static uint8_t bench_values[256];
+
+//Maps of given size. keys[i] is a permutation of all bytes whose first
+//size entries are in map i.
+static ByteMap *bench_build_maps(int size, uint8_t (*keys)[256])
+{
+	ByteMap *maps = (ByteMap *) mdsl_alloc(sizeof(ByteMap) * BENCH_N_MAPS);
+	int i, j;
+
+	for (i = 0; i < BENCH_N_MAPS; i++)
+	{
+		for (j = 0; j < 256; j++)
+			keys[i][j] = j;
+		for (j = 0; j < 256; j++)
+		{
+			int k = j + bench_rand() % (256 - j);
+			uint8_t tmp = keys[i][j];
+			keys[i][j] = keys[i][k];
+			keys[i][k] = tmp;
+		}
+
+		byte_map_init(maps + i);
+		for (j = 0; j < size; j++)
+			byte_map_set(maps + i, keys[i][j], bench_values + keys[i][j]);
+	}
+
+	return maps;
+}
+
+//Map index times 256 plus key, for present or absent keys
+static void bench_make_queries
+	(uint16_t *queries, int size, uint8_t (*keys)[256], int present)
+{
+	int i;
+
+	for (i = 0; i < BENCH_N_QUERIES; i++)
+	{
+		int map = bench_rand() % BENCH_N_MAPS;
+		int pos = present ? bench_rand() % size 
+			: size + bench_rand() % (256 - size);
+		queries[i] = map * 256 + keys[map][pos];
+	}
+}
+
+static void bench_get(size_t n)
+{
+	uint8_t (*keys)[256] = mdsl_alloc(256 * BENCH_N_MAPS);
+	uint16_t *queries 
+		= (uint16_t *) mdsl_alloc(sizeof(uint16_t) * BENCH_N_QUERIES);
+	const char *kinds[3] = {"get hit", "get miss", "next"};
+	char name[64];
+	int s, k;
+	size_t i;
+
+	for (s = 0; bench_sizes[s]; s++)
+	{
+		int size = bench_sizes[s];
+		ByteMap *maps = bench_build_maps(size, keys);
+		int mode = byte_map_get_mode(maps);
+		uintptr_t sum = 0;
+
+		for (k = 0; k < 3; k++)
+		{
+			bench_make_queries(queries, size, keys, k != 1);
+
+			double start = bench_now();
+			if (k < 2)
+			{
+				for (i = 0; i < n; i++)
+				{
+					uint16_t q = queries[i % BENCH_N_QUERIES];
+					sum += (uintptr_t) byte_map_get(maps + q / 256, q % 256);
+				}
+			}
+			else
+			{
+				for (i = 0; i < n; i++)
+				{
+					uint16_t q = queries[i % BENCH_N_QUERIES];
+					uint8_t key;
+					sum += (uintptr_t) byte_map_next
+						(maps + q / 256, q % 256, &key);
+				}
+			}
+			double secs = bench_now() - start;
+
+			snprintf(name, sizeof(name), "%s, %d children: %s",
+					bench_mode_names[mode], size, kinds[k]);
+			bench_report(name, n, secs);
+		}
+
+		//Keeps the lookups from being optimized away
+		if (sum == 1)
+			printf("\n");
+
+		for (i = 0; i < BENCH_N_MAPS; i++)
+			byte_map_clear(maps + i);
+		free(maps);
+	}
+
+	free(queries);
+	free(keys);
+}
+
+//Maps grow to given size and shrink back to empty, in random key order
+static void bench_set(size_t n)
+{
+	uint8_t (*keys)[256] = mdsl_alloc(256 * BENCH_N_MAPS);
+	char name[64];
+	int s, j;
+	size_t i, round;
+
+	for (s = 0; bench_sizes[s]; s++)
+	{
+		int size = bench_sizes[s];
+		ByteMap *maps = bench_build_maps(size, keys);
+		int mode = byte_map_get_mode(maps);
+		size_t n_rounds = n / (size * BENCH_N_MAPS) + 1;
+		double set_secs = 0, remove_secs = 0;
+
+		for (i = 0; i < BENCH_N_MAPS; i++)
+		{
+			byte_map_clear(maps + i);
+			byte_map_init(maps + i);
+		}
+
+		for (round = 0; round < n_rounds; round++)
+		{
+			double start = bench_now();
+			for (i = 0; i < BENCH_N_MAPS; i++)
+			{
+				for (j = 0; j < size; j++)
+					byte_map_set(maps + i, keys[i][j],
+							bench_values + keys[i][j]);
+			}
+			set_secs += bench_now() - start;
+
+			//Different order than insertion
+			start = bench_now();
+			for (i = 0; i < BENCH_N_MAPS; i++)
+			{
+				for (j = size - 1; j >= 0; j--)
+					byte_map_set(maps + i, keys[i][(j * 7) % size], NULL);
+			}
+			remove_secs += bench_now() - start;
+		}
+
+		snprintf(name, sizeof(name), "%s, %d children: insert",
+				bench_mode_names[mode], size);
+		bench_report(name, n_rounds * size * BENCH_N_MAPS, set_secs);
+		snprintf(name, sizeof(name), "%s, %d children: remove",
+				bench_mode_names[mode], size);
+		bench_report(name, n_rounds * size * BENCH_N_MAPS, remove_secs);
+
+		free(maps);
+	}
+
+	free(keys);
+}
+
+//Open addressing hash table with linear probing, the usual hand-rolled
+//replacement for an id map
+typedef struct
+{
+	uint32_t *keys;
+	void **values;
+	size_t capacity, n_keys;
+} BenchHash;
+
+static size_t bench_hash_pos(BenchHash *hash, uint32_t key)
+{
+	size_t pos = ((uint64_t) key * 0x9e3779b97f4a7c15ULL) >> 32;
+	pos &= hash->capacity - 1;
+	while (hash->values[pos] && hash->keys[pos] != key)
+		pos = (pos + 1) & (hash->capacity - 1);
+	return pos;
+}
+
+static void bench_hash_init(BenchHash *hash)
+{
+	hash->capacity = 16;
+	hash->n_keys = 0;
+	hash->keys = (uint32_t *) mdsl_alloc(sizeof(uint32_t) * hash->capacity);
+	hash->values = (void **) mdsl_alloc(sizeof(void *) * hash->capacity);
+	memset(hash->values, 0, sizeof(void *) * hash->capacity);
+}
+
+static void bench_hash_set(BenchHash *hash, uint32_t key, void *value)
+{
+	size_t pos;
+
+	if (hash->n_keys * 2 >= hash->capacity)
+	{
+		BenchHash old = *hash;
+		size_t i;
+
+		hash->capacity *= 2;
+		hash->keys = (uint32_t *) mdsl_alloc(sizeof(uint32_t) * hash->capacity);
+		hash->values = (void **) mdsl_alloc(sizeof(void *) * hash->capacity);
+		memset(hash->values, 0, sizeof(void *) * hash->capacity);
+		for (i = 0; i < old.capacity; i++)
+		{
+			if (old.values[i])
+			{
+				pos = bench_hash_pos(hash, old.keys[i]);
+				hash->keys[pos] = old.keys[i];
+				hash->values[pos] = old.values[i];
+			}
+		}
+		free(old.keys);
+		free(old.values);
+	}
+
+	//Insertions only, removal would need tombstones
+	pos = bench_hash_pos(hash, key);
+	if (! hash->values[pos])
+		hash->n_keys++;
+	hash->keys[pos] = key;
+	hash->values[pos] = value;
+}
+
+static void *bench_hash_get(BenchHash *hash, uint32_t key)
+{
+	return hash->values[bench_hash_pos(hash, key)];
+}
+
+static void bench_hash_destroy(BenchHash *hash)
+{
+	free(hash->keys);
+	free(hash->values);
+}
+
+//Plain array indexed by key, grown to the largest key
+typedef struct
+{
+	void **values;
+	size_t len;
+} BenchArray;
+
+static void bench_array_init(BenchArray *array)
+{
+	array->values = NULL;
+	array->len = 0;
+}
+
+static void bench_array_set(BenchArray *array, uint32_t key, void *value)
+{
+	if (key >= array->len)
+	{
+		size_t len = array->len ? array->len : 16;
+		while (len <= key)
+			len *= 2;
+		array->values = (void **) mdsl_realloc
+			(array->values, sizeof(void *) * len);
+		memset(array->values + array->len, 0, 
+				sizeof(void *) * (len - array->len));
+		array->len = len;
+	}
+	array->values[key] = value;
+}
+
+static void *bench_array_get(BenchArray *array, uint32_t key)
+{
+	return key < array->len ? array->values[key] : NULL;
+}
+
+static void bench_array_destroy(BenchArray *array)
+{
+	free(array->values);
+}
+
+enum
+{
+	BENCH_IDS_ARRAY,
+	BENCH_IDS_MAP16,
+	BENCH_IDS_MAP32,
+	BENCH_IDS_HASH,
+	BENCH_IDS_N_KINDS
+};
+
+static const char *bench_ids_kind_names[] = 
+	{"array", "MdslByteMap16", "MdslByteMap32", "hash table"};
+
+//Builds a table of each kind over the ids, reports bytes per id and 
+//lookup time of present ids in random order
+static void bench_ids_run(const char *workload, uint32_t *ids, size_t n_ids,
+		size_t n, uint32_t max_id)
+{
+	size_t *order = bench_shuffle(n_ids);
+	uint32_t *queries = (uint32_t *) mdsl_alloc(sizeof(uint32_t) * n_ids);
+	char name[128];
+	int kind;
+	size_t i;
+
+	for (i = 0; i < n_ids; i++)
+		queries[i] = ids[order[i]];
+
+	for (kind = 0; kind < BENCH_IDS_N_KINDS; kind++)
+	{
+		BenchArray array[1];
+		MdslByteMap16 map16[1];
+		MdslByteMap32 map32[1];
+		BenchHash hash[1];
+		uintptr_t sum = 0;
+		size_t heap_before, bytes;
+		double start, secs;
+
+		//An array over 32-bit ids would not fit, a 16-bit map cannot hold them
+		if ((kind == BENCH_IDS_ARRAY && max_id >= (1 << 24))
+				|| (kind == BENCH_IDS_MAP16 && max_id > 0xffff))
+			continue;
+
+		heap_before = bench_heap_used();
+		switch (kind)
+		{
+		case BENCH_IDS_ARRAY:
+			bench_array_init(array);
+			for (i = 0; i < n_ids; i++)
+				bench_array_set(array, ids[i], bench_values + (i & 0xff));
+			break;
+		case BENCH_IDS_MAP16:
+			mdsl_byte_map16_init(map16);
+			for (i = 0; i < n_ids; i++)
+				mdsl_byte_map16_set(map16, ids[i], bench_values + (i & 0xff));
+			break;
+		case BENCH_IDS_MAP32:
+			mdsl_byte_map32_init(map32);
+			for (i = 0; i < n_ids; i++)
+				mdsl_byte_map32_set(map32, ids[i], bench_values + (i & 0xff));
+			break;
+		default:
+			bench_hash_init(hash);
+			for (i = 0; i < n_ids; i++)
+				bench_hash_set(hash, ids[i], bench_values + (i & 0xff));
+			break;
+		}
+		bytes = bench_heap_used() - heap_before;
+
+		start = bench_now();
+		switch (kind)
+		{
+		case BENCH_IDS_ARRAY:
+			for (i = 0; i < n; i++)
+				sum += (uintptr_t) bench_array_get(array, queries[i % n_ids]);
+			break;
+		case BENCH_IDS_MAP16:
+			for (i = 0; i < n; i++)
+				sum += (uintptr_t) mdsl_byte_map16_get
+					(map16, queries[i % n_ids]);
+			break;
+		case BENCH_IDS_MAP32:
+			for (i = 0; i < n; i++)
+				sum += (uintptr_t) mdsl_byte_map32_get
+					(map32, queries[i % n_ids]);
+			break;
+		default:
+			for (i = 0; i < n; i++)
+				sum += (uintptr_t) bench_hash_get(hash, queries[i % n_ids]);
+			break;
+		}
+		secs = bench_now() - start;
+
+		snprintf(name, sizeof(name), "%s, %s: get", 
+				workload, bench_ids_kind_names[kind]);
+		bench_report(name, n, secs);
+		printf("    %.1f bytes/id\n", (double) bytes / n_ids);
+
+		//Keeps the lookups from being optimized away
+		if (sum == 1)
+			printf("\n");
+
+		switch (kind)
+		{
+		case BENCH_IDS_ARRAY:
+			bench_array_destroy(array);
+			break;
+		case BENCH_IDS_MAP16:
+			mdsl_byte_map16_clear(map16);
+			break;
+		case BENCH_IDS_MAP32:
+			mdsl_byte_map32_clear(map32);
+			break;
+		default:
+			bench_hash_destroy(hash);
+			break;
+		}
+	}
+
+	free(queries);
+	free(order);
+}
+
+//Tables from ids to objects: file descriptors, mostly dense with some
+//closed, and 32-bit ids allocated in sequence with gaps or at random
+static void bench_ids(size_t n)
+{
+	size_t n_ids = 50000;
+	uint32_t *ids = (uint32_t *) mdsl_alloc(sizeof(uint32_t) * n_ids);
+	uint32_t id, max_id;
+	size_t i;
+
+	//About one descriptor in ten closed
+	for (i = 0, id = 3; i < 10000; i++, id++)
+	{
+		if (bench_rand() % 10 == 0)
+			id++;
+		ids[i] = id;
+	}
+	bench_ids_run("fds", ids, 10000, n, id);
+
+	//Ids handed out in order, a third of the objects gone
+	for (i = 0, id = 1000000; i < n_ids; i++)
+	{
+		id += 1 + bench_rand() % 2;
+		ids[i] = id;
+	}
+	bench_ids_run("sequential ids", ids, n_ids, n, id);
+
+	for (i = 0, max_id = 0; i < n_ids; i++)
+	{
+		ids[i] = bench_rand();
+		if (ids[i] > max_id)
+			max_id = ids[i];
+	}
+	bench_ids_run("random ids", ids, n_ids, n, max_id);
+
+	free(ids);
+}
+
+typedef struct
+{
+	const char *name;
+	void (*func)(size_t n);
+} Benchmark;
+
+static const Benchmark benchmarks[] =
+{
+	{"get", bench_get},
+	{"set", bench_set},
+	{"ids", bench_ids},
+	{NULL, NULL}
+};
+
+int main(int argc, char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : "all";
+	size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000;
+	int i, found = 0;
+
+	for (i = 0; benchmarks[i].name; i++)
+	{
+		if (strcmp(name, "all") == 0 || strcmp(name, benchmarks[i].name) == 0)
+		{
+			printf("== %s (%lu operations)\n", benchmarks[i].name,
+					(unsigned long) n);
+			benchmarks[i].func(n);
+			found = 1;
+		}
+	}
+
+	if (! found)
+	{
+		fprintf(stderr, "Usage: %s [all", argv[0]);
+		for (i = 0; benchmarks[i].name; i++)
+			fprintf(stderr, "|%s", benchmarks[i].name);
+		fprintf(stderr, "] [n_operations]\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1393 @@
+/* dict.c
+ * Benchmarks for dictionary
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdsl/mdsl.h>
+
+#include "bench.h"
+
+#include <pthread.h>
+
+static MdslDict *build_dict_with_flags
+	(BenchKeys *keys, const char *label, MdslDictFlags flags)
+{
+	size_t heap_used = bench_heap_used();
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	size_t i, key_bytes = 0;
+
+	double start = bench_now();
+	for (i = 0; i < keys->n; i++)
+		mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], keys->lens + i);
+	double secs = bench_now() - start;
+
+	char name[64];
+	snprintf(name, sizeof(name), "%s: insert", label);
+	bench_report(name, keys->n, secs);
+
+	for (i = 0; i < keys->n; i++)
+		key_bytes += keys->lens[i];
+	printf("%-40s %12.1f bytes/key %9.1f key bytes/key\n", name, 
+			(double) (bench_heap_used() - heap_used) / keys->n,
+			(double) key_bytes / keys->n);
+
+	return dict;
+}
+
+static MdslDict *build_dict(BenchKeys *keys, const char *label)
+{
+	return build_dict_with_flags(keys, label, 0);
+}
+
+//Lookup latency for hits in random order and for misses
+static void bench_lookup_keys(BenchKeys *keys, const char *label)
+{
+	MdslDict *dict = build_dict(keys, label);
+	size_t *order = bench_shuffle(keys->n);
+	size_t i, found = 0;
+	char name[64];
+
+	double start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		if (mdsl_dict_get(dict, bench_key(keys, k), keys->lens[k]))
+			found++;
+	}
+	double secs = bench_now() - start;
+	mdsl_assert(found == keys->n, "Lookup failed");
+	snprintf(name, sizeof(name), "%s: lookup hit", label);
+	bench_report(name, keys->n, secs);
+
+	//Flip last byte of every key to get (mostly) misses
+	char buf[4096];
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		size_t len = keys->lens[k];
+		memcpy(buf, bench_key(keys, k), len);
+		buf[len - 1] ^= 0x5a;
+		if (mdsl_dict_get(dict, buf, len))
+			found++;
+	}
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: lookup miss", label);
+	bench_report(name, keys->n, secs);
+
+	free(order);
+	mdsl_dict_unref(dict);
+}
+
+//Keys longer than a cache line, compared in long runs
+static void bench_long_keys(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_paths(keys, n, 40, 120);
+	bench_lookup_keys(keys, "paths 40-120");
+	bench_keys_destroy(keys);
+
+	bench_keys_paths(keys, n, 200, 400);
+	bench_lookup_keys(keys, "paths 200-400");
+	bench_keys_destroy(keys);
+
+	bench_keys_paths(keys, n / 10, 1500, 2500);
+	bench_lookup_keys(keys, "paths 1500-2500 (n/10)");
+	bench_keys_destroy(keys);
+}
+
+static void bench_lookup(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_lookup_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_routes(keys, n);
+	bench_lookup_keys(keys, "routes");
+	bench_keys_destroy(keys);
+}
+
+//Inserts and removes keys at random so that the dictionary size stays the same
+//Session keys like "session/Xy" coming and going under a shared prefix,
+//with about half of 128 possible children present in each node
+static void bench_churn_sessions(size_t n)
+{
+	MdslDict *dict = mdsl_dict_new();
+	MdslDictStats stats[1], before[1];
+	char present[128 * 128];
+	char key[16] = "session/??";
+	size_t i;
+
+	for (i = 0; i < 128 * 128; i++)
+	{
+		present[i] = bench_rand() % 2;
+		key[8] = 0x30 + i / 128;
+		key[9] = 0x30 + i % 128;
+		if (present[i])
+			mdsl_dict_set(dict, key, 10, present + i);
+	}
+
+	mdsl_dict_get_stats(dict, before, 0);
+	size_t n_allocs = bench_n_allocs;
+	double start = bench_now();
+	for (i = 0; i < n; i++)
+	{
+		size_t k = bench_rand() % (128 * 128);
+		present[k] = ! present[k];
+		key[8] = 0x30 + k / 128;
+		key[9] = 0x30 + k % 128;
+		mdsl_dict_set(dict, key, 10, present[k] ? present + k : NULL);
+	}
+	double secs = bench_now() - start;
+	mdsl_dict_get_stats(dict, stats, 0);
+
+	bench_report("churn: sessions", n, secs);
+	printf("%-40s %12.3f allocs/op\n", "churn: sessions", 
+			(double) (bench_n_allocs - n_allocs) / n);
+	printf("%-40s %12.3f grows/op %8.3f shrinks/op %8.3f resizes/op\n",
+			"churn: sessions, child tables", 
+			(double) (stats->n_map_grows - before->n_map_grows) / n,
+			(double) (stats->n_map_shrinks - before->n_map_shrinks) / n,
+			(double) (stats->n_map_resizes - before->n_map_resizes) / n);
+
+	mdsl_dict_unref(dict);
+}
+
+static void bench_churn(size_t n)
+{
+	BenchKeys keys[1];
+	MdslDict *dict = mdsl_dict_new();
+	char *present;
+	size_t i, n_ops = n * 4;
+
+	bench_keys_random(keys, n * 2, 8, 24);
+	present = (char *) mdsl_alloc(keys->n);
+	for (i = 0; i < keys->n; i++)
+	{
+		present[i] = (i % 2 == 0);
+		if (present[i])
+			mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], present + i);
+	}
+
+	size_t n_allocs = bench_n_allocs;
+	double start = bench_now();
+	for (i = 0; i < n_ops; i++)
+	{
+		size_t k = bench_rand() % keys->n;
+		present[k] = ! present[k];
+		mdsl_dict_set(dict, bench_key(keys, k), keys->lens[k], 
+				present[k] ? present + k : NULL);
+	}
+	double secs = bench_now() - start;
+	bench_report("churn: insert/remove", n_ops, secs);
+	printf("%-40s %12.3f allocs/op\n", "churn: insert/remove", 
+			(double) (bench_n_allocs - n_allocs) / n_ops);
+
+	size_t *order = bench_shuffle(keys->n);
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		void *res = mdsl_dict_get(dict, bench_key(keys, k), keys->lens[k]);
+		mdsl_assert((res != NULL) == present[k], "Lookup failed");
+	}
+	secs = bench_now() - start;
+	bench_report("churn: lookup after churn", keys->n, secs);
+
+	free(order);
+	free(present);
+	mdsl_dict_unref(dict);
+	bench_keys_destroy(keys);
+
+	bench_churn_sessions(n);
+}
+
+//Full ordered walk and repeated prefix scans
+static void bench_iter(size_t n)
+{
+	BenchKeys keys[1];
+	MdslDict *dict;
+	MdslDictIter iter[1];
+	size_t i, count;
+	double start, secs;
+
+	bench_keys_routes(keys, n);
+	dict = build_dict(keys, "routes");
+
+	mdsl_dict_iter_init(iter, dict);
+	count = 0;
+	start = bench_now();
+	while (mdsl_dict_iter_next(iter))
+		count++;
+	secs = bench_now() - start;
+	bench_report("iter: full walk, per key", count, secs);
+
+	//Prefixes like "route/10.1", selecting a few hundred keys each
+	size_t n_scans = 10000, n_visited = 0;
+	size_t n_allocs = bench_n_allocs;
+	char prefix[32];
+	start = bench_now();
+	for (i = 0; i < n_scans; i++)
+	{
+		int len = snprintf(prefix, sizeof(prefix), "route/%d.%d",
+				(int) (bench_rand() % 224), (int) (bench_rand() % 10));
+		mdsl_dict_iter_seek(iter, prefix, len);
+		while (mdsl_dict_iter_next(iter))
+			n_visited++;
+	}
+	secs = bench_now() - start;
+	bench_report("iter: prefix scan", n_scans, secs);
+	printf("%-40s %12.1f keys/scan %8.3f allocs/scan\n", "iter: prefix scan", 
+			(double) n_visited / n_scans, 
+			(double) (bench_n_allocs - n_allocs) / n_scans);
+
+	mdsl_dict_iter_destroy(iter);
+	mdsl_dict_unref(dict);
+	bench_keys_destroy(keys);
+}
+
+//Pagination: fetching a page at a random offset by selecting its first key
+//against skipping keys from the start, and counting keys under a prefix
+//against scanning them
+static void bench_paginate(size_t n)
+{
+	BenchKeys keys[1];
+	MdslDict *dict;
+	MdslDictIter iter[1];
+	size_t i, j, page_len = 50, n_visited;
+	double start, secs;
+
+	bench_keys_url_paths(keys, n);
+	dict = build_dict(keys, "url");
+	size_t n_keys = mdsl_dict_count_prefix(dict, "", 0);
+	mdsl_dict_iter_init(iter, dict);
+
+	size_t n_pages = 100000;
+	n_visited = 0;
+	start = bench_now();
+	for (i = 0; i < n_pages; i++)
+	{
+		mdsl_dict_iter_select(iter, bench_rand() % n_keys);
+		for (j = 0; j < page_len && mdsl_dict_iter_next(iter); j++)
+			n_visited++;
+	}
+	secs = bench_now() - start;
+	bench_report("paginate: select, per page", n_pages, secs);
+	mdsl_assert(n_visited > 0, "No keys visited");
+
+	//Skipping costs half the dictionary per page on average
+	size_t n_skip_pages = 20;
+	start = bench_now();
+	for (i = 0; i < n_skip_pages; i++)
+	{
+		size_t offset = bench_rand() % n_keys;
+		mdsl_dict_iter_seek(iter, "", 0);
+		for (j = 0; j < offset + page_len && mdsl_dict_iter_next(iter); j++)
+			n_visited++;
+	}
+	secs = bench_now() - start;
+	bench_report("paginate: skip, per page", n_skip_pages, secs);
+
+	size_t n_queries = 1000000;
+	start = bench_now();
+	for (i = 0; i < n_queries; i++)
+	{
+		size_t k = bench_rand() % keys->n;
+		mdsl_assert(mdsl_dict_rank(dict, bench_key(keys, k), keys->lens[k])
+				< n_keys, "Rank out of range");
+	}
+	secs = bench_now() - start;
+	bench_report("paginate: rank", n_queries, secs);
+
+	//Prefixes are keys cut in half, usually a few path components
+	size_t n_counted = 0;
+	start = bench_now();
+	for (i = 0; i < n_queries; i++)
+	{
+		size_t k = bench_rand() % keys->n;
+		n_counted += mdsl_dict_count_prefix
+			(dict, bench_key(keys, k), keys->lens[k] / 2);
+	}
+	secs = bench_now() - start;
+	bench_report("paginate: count_prefix", n_queries, secs);
+
+	size_t n_scans = 10000, n_scanned = 0;
+	start = bench_now();
+	for (i = 0; i < n_scans; i++)
+	{
+		size_t k = bench_rand() % keys->n;
+		mdsl_dict_iter_seek(iter, bench_key(keys, k), keys->lens[k] / 2);
+		while (mdsl_dict_iter_next(iter))
+			n_scanned++;
+	}
+	secs = bench_now() - start;
+	bench_report("paginate: count by scan", n_scans, secs);
+	printf("%-40s %12.1f keys/prefix %8.1f keys/scan\n", 
+			"paginate: count_prefix", (double) n_counted / n_queries,
+			(double) n_scanned / n_scans);
+
+	mdsl_dict_iter_destroy(iter);
+	mdsl_dict_unref(dict);
+	bench_keys_destroy(keys);
+}
+
+//Finding keywords in log text: one pass of the automaton against looking
+//up every substring up to the length of the longest keyword
+static void bench_scan_mode(MdslDict *dict, const char *text, size_t len,
+		size_t n_dense)
+{
+	char name[64];
+	double start = bench_now();
+	MdslDictScanner *scanner = mdsl_dict_scanner_new(dict, n_dense);
+	double secs = bench_now() - start;
+	snprintf(name, sizeof(name), "scan: build, dense %lu", 
+			(unsigned long) n_dense);
+	printf("%-40s %12.1f ms %12lu states\n", name, secs * 1e3,
+			(unsigned long) mdsl_dict_scanner_get_n_states(scanner));
+
+	start = bench_now();
+	size_t n_matches = mdsl_dict_scanner_scan(scanner, text, len, NULL, NULL);
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "scan: automaton, dense %lu", 
+			(unsigned long) n_dense);
+	printf("%-40s %12.1f MB/s %10.1f matches/KB\n", name, 
+			len / secs / 1e6, n_matches * 1e3 / len);
+
+	mdsl_dict_scanner_unref(scanner);
+}
+
+static void bench_scan(size_t n)
+{
+	BenchKeys words[1];
+	size_t n_keywords = n / 50, max_len = 0, i;
+
+	//Keywords are words of at least 5 letters, often rare ones, and 
+	//phrases of two words
+	bench_keys_words(words, n / 10);
+	MdslDict *dict = mdsl_dict_new();
+	for (i = 0; i < n_keywords; i++)
+	{
+		char phrase[32];
+		size_t k = bench_rand() % words->n;
+		size_t len = words->lens[k];
+		if (len < 5)
+		{
+			i--;
+			continue;
+		}
+		memcpy(phrase, bench_key(words, k), len);
+		if (i % 4 == 0)
+		{
+			size_t k2 = bench_rand() % words->n;
+			phrase[len++] = ' ';
+			memcpy(phrase + len, bench_key(words, k2), words->lens[k2]);
+			len += words->lens[k2];
+		}
+		mdsl_dict_set(dict, phrase, len, words);
+		max_len = len > max_len ? len : max_len;
+	}
+
+	size_t text_len = 32 << 20;
+	char *text = bench_text_log(words, text_len);
+
+	//Quadratic baseline on a slice of the text
+	size_t slice_len = 1 << 20, n_found = 0, j;
+	double start = bench_now();
+	for (i = 0; i < slice_len; i++)
+	{
+		for (j = 1; j <= max_len && i + j <= slice_len; j++)
+		{
+			if (mdsl_dict_get(dict, text + i, j))
+				n_found++;
+		}
+	}
+	double secs = bench_now() - start;
+	printf("%-40s %12.1f MB/s %10.1f matches/KB\n", "scan: get at every offset",
+			slice_len / secs / 1e6, n_found * 1e3 / slice_len);
+
+	bench_scan_mode(dict, text, text_len, 1);
+	bench_scan_mode(dict, text, text_len, 256);
+	bench_scan_mode(dict, text, text_len, 4096);
+	bench_scan_mode(dict, text, text_len, 65536);
+
+	free(text);
+	mdsl_dict_unref(dict);
+	bench_keys_destroy(words);
+}
+
+//Batched lookups against a loop of mdsl_dict_get()
+static void bench_get_many_keys(BenchKeys *keys, const char *label)
+{
+	MdslDict *dict = build_dict(keys, label);
+	size_t *order = bench_shuffle(keys->n);
+	size_t batch = 256;
+	const void **batch_keys = (const void **) mdsl_alloc(sizeof(void *) * batch);
+	size_t *batch_lens = (size_t *) mdsl_alloc(sizeof(size_t) * batch);
+	void **values = (void **) mdsl_alloc(sizeof(void *) * batch);
+	size_t i, j, found;
+	char name[64];
+	double start, secs;
+
+	found = 0;
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		if (mdsl_dict_get(dict, bench_key(keys, k), keys->lens[k]))
+			found++;
+	}
+	secs = bench_now() - start;
+	mdsl_assert(found == keys->n, "Lookup failed");
+	snprintf(name, sizeof(name), "%s: mdsl_dict_get loop", label);
+	bench_report(name, keys->n, secs);
+
+	found = 0;
+	start = bench_now();
+	for (i = 0; i < keys->n; i += batch)
+	{
+		size_t n = keys->n - i < batch ? keys->n - i : batch;
+		for (j = 0; j < n; j++)
+		{
+			size_t k = order[i + j];
+			batch_keys[j] = bench_key(keys, k);
+			batch_lens[j] = keys->lens[k];
+		}
+		mdsl_dict_get_many(dict, batch_keys, batch_lens, n, values);
+		for (j = 0; j < n; j++)
+		{
+			if (values[j])
+				found++;
+		}
+	}
+	secs = bench_now() - start;
+	mdsl_assert(found == keys->n, "Lookup failed");
+	snprintf(name, sizeof(name), "%s: mdsl_dict_get_many", label);
+	bench_report(name, keys->n, secs);
+
+	free(batch_keys);
+	free(batch_lens);
+	free(values);
+	free(order);
+	mdsl_dict_unref(dict);
+}
+
+static void bench_get_many(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_get_many_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_routes(keys, n);
+	bench_get_many_keys(keys, "routes");
+	bench_keys_destroy(keys);
+}
+
+//Bulk loading sorted keys against inserting them one by one
+typedef struct
+{
+	BenchKeys *keys;
+	size_t i;
+} BenchSource;
+
+static int bench_source_next(void *user_data, const void **key_return,
+		size_t *key_len_return, const void **value_return)
+{
+	BenchSource *source = (BenchSource *) user_data;
+	if (source->i >= source->keys->n)
+		return 0;
+	*key_return = bench_key(source->keys, source->i);
+	*key_len_return = source->keys->lens[source->i];
+	*value_return = source->keys->lens + source->i;
+	source->i++;
+	return 1;
+}
+
+static void bench_bulk_load_keys(BenchKeys *keys, const char *label)
+{
+	MdslDict *dict;
+	size_t i;
+	double start, secs;
+	char name[64];
+
+	bench_keys_sort(keys);
+
+	dict = mdsl_dict_new();
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+		mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], keys->lens + i);
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: sorted mdsl_dict_set", label);
+	bench_report(name, keys->n, secs);
+	mdsl_dict_unref(dict);
+
+	BenchSource source = {keys, 0};
+	dict = mdsl_dict_new();
+	start = bench_now();
+	if (mdsl_dict_bulk_load(dict, bench_source_next, &source) != MDSL_SUCCESS)
+		mdsl_error("Bulk loading failed");
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: mdsl_dict_bulk_load", label);
+	bench_report(name, keys->n, secs);
+	mdsl_dict_unref(dict);
+}
+
+static void bench_bulk_load(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_bulk_load_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_routes(keys, n);
+	bench_bulk_load_keys(keys, "routes");
+	bench_keys_destroy(keys);
+}
+
+//Parallel build from unsorted keys, wall clock time against thread count
+static void bench_build_parallel_keys(BenchKeys *keys, const char *label,
+		int max_threads)
+{
+	const void **key_ptrs = (const void **) mdsl_alloc
+		(sizeof(void *) * keys->n);
+	const void **values = (const void **) mdsl_alloc
+		(sizeof(void *) * keys->n);
+	MdslDict *dict;
+	size_t i;
+	int n_threads;
+	double start, secs, seq_secs;
+	char name[64];
+
+	for (i = 0; i < keys->n; i++)
+	{
+		key_ptrs[i] = bench_key(keys, i);
+		values[i] = keys->lens + i;
+	}
+
+	dict = mdsl_dict_new();
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+		mdsl_dict_set(dict, key_ptrs[i], keys->lens[i], values[i]);
+	seq_secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: mdsl_dict_set", label);
+	bench_report(name, keys->n, seq_secs);
+	mdsl_dict_unref(dict);
+
+	for (n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+	{
+		dict = mdsl_dict_new();
+		start = bench_now();
+		if (mdsl_dict_build_parallel(dict, key_ptrs, keys->lens, values,
+					keys->n, n_threads) != MDSL_SUCCESS)
+			mdsl_error("Parallel build failed");
+		secs = bench_now() - start;
+		snprintf(name, sizeof(name), "%s: build, %d threads",
+				label, n_threads);
+		bench_report(name, keys->n, secs);
+		printf("%-40s %12.2fx speedup\n", name, seq_secs / secs);
+		mdsl_dict_unref(dict);
+	}
+
+	free(key_ptrs);
+	free(values);
+}
+
+static void bench_build_parallel(size_t n)
+{
+	BenchKeys keys[1];
+	const char *env = getenv("BENCH_MAX_THREADS");
+	int max_threads = env ? atoi(env) : 8;
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_build_parallel_keys(keys, "random", max_threads);
+	bench_keys_destroy(keys);
+
+	//All keys start with '/', so there is a single partition
+	bench_keys_url_paths(keys, n);
+	bench_build_parallel_keys(keys, "url", max_threads);
+	bench_keys_destroy(keys);
+}
+
+//Lookups in a frozen image against the dictionary it was made from
+static void bench_freeze_keys(BenchKeys *keys, const char *label)
+{
+	MdslDict *dict = build_dict(keys, label);
+	size_t *order = bench_shuffle(keys->n);
+	size_t i, found;
+	double start, secs;
+	char name[64];
+
+	start = bench_now();
+	size_t image_len;
+	void *image = mdsl_dict_freeze(dict, NULL, NULL, &image_len);
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: freeze", label);
+	bench_report(name, keys->n, secs);
+	printf("%-40s %12.1f bytes/key\n", name, (double) image_len / keys->n);
+
+	found = 0;
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		if (mdsl_dict_get(dict, bench_key(keys, k), keys->lens[k]))
+			found++;
+	}
+	secs = bench_now() - start;
+	mdsl_assert(found == keys->n, "Lookup failed");
+	snprintf(name, sizeof(name), "%s: mdsl_dict_get", label);
+	bench_report(name, keys->n, secs);
+
+	found = 0;
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		if (mdsl_frozen_dict_get(image, bench_key(keys, k), keys->lens[k], 
+					NULL))
+			found++;
+	}
+	secs = bench_now() - start;
+	mdsl_assert(found == keys->n, "Lookup failed");
+	snprintf(name, sizeof(name), "%s: mdsl_frozen_dict_get", label);
+	bench_report(name, keys->n, secs);
+
+	free(image);
+	free(order);
+	mdsl_dict_unref(dict);
+}
+
+static void bench_freeze(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_freeze_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_routes(keys, n);
+	bench_freeze_keys(keys, "routes");
+	bench_keys_destroy(keys);
+}
+
+//Cost of polling statistics, and the statistics themselves
+static void bench_stats_keys(BenchKeys *keys, const char *label)
+{
+	MdslDict *dict = build_dict(keys, label);
+	MdslDictStats stats[1];
+	size_t i, n_polls = 1000000;
+	char name[64];
+	int j;
+
+	double start = bench_now();
+	for (i = 0; i < n_polls; i++)
+		mdsl_dict_get_stats(dict, stats, 0);
+	double secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: poll stats", label);
+	bench_report(name, n_polls, secs);
+
+	start = bench_now();
+	mdsl_dict_get_stats(dict, stats, 1);
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: walk stats", label);
+	bench_report(name, 1, secs);
+
+	printf("  keys %lu, nodes %lu, node bytes %lu, map bytes %lu, "
+			"total bytes %lu\n", 
+			(unsigned long) stats->n_keys, (unsigned long) stats->n_nodes,
+			(unsigned long) stats->node_bytes, (unsigned long) stats->map_bytes,
+			(unsigned long) stats->total_bytes);
+	printf("  %.1f bytes/key, average run %.1f bytes\n  map modes:",
+			stats->bytes_per_key, stats->avg_run_len);
+	for (j = 0; j < MDSL_DICT_N_MAP_MODES; j++)
+		printf(" %lu", (unsigned long) stats->map_modes[j]);
+	printf("\n  depths:");
+	for (j = 0; j < MDSL_DICT_N_DEPTHS; j++)
+		printf(" %lu", (unsigned long) stats->depths[j]);
+	printf("\n");
+
+	mdsl_dict_unref(dict);
+}
+
+static void bench_stats(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_stats_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_tokens(keys, n, 22);
+	bench_stats_keys(keys, "tokens");
+	bench_keys_destroy(keys);
+
+	bench_keys_routes(keys, n);
+	bench_stats_keys(keys, "routes");
+	bench_keys_destroy(keys);
+
+	bench_keys_paths(keys, n, 40, 120);
+	bench_stats_keys(keys, "paths 40-120");
+	bench_keys_destroy(keys);
+}
+
+//Lookup latency with and without the table over the first two bytes
+static void bench_root_table_keys(BenchKeys *keys, const char *label)
+{
+	MdslDictFlags modes[2] = {0, MDSL_DICT_ROOT_TABLE};
+	const char *mode_names[2] = {"plain", "root table"};
+	size_t *order = bench_shuffle(keys->n);
+	double *samples = (double *) mdsl_alloc(sizeof(double) * keys->n);
+	size_t i;
+	char name[64];
+	int m;
+
+	for (m = 0; m < 2; m++)
+	{
+		snprintf(name, sizeof(name), "%s, %s", label, mode_names[m]);
+		MdslDict *dict = build_dict_with_flags(keys, name, modes[m]);
+
+		double start = bench_now();
+		for (i = 0; i < keys->n; i++)
+		{
+			size_t k = order[i];
+			void *res = mdsl_dict_get(dict, bench_key(keys, k), keys->lens[k]);
+			mdsl_assert(res, "Lookup failed");
+		}
+		double secs = bench_now() - start;
+		snprintf(name, sizeof(name), "%s, %s: lookup hit", 
+				label, mode_names[m]);
+		bench_report(name, keys->n, secs);
+
+		//Timer overhead is included in every sample
+		for (i = 0; i < keys->n; i++)
+		{
+			size_t k = order[i];
+			double t = bench_now();
+			void *res = mdsl_dict_get(dict, bench_key(keys, k), keys->lens[k]);
+			samples[i] = bench_now() - t;
+			mdsl_assert(res, "Lookup failed");
+		}
+		bench_report_latency(name, samples, keys->n);
+
+		mdsl_dict_unref(dict);
+	}
+
+	free(samples);
+	free(order);
+}
+
+static void bench_root_table(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_root_table_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_random(keys, n / 100, 8, 24);
+	bench_root_table_keys(keys, "random 1%");
+	bench_keys_destroy(keys);
+}
+
+//Cost of writes while snapshots are alive. A new snapshot is taken every
+//interval writes, so that writes keep copying shared paths.
+static void bench_snapshot_writes(BenchKeys *keys, size_t interval)
+{
+	MdslDict *dict = mdsl_dict_new();
+	MdslDict *snapshot = NULL;
+	char *present;
+	size_t i, n_ops = keys->n * 2;
+	char name[64];
+
+	present = (char *) mdsl_alloc(keys->n);
+	for (i = 0; i < keys->n; i++)
+	{
+		present[i] = (i % 2 == 0);
+		if (present[i])
+			mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], present + i);
+	}
+
+	size_t heap = bench_heap_used();
+	double start = bench_now();
+	for (i = 0; i < n_ops; i++)
+	{
+		size_t k = bench_rand() % keys->n;
+		if (interval && i % interval == 0)
+		{
+			if (snapshot)
+				mdsl_dict_unref(snapshot);
+			snapshot = mdsl_dict_snapshot(dict);
+		}
+		present[k] = ! present[k];
+		mdsl_dict_set(dict, bench_key(keys, k), keys->lens[k], 
+				present[k] ? present + k : NULL);
+	}
+	double secs = bench_now() - start;
+	if (interval)
+		snprintf(name, sizeof(name), "snapshot: writes, every %lu", 
+				(unsigned long) interval);
+	else
+		snprintf(name, sizeof(name), "snapshot: writes, none");
+	bench_report(name, n_ops, secs);
+	printf("  heap growth %.1f MB\n", 
+			(double) (bench_heap_used() - heap) / (1024 * 1024));
+
+	if (snapshot)
+		mdsl_dict_unref(snapshot);
+	free(present);
+	mdsl_dict_unref(dict);
+}
+
+static void bench_snapshot(size_t n)
+{
+	BenchKeys keys[1];
+	MdslDict *dict, *snapshot;
+	size_t i, n_snapshots = 1000000;
+
+	bench_keys_random(keys, n, 8, 24);
+
+	bench_snapshot_writes(keys, 0);
+	bench_snapshot_writes(keys, 1000000);
+	bench_snapshot_writes(keys, 1000);
+	bench_snapshot_writes(keys, 10);
+
+	//Taking and dropping a snapshot of an unchanged dictionary
+	dict = build_dict(keys, "random");
+	double start = bench_now();
+	for (i = 0; i < n_snapshots; i++)
+	{
+		snapshot = mdsl_dict_snapshot(dict);
+		mdsl_dict_unref(snapshot);
+	}
+	double secs = bench_now() - start;
+	bench_report("snapshot: take and drop", n_snapshots, secs);
+
+	mdsl_dict_unref(dict);
+	bench_keys_destroy(keys);
+}
+
+//Session expiry: keys removed one by one in random order, and whole 
+//groups of keys removed by prefix
+static void bench_expire(size_t n)
+{
+	BenchKeys keys[1];
+	size_t i, n_groups = n / 100 + 1;
+	size_t offset = 0, max_len = 40;
+	char name[64];
+
+	bench_keys_init(keys, n, n * max_len);
+	for (i = 0; i < n; i++)
+	{
+		uint64_t r = bench_rand();
+		int len = snprintf(keys->data + offset, max_len, "session/%d/%08x",
+				(int) (i % n_groups), (unsigned int) r);
+		keys->offsets[i] = offset;
+		keys->lens[i] = len;
+		offset += len;
+	}
+
+	MdslDict *dict = mdsl_dict_new();
+	for (i = 0; i < keys->n; i++)
+		mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], keys->lens + i);
+
+	size_t *order = bench_shuffle(keys->n);
+	size_t n_allocs = bench_n_allocs;
+	double start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		size_t k = order[i];
+		mdsl_dict_set(dict, bench_key(keys, k), keys->lens[k], NULL);
+	}
+	double secs = bench_now() - start;
+	bench_report("expire: remove keys", keys->n, secs);
+	printf("%-40s %12.3f allocs/op\n", "expire: remove keys",
+			(double) (bench_n_allocs - n_allocs) / keys->n);
+
+	for (i = 0; i < keys->n; i++)
+		mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], keys->lens + i);
+
+	size_t n_removed = 0;
+	n_allocs = bench_n_allocs;
+	start = bench_now();
+	for (i = 0; i < n_groups; i++)
+	{
+		char prefix[32];
+		int len = snprintf(prefix, sizeof(prefix), "session/%d/", (int) i);
+		n_removed += mdsl_dict_remove_prefix(dict, prefix, len);
+	}
+	secs = bench_now() - start;
+	mdsl_assert(n_removed == keys->n, "Wrong number of keys removed");
+	snprintf(name, sizeof(name), "expire: remove by prefix");
+	bench_report(name, keys->n, secs);
+	printf("%-40s %12.3f allocs/op\n", name,
+			(double) (bench_n_allocs - n_allocs) / keys->n);
+
+	free(order);
+	mdsl_dict_unref(dict);
+	bench_keys_destroy(keys);
+}
+
+//Counting occurrences of keys: get then set, against one slot lookup
+static void bench_count_keys(BenchKeys *keys, const char *label)
+{
+	MdslDict *dict = mdsl_dict_new();
+	size_t i, n_ops = keys->n * 4;
+	char name[64];
+
+	//Keys repeat, so both inserts and updates are measured
+	size_t *order = (size_t *) mdsl_alloc(sizeof(size_t) * n_ops);
+	for (i = 0; i < n_ops; i++)
+		order[i] = bench_rand() % keys->n;
+
+	double start = bench_now();
+	for (i = 0; i < n_ops; i++)
+	{
+		size_t k = order[i];
+		char *count = (char *) mdsl_dict_get
+			(dict, bench_key(keys, k), keys->lens[k]);
+		mdsl_dict_set(dict, bench_key(keys, k), keys->lens[k], count + 1);
+	}
+	double secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: count with get/set", label);
+	bench_report(name, n_ops, secs);
+	mdsl_dict_unref(dict);
+
+	dict = mdsl_dict_new();
+	start = bench_now();
+	for (i = 0; i < n_ops; i++)
+	{
+		size_t k = order[i];
+		void **slot = mdsl_dict_lookup_slot
+			(dict, bench_key(keys, k), keys->lens[k], 1);
+		*slot = (char *) *slot + 1;
+	}
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: count with slot", label);
+	bench_report(name, n_ops, secs);
+	mdsl_dict_unref(dict);
+
+	dict = mdsl_dict_new_with_flags(MDSL_DICT_U64);
+	start = bench_now();
+	for (i = 0; i < n_ops; i++)
+	{
+		size_t k = order[i];
+		mdsl_dict_u64_add(dict, bench_key(keys, k), keys->lens[k], 1);
+	}
+	secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: count with u64", label);
+	bench_report(name, n_ops, secs);
+
+	uint64_t sum = 0, value;
+	start = bench_now();
+	for (i = 0; i < keys->n; i++)
+	{
+		if (mdsl_dict_u64_get(dict, bench_key(keys, i), keys->lens[i], &value))
+			sum += value;
+	}
+	secs = bench_now() - start;
+	//Keys may repeat in the list
+	mdsl_assert(sum >= n_ops, "Counts do not add up");
+	snprintf(name, sizeof(name), "%s: read u64 counts", label);
+	bench_report(name, keys->n, secs);
+	mdsl_dict_unref(dict);
+
+	free(order);
+}
+
+static void bench_count(size_t n)
+{
+	BenchKeys keys[1];
+
+	bench_keys_random(keys, n, 8, 24);
+	bench_count_keys(keys, "random");
+	bench_keys_destroy(keys);
+
+	bench_keys_url_paths(keys, n);
+	bench_count_keys(keys, "url");
+	bench_keys_destroy(keys);
+}
+
+//Longest prefix match against calling mdsl_dict_get() for every prefix
+static void bench_prefix_keys(BenchKeys *keys, BenchKeys *queries, 
+		const char *label)
+{
+	MdslDict *dict = build_dict(keys, label);
+	size_t i, len, found = 0, cfound = 0, matched_len;
+	char name[64];
+
+	double start = bench_now();
+	for (i = 0; i < queries->n; i++)
+	{
+		if (mdsl_dict_get_longest_prefix(dict, bench_key(queries, i), 
+					queries->lens[i], &matched_len))
+			found += matched_len;
+	}
+	double secs = bench_now() - start;
+	snprintf(name, sizeof(name), "%s: longest prefix", label);
+	bench_report(name, queries->n, secs);
+
+	start = bench_now();
+	for (i = 0; i < queries->n; i++)
+	{
+		for (len = queries->lens[i] + 1; len > 0; len--)
+		{
+			if (mdsl_dict_get(dict, bench_key(queries, i), len - 1))
+			{
+				cfound += len - 1;
+				break;
+			}
+		}
+	}
+	secs = bench_now() - start;
+	mdsl_assert(found == cfound, "Longest prefix match differs");
+	snprintf(name, sizeof(name), "%s: get per length", label);
+	bench_report(name, queries->n, secs);
+
+	mdsl_dict_unref(dict);
+}
+
+static void bench_prefix(size_t n)
+{
+	BenchKeys keys[1], queries[1];
+
+	bench_keys_addr_prefixes(keys, n, 1, 4);
+	bench_keys_extend(queries, keys, n, 4, NULL);
+	bench_prefix_keys(keys, queries, "ipv4");
+	bench_keys_destroy(keys);
+	bench_keys_destroy(queries);
+
+	bench_keys_addr_prefixes(keys, n, 2, 8);
+	bench_keys_extend(queries, keys, n, 16, NULL);
+	bench_prefix_keys(keys, queries, "ipv6");
+	bench_keys_destroy(keys);
+	bench_keys_destroy(queries);
+
+	bench_keys_url_paths(keys, n);
+	bench_keys_extend(queries, keys, n, 48, "abcdefgh/0123");
+	bench_prefix_keys(keys, queries, "url");
+	bench_keys_destroy(keys);
+	bench_keys_destroy(queries);
+}
+
+//Reader scaling with a concurrent writer.
+//Readers look up keys at even indices, the writer toggles keys at odd indices.
+typedef struct
+{
+	BenchKeys *keys;
+	MdslDict *dict;
+	pthread_mutex_t *lock;
+	size_t *order;
+	size_t first;
+	size_t n_ops;
+	int *stop;
+} ScaleThread;
+
+static void *scale_reader(void *data)
+{
+	ScaleThread *t = (ScaleThread *) data;
+	BenchKeys *keys = t->keys;
+	size_t i, found = 0;
+
+	for (i = 0; i < t->n_ops; i++)
+	{
+		size_t k = t->order[(t->first + i) % keys->n] & ~((size_t) 1);
+		void *res;
+		if (t->lock)
+			pthread_mutex_lock(t->lock);
+		res = mdsl_dict_get(t->dict, bench_key(keys, k), keys->lens[k]);
+		if (t->lock)
+			pthread_mutex_unlock(t->lock);
+		if (res)
+			found++;
+	}
+	mdsl_assert(found == t->n_ops, "Lookup failed");
+
+	return NULL;
+}
+
+static void *scale_writer(void *data)
+{
+	ScaleThread *t = (ScaleThread *) data;
+	BenchKeys *keys = t->keys;
+	size_t i;
+
+	for (i = 0; ! __atomic_load_n(t->stop, __ATOMIC_ACQUIRE); i++)
+	{
+		size_t k = t->order[i % keys->n] | 1;
+		if (k >= keys->n)
+			continue;
+		if (t->lock)
+			pthread_mutex_lock(t->lock);
+		mdsl_dict_set(t->dict, bench_key(keys, k), keys->lens[k], 
+				(i / keys->n) % 2 ? NULL : keys->lens + k);
+		if (t->lock)
+			pthread_mutex_unlock(t->lock);
+	}
+	t->n_ops = i;
+
+	return NULL;
+}
+
+static void bench_scale_mode(BenchKeys *keys, size_t *order, 
+		int max_threads, int concurrent)
+{
+	const char *label = concurrent ? "concurrent" : "mutex";
+	MdslDict *dict = mdsl_dict_new_with_flags
+		(concurrent ? MDSL_DICT_CONCURRENT : 0);
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	ScaleThread threads[max_threads + 1];
+	pthread_t ids[max_threads + 1];
+	size_t i, n_ops = keys->n;
+	int t, n_threads, stop;
+	char name[64];
+
+	for (i = 0; i < keys->n; i += 2)
+		mdsl_dict_set(dict, bench_key(keys, i), keys->lens[i], keys->lens + i);
+
+	for (n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+	{
+		stop = 0;
+		for (t = 0; t <= n_threads; t++)
+		{
+			threads[t].keys = keys;
+			threads[t].dict = dict;
+			threads[t].lock = concurrent ? NULL : &lock;
+			threads[t].order = order;
+			threads[t].first = (t * keys->n) / (n_threads + 1);
+			threads[t].n_ops = n_ops;
+			threads[t].stop = &stop;
+		}
+
+		double start = bench_now();
+		pthread_create(ids + n_threads, NULL, scale_writer, threads + n_threads);
+		for (t = 0; t < n_threads; t++)
+			pthread_create(ids + t, NULL, scale_reader, threads + t);
+		for (t = 0; t < n_threads; t++)
+			pthread_join(ids[t], NULL);
+		double secs = bench_now() - start;
+		__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+		pthread_join(ids[n_threads], NULL);
+
+		snprintf(name, sizeof(name), "scale: %s, %d readers", label, n_threads);
+		bench_report(name, n_ops * n_threads, secs);
+		printf("%-40s %12.0f writes/s\n", name, threads[n_threads].n_ops / secs);
+	}
+
+	mdsl_dict_unref(dict);
+}
+
+static void bench_scale(size_t n)
+{
+	BenchKeys keys[1];
+	const char *env = getenv("BENCH_MAX_THREADS");
+	int max_threads = env ? atoi(env) : 8;
+
+	bench_keys_random(keys, n, 8, 24);
+	size_t *order = bench_shuffle(keys->n);
+
+	bench_scale_mode(keys, order, max_threads, 0);
+	bench_scale_mode(keys, order, max_threads, 1);
+
+	free(order);
+	bench_keys_destroy(keys);
+}
+
+//Writer scaling: threads insert disjoint slices of the keys, either into
+//one dictionary behind one mutex or into a sharded dictionary.
+typedef struct
+{
+	BenchKeys *keys;
+	MdslDict *dict;
+	MdslShardedDict *sdict;
+	pthread_mutex_t *lock;
+	size_t begin, end;
+} ShardedThread;
+
+static void *sharded_writer(void *data)
+{
+	ShardedThread *t = (ShardedThread *) data;
+	BenchKeys *keys = t->keys;
+	size_t i;
+
+	for (i = t->begin; i < t->end; i++)
+	{
+		if (t->sdict)
+		{
+			mdsl_sharded_dict_set(t->sdict, bench_key(keys, i), keys->lens[i],
+					keys->lens + i);
+		}
+		else
+		{
+			pthread_mutex_lock(t->lock);
+			mdsl_dict_set(t->dict, bench_key(keys, i), keys->lens[i],
+					keys->lens + i);
+			pthread_mutex_unlock(t->lock);
+		}
+	}
+
+	return NULL;
+}
+
+static void bench_sharded_mode(BenchKeys *keys, int max_threads,
+		const char *label, int n_shards, MdslShardMode mode, int flags)
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	ShardedThread threads[max_threads];
+	pthread_t ids[max_threads];
+	int n_threads, i;
+	char name[64];
+
+	for (n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+	{
+		MdslDict *dict = NULL;
+		MdslShardedDict *sdict = NULL;
+
+		if (n_shards)
+			sdict = mdsl_sharded_dict_new(n_shards, mode, flags);
+		else
+			dict = mdsl_dict_new_with_flags(flags);
+
+		for (i = 0; i < n_threads; i++)
+		{
+			threads[i].keys = keys;
+			threads[i].dict = dict;
+			threads[i].sdict = sdict;
+			threads[i].lock = &lock;
+			threads[i].begin = (i * keys->n) / n_threads;
+			threads[i].end = ((i + 1) * keys->n) / n_threads;
+		}
+
+		double start = bench_now();
+		for (i = 0; i < n_threads; i++)
+			pthread_create(ids + i, NULL, sharded_writer, threads + i);
+		for (i = 0; i < n_threads; i++)
+			pthread_join(ids[i], NULL);
+		double secs = bench_now() - start;
+
+		snprintf(name, sizeof(name), "sharded: %s, %d writers",
+				label, n_threads);
+		bench_report(name, keys->n, secs);
+
+		//Merged ordered iteration over all shards, once
+		if (sdict && n_threads == 1)
+		{
+			MdslShardedDictIter iter[1];
+			size_t n_keys = 0;
+
+			start = bench_now();
+			mdsl_sharded_dict_iter_init(iter, sdict);
+			while (mdsl_sharded_dict_iter_next(iter))
+				n_keys++;
+			mdsl_sharded_dict_iter_destroy(iter);
+			secs = bench_now() - start;
+			mdsl_assert(n_keys == mdsl_sharded_dict_get_n_keys(sdict),
+					"Iteration missed keys");
+			snprintf(name, sizeof(name), "sharded: %s, ordered iter", label);
+			bench_report(name, n_keys, secs);
+		}
+
+		if (sdict)
+			mdsl_sharded_dict_unref(sdict);
+		else
+			mdsl_dict_unref(dict);
+	}
+}
+
+static void bench_sharded(size_t n)
+{
+	BenchKeys keys[1];
+	const char *env = getenv("BENCH_MAX_THREADS");
+	int max_threads = env ? atoi(env) : 8;
+
+	bench_keys_random(keys, n, 8, 24);
+
+	bench_sharded_mode(keys, max_threads, "one mutex",
+			0, MDSL_SHARD_BY_HASH, 0);
+	bench_sharded_mode(keys, max_threads, "hash x16",
+			16, MDSL_SHARD_BY_HASH, 0);
+	bench_sharded_mode(keys, max_threads, "hash x64",
+			64, MDSL_SHARD_BY_HASH, 0);
+	bench_sharded_mode(keys, max_threads, "first byte x16",
+			16, MDSL_SHARD_BY_FIRST_BYTE, 0);
+	bench_sharded_mode(keys, max_threads, "hash x16 concurrent",
+			16, MDSL_SHARD_BY_HASH, MDSL_DICT_CONCURRENT);
+
+	bench_keys_destroy(keys);
+}
+
+typedef struct
+{
+	const char *name;
+	void (*func)(size_t n);
+} Benchmark;
+
+static const Benchmark benchmarks[] = 
+{
+	{"lookup", bench_lookup},
+	{"long_keys", bench_long_keys},
+	{"churn", bench_churn},
+	{"iter", bench_iter},
+	{"paginate", bench_paginate},
+	{"scan", bench_scan},
+	{"get_many", bench_get_many},
+	{"bulk_load", bench_bulk_load},
+	{"build_parallel", bench_build_parallel},
+	{"freeze", bench_freeze},
+	{"prefix", bench_prefix},
+	{"count", bench_count},
+	{"expire", bench_expire},
+	{"stats", bench_stats},
+	{"snapshot", bench_snapshot},
+	{"root_table", bench_root_table},
+	{"scale", bench_scale},
+	{"sharded", bench_sharded},
+	{NULL, NULL}
+};
+
+int main(int argc, char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : "all";
+	size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	int i, found = 0;
+
+	for (i = 0; benchmarks[i].name; i++)
+	{
+		if (strcmp(name, "all") == 0 || strcmp(name, benchmarks[i].name) == 0)
+		{
+			printf("== %s (%lu keys)\n", benchmarks[i].name, (unsigned long) n);
+			benchmarks[i].func(n);
+			found = 1;
+		}
+	}
+
+	if (! found)
+	{
+		fprintf(stderr, "Usage: %s [all", argv[0]);
+		for (i = 0; benchmarks[i].name; i++)
+			fprintf(stderr, "|%s", benchmarks[i].name);
+		fprintf(stderr, "] [n_keys]\n");
+		return 1;
+	}
+
+	return 0;
+}
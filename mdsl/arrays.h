@@ -189,8 +189,8 @@ static inline TypeName array_type_name ## _pop(ArrayTypeName *array)\
 static inline void array_type_name ## _pop_n(ArrayTypeName *array, size_t n)\
 {\
 	if (array->len < n)\
-		mdsl_error("Too few elements to pop from queue(%d from %d)", \
-				n, array->len);\
+		mdsl_error("Too few elements to pop from queue(%lu from %lu)", \
+				(unsigned long) n, (unsigned long) array->len);\
 	array->start += n;\
 	array->len -= n;\
 	size_t new_alloc_len = array->len + MDSL_RBUF_MIN_LEN; \
@@ -212,6 +212,97 @@ static inline void array_type_name ## _destroy(ArrayTypeName *array)\
 }\
 typedef int MdslDynamicQueueEnd ## ArrayTypeName
 
+//Template for ring buffer queues. The capacity is a power of two, so that
+//positions wrap around by masking, and elements never move except when
+//the capacity changes. The capacity doubles when full and shrinks when less
+//than an eighth is used, leaving room for four times the elements, so that
+//a queue of steady depth with bursts does not keep reallocating.
+//Unlike dynamic array queues the elements are not contiguous, they are 
+//accessed through _get().
+#define mdsl_declare_ring(TypeName, ArrayTypeName, array_type_name) \
+typedef struct\
+{\
+	TypeName *data;\
+	size_t start, len, alloc_len;\
+} ArrayTypeName;\
+static inline void array_type_name ## _init(ArrayTypeName *array)\
+{\
+	array->start = array->len = 0;\
+	array->alloc_len = MDSL_RBUF_MIN_LEN;\
+	array->data = mdsl_alloc(array->alloc_len * sizeof(TypeName));\
+}\
+static inline size_t array_type_name ## _size(ArrayTypeName *array)\
+{\
+	return array->len;\
+}\
+static inline TypeName *array_type_name ## _get\
+	(ArrayTypeName *array, size_t i)\
+{\
+	return array->data + ((array->start + i) & (array->alloc_len - 1));\
+}\
+static inline TypeName *array_type_name ## _head(ArrayTypeName *array)\
+{\
+	return array->data + array->start;\
+}\
+static inline void array_type_name ## _realloc\
+	(ArrayTypeName *array, size_t new_alloc_len)\
+{\
+	TypeName *new_data = mdsl_alloc(sizeof(TypeName) * new_alloc_len);\
+	size_t first = array->alloc_len - array->start;\
+	if (first > array->len)\
+		first = array->len;\
+	memcpy(new_data, array->data + array->start, first * sizeof(TypeName));\
+	memcpy(new_data + first, array->data, \
+			(array->len - first) * sizeof(TypeName));\
+	free(array->data);\
+	array->data = new_data;\
+	array->alloc_len = new_alloc_len;\
+	array->start = 0;\
+}\
+static inline TypeName * array_type_name ## _alloc(ArrayTypeName *array)\
+{\
+	if (array->len == array->alloc_len)\
+		array_type_name ## _realloc(array, array->alloc_len * 2);\
+	TypeName *res = array_type_name ## _get(array, array->len);\
+	array->len++;\
+	return res;\
+}\
+static inline void array_type_name ## _push(ArrayTypeName *array, \
+		TypeName element)\
+{\
+	*array_type_name ## _alloc(array) = element;\
+}\
+static inline void array_type_name ## _pop_n(ArrayTypeName *array, size_t n)\
+{\
+	if (array->len < n)\
+		mdsl_error("Too few elements to pop from queue(%lu from %lu)", \
+				(unsigned long) n, (unsigned long) array->len);\
+	array->start = (array->start + n) & (array->alloc_len - 1);\
+	array->len -= n;\
+	if (array->alloc_len > MDSL_RBUF_MIN_LEN \
+			&& array->len < array->alloc_len / 8)\
+	{\
+		size_t new_alloc_len = array->alloc_len / 2;\
+		while (new_alloc_len > MDSL_RBUF_MIN_LEN \
+				&& array->len < new_alloc_len / 8)\
+			new_alloc_len /= 2;\
+		array_type_name ## _realloc(array, new_alloc_len);\
+	}\
+}\
+static inline TypeName array_type_name ## _pop(ArrayTypeName *array)\
+{\
+	if (array->len == 0)\
+		mdsl_error("Cannot pop from empty queue");\
+	TypeName res = *array_type_name ## _head(array);\
+	array_type_name ## _pop_n(array, 1);\
+	return res;\
+}\
+static inline void array_type_name ## _destroy(ArrayTypeName *array)\
+{\
+	free(array->data);\
+}\
+typedef int MdslRingEnd ## ArrayTypeName
+
 /**
  * \}
  */
@@ -0,0 +1,256 @@
+/* bytemap.c
+ * Compact maps with small integer keys
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#include "private.h"
+
+//8-bit keys
+void mdsl_byte_map_init(MdslByteMap *map)
+{
+	byte_map_init(map);
+}
+
+void mdsl_byte_map_clear(MdslByteMap *map)
+{
+	byte_map_clear(map);
+	byte_map_init(map);
+}
+
+void *mdsl_byte_map_get(MdslByteMap *map, uint8_t key)
+{
+	return byte_map_get(map, key);
+}
+
+void *mdsl_byte_map_set(MdslByteMap *map, uint8_t key, void *value)
+{
+	void *old = byte_map_get(map, key);
+	if (old != value)
+		byte_map_set(map, key, value);
+	return old;
+}
+
+void *mdsl_byte_map_next(MdslByteMap *map, int from, uint8_t *key_return)
+{
+	if (from > 255)
+		return NULL;
+	return byte_map_next(map, from < 0 ? 0 : from, key_return);
+}
+
+int mdsl_byte_map_get_size(MdslByteMap *map)
+{
+	return byte_map_get_size(map);
+}
+
+//Wider keys: one ByteMap per byte of the key, most significant first.
+//Maps of inner levels point to heap allocated maps of the next level,
+//which are freed as soon as they become empty.
+static void *byte_map_tree_get(ByteMap *m, uint32_t key, int n_levels)
+{
+	int level;
+
+	for (level = n_levels - 1; level > 0; level--)
+	{
+		m = (ByteMap *) byte_map_get(m, (key >> (level * 8)) & 0xff);
+		if (! m)
+			return NULL;
+	}
+
+	return byte_map_get(m, key & 0xff);
+}
+
+static void *byte_map_tree_set
+	(ByteMap *root, uint32_t key, int n_levels, void *value)
+{
+	ByteMap *path[4];
+	ByteMap *m = root;
+	void *old;
+	int level;
+
+	for (level = n_levels - 1; level > 0; level--)
+	{
+		uint8_t chr = (key >> (level * 8)) & 0xff;
+		ByteMap *next = (ByteMap *) byte_map_get(m, chr);
+		if (! next)
+		{
+			if (! value)
+				return NULL;
+			next = mdsl_new(ByteMap);
+			byte_map_init(next);
+			byte_map_set(m, chr, next);
+		}
+		path[level] = m;
+		m = next;
+	}
+
+	old = byte_map_get(m, key & 0xff);
+	if (old == value)
+		return old;
+	byte_map_set(m, key & 0xff, value);
+
+	//Free levels that became empty, the root stays
+	for (level = 1; level < n_levels && byte_map_get_size(m) == 0; level++)
+	{
+		byte_map_clear(m);
+		free(m);
+		m = path[level];
+		byte_map_set(m, (key >> (level * 8)) & 0xff, NULL);
+	}
+
+	return old;
+}
+
+//Smallest key not less than from in a map at given level, whose keys
+//are the low level + 1 bytes of the full key
+static void *byte_map_tree_next
+	(ByteMap *m, uint32_t from, int level, uint32_t *key_return)
+{
+	uint32_t chr_from = from >> (level * 8);
+	uint8_t chr;
+	void *res;
+
+	if (level == 0)
+	{
+		res = byte_map_next(m, chr_from, &chr);
+		if (res)
+			*key_return = chr;
+		return res;
+	}
+
+	//Only the first child is walked from the middle
+	from &= (((uint32_t) 1) << (level * 8)) - 1;
+	while ((res = byte_map_next(m, chr_from, &chr)))
+	{
+		uint32_t low_key;
+		void *value = byte_map_tree_next((ByteMap *) res,
+				chr == chr_from ? from : 0, level - 1, &low_key);
+		if (value)
+		{
+			*key_return = ((uint32_t) chr << (level * 8)) | low_key;
+			return value;
+		}
+		chr_from = chr + 1;
+		from = 0;
+	}
+
+	return NULL;
+}
+
+static void byte_map_tree_clear(ByteMap *m, int level)
+{
+	if (level > 0)
+	{
+		ByteMap *child;
+		uint8_t chr;
+		int from = 0;
+
+		while ((child = (ByteMap *) byte_map_next(m, from, &chr)))
+		{
+			byte_map_tree_clear(child, level - 1);
+			free(child);
+			from = chr + 1;
+		}
+	}
+
+	byte_map_clear(m);
+	byte_map_init(m);
+}
+
+//16-bit keys
+void mdsl_byte_map16_init(MdslByteMap16 *map)
+{
+	byte_map_init(&(map->root));
+	map->n_keys = 0;
+}
+
+void mdsl_byte_map16_clear(MdslByteMap16 *map)
+{
+	byte_map_tree_clear(&(map->root), 1);
+	map->n_keys = 0;
+}
+
+void *mdsl_byte_map16_get(MdslByteMap16 *map, uint16_t key)
+{
+	return byte_map_tree_get(&(map->root), key, 2);
+}
+
+void *mdsl_byte_map16_set(MdslByteMap16 *map, uint16_t key, void *value)
+{
+	void *old = byte_map_tree_set(&(map->root), key, 2, value);
+	map->n_keys += (value != NULL) - (old != NULL);
+	return old;
+}
+
+void *mdsl_byte_map16_next(MdslByteMap16 *map, uint32_t from,
+		uint16_t *key_return)
+{
+	uint32_t key;
+	void *value;
+
+	if (from > 0xffff)
+		return NULL;
+	value = byte_map_tree_next(&(map->root), from, 1, &key);
+	if (value)
+		*key_return = key;
+	return value;
+}
+
+size_t mdsl_byte_map16_get_size(MdslByteMap16 *map)
+{
+	return map->n_keys;
+}
+
+//32-bit keys
+void mdsl_byte_map32_init(MdslByteMap32 *map)
+{
+	byte_map_init(&(map->root));
+	map->n_keys = 0;
+}
+
+void mdsl_byte_map32_clear(MdslByteMap32 *map)
+{
+	byte_map_tree_clear(&(map->root), 3);
+	map->n_keys = 0;
+}
+
+void *mdsl_byte_map32_get(MdslByteMap32 *map, uint32_t key)
+{
+	return byte_map_tree_get(&(map->root), key, 4);
+}
+
+void *mdsl_byte_map32_set(MdslByteMap32 *map, uint32_t key, void *value)
+{
+	void *old = byte_map_tree_set(&(map->root), key, 4, value);
+	map->n_keys += (value != NULL) - (old != NULL);
+	return old;
+}
+
+void *mdsl_byte_map32_next(MdslByteMap32 *map, uint64_t from,
+		uint32_t *key_return)
+{
+	if (from > 0xffffffff)
+		return NULL;
+	return byte_map_tree_next(&(map->root), from, 3, key_return);
+}
+
+size_t mdsl_byte_map32_get_size(MdslByteMap32 *map)
+{
+	return map->n_keys;
+}
@@ -0,0 +1,226 @@
+/* bytemap.h
+ * Compact maps with small integer keys
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * A map from a byte to a non-NULL pointer, the child table of dictionary
+ * nodes. The layout adapts to the number of keys, from none at all for an
+ * empty map to a table of 256 pointers, so that memory stays proportional
+ * to the number of keys and lookups take constant time.
+ *
+ * The structure can be embedded, but its members are private.
+ * Maps are not thread safe.
+ */
+typedef struct
+{
+	void *ptr;
+	uint16_t metainf;
+	uint8_t capacity;
+} MdslByteMap;
+
+/**
+ * Initializes an empty map.
+ *
+ * \param map The map
+ */
+void mdsl_byte_map_init(MdslByteMap *map);
+
+/**
+ * Frees all memory held by the map, leaving it empty.
+ *
+ * \param map The map
+ */
+void mdsl_byte_map_clear(MdslByteMap *map);
+
+/**
+ * Looks up a key.
+ *
+ * \param map The map
+ * \param key The key
+ * \return The value, or NULL if the key is not in the map
+ */
+void *mdsl_byte_map_get(MdslByteMap *map, uint8_t key);
+
+/**
+ * Sets the value of a key.
+ *
+ * \param map The map
+ * \param key The key
+ * \param value The new value, or NULL to remove the key
+ * \return The previous value, or NULL if the key was not in the map
+ */
+void *mdsl_byte_map_set(MdslByteMap *map, uint8_t key, void *value);
+
+/**
+ * Finds the smallest key that is not less than given key, for walking
+ * the map in order.
+ *
+ * \param map The map
+ * \param from The smallest key to consider, 256 or more to find nothing.
+ *             Negative values are the same as 0.
+ * \param key_return Location to store the key found
+ * \return The value of the key found, or NULL if there is none
+ */
+void *mdsl_byte_map_next(MdslByteMap *map, int from, uint8_t *key_return);
+
+/**
+ * Returns the number of keys in the map.
+ *
+ * \param map The map
+ * \return Number of keys
+ */
+int mdsl_byte_map_get_size(MdslByteMap *map);
+
+/**
+ * A map from a 16-bit key to a non-NULL pointer, made of two levels of
+ * MdslByteMap indexed by the high and the low byte of the key. Keys that
+ * differ only in the low byte share a table, so dense ranges like file
+ * descriptors cost little more than a plain array, while sparse keys do
+ * not need a table covering every key.
+ *
+ * The structure can be embedded, but its members are private.
+ * Maps are not thread safe.
+ */
+typedef struct
+{
+	MdslByteMap root;
+	size_t n_keys;
+} MdslByteMap16;
+
+/**
+ * Initializes an empty map.
+ *
+ * \param map The map
+ */
+void mdsl_byte_map16_init(MdslByteMap16 *map);
+
+/**
+ * Frees all memory held by the map, leaving it empty.
+ *
+ * \param map The map
+ */
+void mdsl_byte_map16_clear(MdslByteMap16 *map);
+
+/**
+ * Looks up a key.
+ *
+ * \param map The map
+ * \param key The key
+ * \return The value, or NULL if the key is not in the map
+ */
+void *mdsl_byte_map16_get(MdslByteMap16 *map, uint16_t key);
+
+/**
+ * Sets the value of a key.
+ *
+ * \param map The map
+ * \param key The key
+ * \param value The new value, or NULL to remove the key
+ * \return The previous value, or NULL if the key was not in the map
+ */
+void *mdsl_byte_map16_set(MdslByteMap16 *map, uint16_t key, void *value);
+
+/**
+ * Finds the smallest key that is not less than given key, for walking
+ * the map in order.
+ *
+ * \param map The map
+ * \param from The smallest key to consider, 65536 or more to find nothing
+ * \param key_return Location to store the key found
+ * \return The value of the key found, or NULL if there is none
+ */
+void *mdsl_byte_map16_next(MdslByteMap16 *map, uint32_t from,
+		uint16_t *key_return);
+
+/**
+ * Returns the number of keys in the map.
+ *
+ * \param map The map
+ * \return Number of keys
+ */
+size_t mdsl_byte_map16_get_size(MdslByteMap16 *map);
+
+/**
+ * A map from a 32-bit key to a non-NULL pointer, made of four levels of
+ * MdslByteMap indexed by the bytes of the key, most significant first.
+ * Suited to identifiers that are allocated close to each other, like
+ * object or connection ids. Keys spread over the whole range cost a few
+ * small tables each.
+ *
+ * The structure can be embedded, but its members are private.
+ * Maps are not thread safe.
+ */
+typedef struct
+{
+	MdslByteMap root;
+	size_t n_keys;
+} MdslByteMap32;
+
+/**
+ * Initializes an empty map.
+ *
+ * \param map The map
+ */
+void mdsl_byte_map32_init(MdslByteMap32 *map);
+
+/**
+ * Frees all memory held by the map, leaving it empty.
+ *
+ * \param map The map
+ */
+void mdsl_byte_map32_clear(MdslByteMap32 *map);
+
+/**
+ * Looks up a key.
+ *
+ * \param map The map
+ * \param key The key
+ * \return The value, or NULL if the key is not in the map
+ */
+void *mdsl_byte_map32_get(MdslByteMap32 *map, uint32_t key);
+
+/**
+ * Sets the value of a key.
+ *
+ * \param map The map
+ * \param key The key
+ * \param value The new value, or NULL to remove the key
+ * \return The previous value, or NULL if the key was not in the map
+ */
+void *mdsl_byte_map32_set(MdslByteMap32 *map, uint32_t key, void *value);
+
+/**
+ * Finds the smallest key that is not less than given key, for walking
+ * the map in order.
+ *
+ * \param map The map
+ * \param from The smallest key to consider, 2^32 or more to find nothing
+ * \param key_return Location to store the key found
+ * \return The value of the key found, or NULL if there is none
+ */
+void *mdsl_byte_map32_next(MdslByteMap32 *map, uint64_t from,
+		uint32_t *key_return);
+
+/**
+ * Returns the number of keys in the map.
+ *
+ * \param map The map
+ * \return Number of keys
+ */
+size_t mdsl_byte_map32_get_size(MdslByteMap32 *map);
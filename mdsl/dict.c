@@ -21,74 +21,549 @@
 #include "incl.h"
 
 #include "private.h"
-
-#define MAX_NODE_LEN 32
-
+#include "epoch.h"
+
+#include <pthread.h>
+#include <limits.h>
+
+//Nodes hold the whole compressed run of key bytes inline, however long
+//A node may be shared by a dictionary and its snapshots. refcount is the
+//number of parents of the node, counting dictionaries it is the root of.
+//In MDSL_DICT_U64 mode the value is stored in value_u64 and has_u64 tells
+//whether it is present. Otherwise a value is present if it is not NULL.
+//Bits of an absent value are always zero.
+//has_u64 shares a word with len, which is never written after the node is
+//created, and not with refcount, which changes while snapshots read the node.
+//n_values is the number of counted values in the subtree, including the
+//node itself. Every value is counted, and so is the location last handed
+//out by mdsl_dict_lookup_slot() until the next modification settles it.
 typedef struct 
 {
-	const void *value;
+	union
+	{
+		const void *value;
+		uint64_t value_u64;
+	};
 	ByteMap next;
-	uint8_t len;
+	uint32_t len : 30;
+	uint32_t has_u64 : 1;
+	uint32_t counted : 1;
+	uint32_t refcount;
+	uint32_t n_values;
 	uint8_t ekey[];
 } DictNode;
 
+static inline int node_has_value(DictNode *node)
+{
+	return node->value || node->has_u64;
+}
+
+static inline void node_clear_value(DictNode *node)
+{
+	node->value_u64 = 0;
+	node->has_u64 = 0;
+	node->counted = 0;
+}
+
+static inline void node_copy_value(DictNode *dest, DictNode *src)
+{
+	dest->value_u64 = src->value_u64;
+	dest->has_u64 = src->has_u64;
+	dest->counted = src->counted;
+}
+
+//Node allocator.
+//Nodes are carved out of large chunks owned by the dictionary, and freed
+//nodes are kept in free lists, one for each value of len up to 
+//MAX_POOL_NODE_LEN. Longer nodes are allocated individually.
+//Memory is returned to the system only when the dictionary is destroyed.
+#define NODE_CHUNK_SIZE 65536
+#define MAX_POOL_NODE_LEN 32
+
+typedef struct _DictNodeChunk DictNodeChunk;
+struct _DictNodeChunk
+{
+	DictNodeChunk *next;
+};
+
+typedef struct _DictFreeNode DictFreeNode;
+struct _DictFreeNode
+{
+	DictFreeNode *next;
+};
+
+typedef struct
+{
+	DictNodeChunk *chunks;
+	char *bump;
+	size_t bump_left;
+	DictFreeNode *free_lists[MAX_POOL_NODE_LEN + 1];
+	//Bytes in chunks and long nodes
+	size_t reserved;
+} DictNodePool;
+
+//Memory that readers may still see in concurrent mode
+typedef struct
+{
+	void *ptr;
+	unsigned long epoch;
+	int is_node;
+} DictRetired;
+
+mdsl_declare_ring(DictRetired, DictRetiredQueue, dict_retired_queue);
+
+//Memory of nodes, shared by a dictionary and its snapshots.
+//While it is shared, writers hold the lock.
+typedef struct
+{
+	int refcount;
+	pthread_mutex_t lock;
+	DictNodePool pool;
+
+	//Counters that are cheap to maintain, except n_keys
+	MdslDictStats stats;
+} DictStore;
+
+//Internal flag for read only snapshots
+#define DICT_SNAPSHOT ((MdslDictFlags) (1 << 16))
+
+//Direct indexed table over the first two bytes of keys, for 
+//MDSL_DICT_ROOT_TABLE mode. nodes[b0 * 256 + b1] is the child for b1 of 
+//the child for b0 of root, if the latter has an empty run, and NULL 
+//otherwise. rows[b0] is the child for b0 the row was built from.
+typedef struct
+{
+	DictNode *rows[256];
+	DictNode *nodes[65536];
+} DictRootTable;
+
 struct _MdslDict
 {
 	MdslRC parent;
-	DictNode root;
+	DictNode *root;
+	DictStore *store;
+	MdslDictFlags flags;
+	size_t n_keys;
+
+	//Allocated when first needed
+	DictRootTable *table;
+
+	//Reusable memory for paths and stacks of nodes, never shrinks
+	MdslRBuf scratch;
+
+	//Node of the location last returned by mdsl_dict_lookup_slot() and
+	//a copy of its key, until the next modification
+	DictNode *slot_node;
+	MdslRBuf slot_key;
+
+	//Concurrent mode only
+	pthread_mutex_t lock;
+	DictRetiredQueue retired;
 };
 
 mdsl_rc_define(MdslDict, mdsl_dict);
 
 mdsl_declare_array(DictNode *, DictNodeArray, dict_node_array);
 
+//Grows a resizable buffer without ever shrinking it
+static void dict_rbuf_reserve(MdslRBuf *buf, size_t len)
+{
+	if (buf->alloc_len < len)
+	{
+		buf->alloc_len = (2 * buf->alloc_len) + len;
+		buf->data = (char *) mdsl_realloc(buf->data, buf->alloc_len);
+	}
+}
+
+static inline DictNode **dict_scratch_reserve(MdslDict *dict, size_t n)
+{
+	dict_rbuf_reserve(&(dict->scratch), n * sizeof(DictNode *));
+	return (DictNode **) dict->scratch.data;
+}
+
+static inline int dict_is_shared(MdslDict *dict)
+{
+	return __atomic_load_n(&(dict->store->refcount), __ATOMIC_ACQUIRE) > 1;
+}
+
+//Returns whether the lock was taken
+static int dict_store_lock(MdslDict *dict)
+{
+	if (! dict_is_shared(dict))
+		return 0;
+	pthread_mutex_lock(&(dict->store->lock));
+	return 1;
+}
+
+static void dict_store_unlock(MdslDict *dict, int locked)
+{
+	if (locked)
+		pthread_mutex_unlock(&(dict->store->lock));
+}
+
+static void dict_settle_slot(MdslDict *dict);
+
+static int dict_write_begin(MdslDict *dict)
+{
+	int locked;
+
+	if (dict->flags & DICT_SNAPSHOT)
+		mdsl_error("Attempt to modify a snapshot of a dictionary");
+	locked = dict_store_lock(dict);
+	dict_settle_slot(dict);
+	return locked;
+}
+
+//Root of the dictionary as seen by readers
+static inline DictNode *dict_root(MdslDict *dict)
+{
+	return __atomic_load_n(&(dict->root), __ATOMIC_ACQUIRE);
+}
+
+static inline size_t node_size(size_t len)
+{
+	size_t align = sizeof(void *);
+	size_t size = offsetof(DictNode, ekey) + len;
+	return (size + align - 1) - ((size + align - 1) % align);
+}
+
+static void node_pool_init(DictNodePool *pool)
+{
+	int i;
+	pool->chunks = NULL;
+	pool->bump = NULL;
+	pool->bump_left = 0;
+	pool->reserved = 0;
+	for (i = 0; i <= MAX_POOL_NODE_LEN; i++)
+		pool->free_lists[i] = NULL;
+}
+
+static void node_pool_destroy(DictNodePool *pool)
+{
+	DictNodeChunk *iter, *next;
+	for (iter = pool->chunks; iter; iter = next)
+	{
+		next = iter->next;
+		free(iter);
+	}
+}
+
+static DictNode *node_pool_alloc(DictNodePool *pool, size_t len)
+{
+	if (len > MAX_POOL_NODE_LEN)
+	{
+		pool->reserved += node_size(len);
+		return (DictNode *) mdsl_alloc(node_size(len));
+	}
+
+	DictFreeNode *fn = pool->free_lists[len];
+	if (fn)
+	{
+		pool->free_lists[len] = fn->next;
+		return (DictNode *) fn;
+	}
+
+	size_t size = node_size(len);
+	if (pool->bump_left < size)
+	{
+		size_t header_size = mdsl_offset_align(sizeof(DictNodeChunk));
+		DictNodeChunk *chunk = (DictNodeChunk *) mdsl_alloc(NODE_CHUNK_SIZE);
+		chunk->next = pool->chunks;
+		pool->chunks = chunk;
+		pool->bump = ((char *) chunk) + header_size;
+		pool->bump_left = NODE_CHUNK_SIZE - header_size;
+		pool->reserved += NODE_CHUNK_SIZE;
+	}
+
+	DictNode *res = (DictNode *) pool->bump;
+	pool->bump += size;
+	pool->bump_left -= size;
+	return res;
+}
+
+static void node_pool_free(DictNodePool *pool, DictNode *node)
+{
+	DictFreeNode *fn = (DictFreeNode *) node;
+	size_t len = node->len;
+	if (len > MAX_POOL_NODE_LEN)
+	{
+		pool->reserved -= node_size(len);
+		free(node);
+		return;
+	}
+	fn->next = pool->free_lists[len];
+	pool->free_lists[len] = fn;
+}
 
-static DictNode *alloc_node(const uint8_t *ekey, size_t len)
+//Takes over all memory of another pool, which is left empty
+static void node_pool_merge(DictNodePool *pool, DictNodePool *src)
 {
-	DictNode *dn = (DictNode *) mdsl_alloc(sizeof(DictNode) + len);
+	DictNodeChunk *last;
+	DictFreeNode *fn;
 	int i;
-	for (i = 0; i < len; i++)
-		dn->ekey[i] = ekey[i];
+
+	if (src->chunks)
+	{
+		for (last = src->chunks; last->next; last = last->next)
+			;
+		last->next = pool->chunks;
+		pool->chunks = src->chunks;
+	}
+
+	//Keep whichever bump region has more room
+	if (src->bump_left > pool->bump_left)
+	{
+		pool->bump = src->bump;
+		pool->bump_left = src->bump_left;
+	}
+
+	for (i = 0; i <= MAX_POOL_NODE_LEN; i++)
+	{
+		if (! src->free_lists[i])
+			continue;
+		for (fn = src->free_lists[i]; fn->next; fn = fn->next)
+			;
+		fn->next = pool->free_lists[i];
+		pool->free_lists[i] = src->free_lists[i];
+	}
+
+	pool->reserved += src->reserved;
+	node_pool_init(src);
+}
+
+//Memory reclamation for concurrent mode.
+//Memory is retired while the new root is being built, but stays reachable
+//until the root is published. Other dictionaries may advance the epoch
+//meanwhile, so it is stamped with the epoch only by dict_reclaim(), which
+//must follow every publication.
+#define DICT_EPOCH_UNSTAMPED ULONG_MAX
+
+static void dict_retire(MdslDict *dict, void *ptr, int is_node)
+{
+	DictRetired *retired = dict_retired_queue_alloc(&(dict->retired));
+	retired->ptr = ptr;
+	retired->epoch = DICT_EPOCH_UNSTAMPED;
+	retired->is_node = is_node;
+}
+
+static void dict_release(MdslDict *dict, DictRetired *retired)
+{
+	if (retired->is_node)
+		node_pool_free(&(dict->store->pool), (DictNode *) retired->ptr);
+	else
+		free(retired->ptr);
+}
+
+static void dict_reclaim(MdslDict *dict)
+{
+	DictRetired *retired;
+	size_t i;
+
+	//Readers that load the epoch after this cannot see the old root
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	unsigned long now = mdsl_epoch_get();
+	for (i = dict_retired_queue_size(&(dict->retired)); i > 0; i--)
+	{
+		retired = dict_retired_queue_get(&(dict->retired), i - 1);
+		if (retired->epoch != DICT_EPOCH_UNSTAMPED)
+			break;
+		retired->epoch = now;
+	}
+
+	unsigned long epoch = mdsl_epoch_try_advance();
+	while (dict_retired_queue_size(&(dict->retired)) > 0)
+	{
+		retired = dict_retired_queue_head(&(dict->retired));
+		if (retired->epoch + MDSL_EPOCH_GRACE > epoch)
+			break;
+		dict_release(dict, retired);
+		dict_retired_queue_pop_n(&(dict->retired), 1);
+	}
+}
+
+//Statistics of ByteMaps. Every change to the layout of a map in a live
+//node is bracketed by calls with add = 0 and add = 1.
+static inline void dict_count_map(MdslDict *dict, ByteMap *m, int add)
+{
+	int mode = byte_map_get_mode(m);
+	if (add)
+	{
+		dict->store->stats.map_modes[mode]++;
+		dict->store->stats.map_bytes += byte_map_storage_size(m);
+	}
+	else
+	{
+		dict->store->stats.map_modes[mode]--;
+		dict->store->stats.map_bytes -= byte_map_storage_size(m);
+	}
+}
+
+static inline void dict_map_set
+	(MdslDict *dict, ByteMap *m, uint8_t key, void *value)
+{
+	int mode = byte_map_get_mode(m);
+	size_t size = byte_map_storage_size(m);
+
+	dict_count_map(dict, m, 0);
+	byte_map_set(m, key, value);
+	dict_count_map(dict, m, 1);
+
+	//Changes that allocated or freed memory
+	int new_mode = byte_map_get_mode(m);
+	if (new_mode > mode && new_mode >= 2)
+		dict->store->stats.n_map_grows++;
+	else if (new_mode < mode && mode >= 2)
+		dict->store->stats.n_map_shrinks++;
+	else if (new_mode >= 2 && byte_map_storage_size(m) != size)
+		dict->store->stats.n_map_resizes++;
+}
+
+//Moves the map of a node that is about to be freed into another node
+static inline void dict_map_move(MdslDict *dict, ByteMap *dest, ByteMap *src)
+{
+	dict_count_map(dict, dest, 0);
+	*dest = *src;
+	dict_count_map(dict, dest, 1);
+}
+
+//Copies the map of a node that stays in use, children gain a parent
+static void dict_map_share(MdslDict *dict, ByteMap *dest, ByteMap *src)
+{
+	DictNode *child;
+	uint8_t chr;
+	int from = 0;
+
+	dict_count_map(dict, dest, 0);
+	byte_map_copy(dest, src);
+	dict_count_map(dict, dest, 1);
+	while ((child = (DictNode *) byte_map_next(src, from, &chr)))
+	{
+		child->refcount++;
+		from = chr + 1;
+	}
+}
+
+//Frees a node, but not memory owned by its ByteMap
+static void free_node(MdslDict *dict, DictNode *node)
+{
+	dict->store->stats.n_nodes--;
+	dict->store->stats.node_bytes -= node_size(node->len);
+	dict->store->stats.run_bytes -= node->len;
+	dict_count_map(dict, &(node->next), 0);
+
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		dict_retire(dict, node, 1);
+	else
+		node_pool_free(&(dict->store->pool), node);
+}
+
+//Frees memory owned by a ByteMap
+static void free_map(MdslDict *dict, ByteMap *m)
+{
+	void *storage = byte_map_storage(m);
+	if (storage && (dict->flags & MDSL_DICT_CONCURRENT))
+		dict_retire(dict, storage, 0);
+	else
+		byte_map_clear(m);
+}
+
+static DictNode *alloc_node(MdslDict *dict, const uint8_t *ekey, size_t len)
+{
+	mdsl_assert(len < (1 << 30), "Key too long");
+	DictNode *dn = node_pool_alloc(&(dict->store->pool), len);
+	if (ekey)
+		memcpy(dn->ekey, ekey, len);
 	dn->len = len;
-	dn->value = NULL;
+	dn->refcount = 1;
+	dn->n_values = 0;
+	node_clear_value(dn);
 	byte_map_init(&(dn->next));
 
+	dict->store->stats.n_nodes++;
+	dict->store->stats.node_bytes += node_size(len);
+	dict->store->stats.run_bytes += len;
+	dict_count_map(dict, &(dn->next), 1);
+
 	return dn;
 }
 
-static DictNode *create_node
-	(MdslDict *dict, const void *key, size_t key_len)
+//Counts the value just stored in the node at the end of the path.
+//The counted bit alone decides whether a value is in n_keys.
+static void dict_count_value(MdslDict *dict, DictNode **path, int depth)
+{
+	int i;
+
+	mdsl_assert(path[0]->n_values < UINT32_MAX, "Too many keys");
+	for (i = 0; i < depth; i++)
+		path[i]->n_values++;
+	path[depth - 1]->counted = 1;
+	dict->n_keys++;
+}
+
+//Stops counting the value of the node at the end of the path
+static void dict_uncount_value(MdslDict *dict, DictNode **path, int depth)
+{
+	int i;
+
+	if (! path[depth - 1]->counted)
+		return;
+	for (i = 0; i < depth; i++)
+		path[i]->n_values--;
+	path[depth - 1]->counted = 0;
+	dict->n_keys--;
+}
+
+
+//Sets the number of values under a node from its children
+static void node_recount(DictNode *node)
+{
+	DictNode *child;
+	uint8_t chr;
+	int from = 0;
+	size_t n_values = node_has_value(node);
+
+	node->counted = n_values;
+	while ((child = byte_map_next(&(node->next), from, &chr)))
+	{
+		n_values += child->n_values;
+		from = chr + 1;
+	}
+	mdsl_assert(n_values <= UINT32_MAX, "Too many keys");
+	node->n_values = n_values;
+}
+
+//Returns the node for the key, creating it if needed. Nodes on the path to
+//it are left in the scratch buffer, and their number in depth_return.
+static DictNode *create_node(MdslDict *dict, DictNode *root, 
+		const void *key, size_t key_len, int *depth_return)
 {
 	const uint8_t *ekey = (const uint8_t *) key;
+	//Every node on the path takes at least one byte of the key except root
+	DictNode **path = dict_scratch_reserve(dict, key_len + 1);
+	int depth = 1;
 
 	//Find the node to graft a branch
 	DictNode *target_ptr_node = NULL;
 	int target_ptr_chr = 0;
-	DictNode *target = &(dict->root);
-	int target_offset = 0;
+	DictNode *target = root;
+	size_t target_offset = 0;
+
+	size_t ekey_offset = 0;
 
-	int ekey_offset = 0;
+	path[0] = root;
 
 	while (target && ekey_offset < key_len)
 	{
-		int i;
-		int remains = key_len - ekey_offset;
-		int run_len = target->len;
+		size_t i;
+		size_t remains = key_len - ekey_offset;
+		size_t run_len = target->len;
 		if (run_len >= remains)
 		{
-			for (i = 0; i < remains; i++)
-			{
-				if (target->ekey[i] != ekey[ekey_offset + i])
-					break;
-			}
+			i = mdsl_mismatch(target->ekey, ekey + ekey_offset, remains);
 		}
 		else
 		{
-			for (i = 0; i < run_len; i++)
-			{
-				if (target->ekey[i] != ekey[ekey_offset + i])
-					break;
-			}
+			i = mdsl_mismatch(target->ekey, ekey + ekey_offset, run_len);
 			if (i == run_len)
 			{
 				DictNode *next = byte_map_get
@@ -98,6 +573,7 @@ static DictNode *create_node
 					target_ptr_node = target;
 					target_ptr_chr = ekey[ekey_offset + run_len];
 					target = next;
+					path[depth++] = next;
 					ekey_offset += run_len + 1;
 					continue;
 				}
@@ -117,96 +593,54 @@ static DictNode *create_node
 	}
 	else
 	{
-		mdsl_assert(target != &(dict->root),
+		mdsl_assert(target != root,
 				"Assertion failure (cannot split root node)");
 		//Splice target, second part --> start_node
-		DictNode *p1 = alloc_node(target->ekey, target_offset);
-		DictNode *p2 = alloc_node(target->ekey + target_offset + 1, 
+		DictNode *p1 = alloc_node(dict, target->ekey, target_offset);
+		DictNode *p2 = alloc_node(dict, target->ekey + target_offset + 1, 
 				target->len - target_offset - 1);
-		byte_map_set(&(p1->next), target->ekey[target_offset], p2);
+		dict_map_set(dict, &(p1->next), target->ekey[target_offset], p2);
 		start_node = p1;
-		p2->next = target->next;
-		p2->value = target->value;
-		byte_map_set(&(target_ptr_node->next), target_ptr_chr, p1);
+		dict_map_move(dict, &(p2->next), &(target->next));
+		node_copy_value(p2, target);
+		p1->n_values = p2->n_values = target->n_values;
+		dict_map_set(dict, &(target_ptr_node->next), target_ptr_chr, p1);
 		start_node = p1;
-		free(target);
+		free_node(dict, target);
+		path[depth - 1] = p1;
 	}
 
 	//Grow the new branch
 	DictNode *res = start_node;
 
-	while (ekey_offset < key_len)
+	if (ekey_offset < key_len)
 	{
-		int run_len = key_len - ekey_offset;
-		if (run_len > MAX_NODE_LEN + 1)
-			run_len = MAX_NODE_LEN + 1;
-
-		DictNode *ext = alloc_node(ekey + ekey_offset + 1, run_len - 1);
-		byte_map_set(&(res->next), ekey[ekey_offset], ext);
+		DictNode *ext = alloc_node(dict, ekey + ekey_offset + 1, 
+				key_len - ekey_offset - 1);
+		dict_map_set(dict, &(res->next), ekey[ekey_offset], ext);
 		res = ext;
-		ekey_offset += run_len;
+		path[depth++] = ext;
 	}
 
+	*depth_return = depth;
 	return res;
 }
 
-static void *collect_node(MdslDict *dict, const void *key, size_t key_len)
+//Removes nodes on the path that have neither a value nor children, and 
+//coalesces nodes that are left with a single child. 
+//The path ends at node for the key.
+static void collect_path(MdslDict *dict, DictNode **path, int depth,
+		const uint8_t *ekey, size_t key_len)
 {
-	const uint8_t *ekey = (const uint8_t *) key;
-	const uint8_t *lkey = ekey + key_len;
-	const void *res = NULL;
-	DictNodeArray array[1];
-	dict_node_array_init(array);
-
-	DictNode *iter = &(dict->root);
-
-	//Find the node and set the value
-	while (iter)
-	{
-		int remains = lkey - ekey;
-		int run_len = iter->len;
-		if (remains < run_len)
-		{
-			iter = NULL;
-			break;
-		}
-
-		int i;
-		for (i = 0; i < run_len; i++)
-		{
-			if (ekey[i] != iter->ekey[i])
-				break;
-		}
-		if (i < run_len)
-		{
-			iter = NULL;
-			break;
-		}
-
-		dict_node_array_append(array, iter);
-		if (remains == run_len)
-		{
-			res = iter->value;
-			iter->value = NULL;
-			break;
-		}
-		else
-		{
-			iter = byte_map_get(&(iter->next), ekey[run_len]);
-			ekey += run_len + 1;
-		}
-	}
-
-	ekey = (const uint8_t *) key;
-	int array_size = dict_node_array_size(array);
+	DictNode *iter = path[depth - 1];
 	while (iter)
 	{
 		DictNode *ptr_node;
 		uint8_t ptr_chr;
-		int reduce_len = iter->len + 1;
-		if (array_size > 1)
+		size_t reduce_len = iter->len + 1;
+		if (depth > 1)
 		{
-			ptr_node = array->data[array_size - 2];
+			ptr_node = path[depth - 2];
 			ptr_chr = ekey[key_len - reduce_len];
 		}
 		else
@@ -215,13 +649,11 @@ static void *collect_node(MdslDict *dict, const void *key, size_t key_len)
 			break;
 		}
 
-		mdsl_assert(ptr_node, "TMP: Assertion failure");
-
 		//Coalesc forwards if possible
 		do 
 		{
 			//Check if coalescing can be done
-			if (iter->value)
+			if (node_has_value(iter))
 				break;
 
 			if (byte_map_get_size(&(iter->next)) != 1)
@@ -231,98 +663,88 @@ static void *collect_node(MdslDict *dict, const void *key, size_t key_len)
 			DictNode *next;
 			byte_map_get_tuples(&(iter->next), &chr, (void **) &next);
 
-			int buf_len = iter->len + 1 + next->len;
-			if (buf_len > MAX_NODE_LEN)
-				break;
-
 			//Do the coalescing
-			uint8_t buf[MAX_NODE_LEN];
-
-			memcpy(buf, iter->ekey, iter->len);
-			buf[iter->len] = chr;
-			memcpy(buf + iter->len + 1, next->ekey, next->len);
-
-			DictNode *nn = alloc_node(buf, buf_len);
-			nn->next = next->next;
-			nn->value = next->value;
+			DictNode *nn = alloc_node(dict, NULL, iter->len + 1 + next->len);
+			memcpy(nn->ekey, iter->ekey, iter->len);
+			nn->ekey[iter->len] = chr;
+			memcpy(nn->ekey + iter->len + 1, next->ekey, next->len);
+			node_copy_value(nn, next);
+			nn->n_values = next->n_values;
 
 			//Amend the structure to replace the old nodes
-			byte_map_set(&(ptr_node->next), ptr_chr, nn);
+			dict_map_set(dict, &(ptr_node->next), ptr_chr, nn);
 
 			byte_map_clear(&(iter->next));
-			free(iter);
-			free(next);
+			free_node(dict, iter);
+			if (next->refcount > 1)
+			{
+				//Child is also part of a snapshot
+				dict_map_share(dict, &(nn->next), &(next->next));
+				next->refcount--;
+			}
+			else
+			{
+				dict_map_move(dict, &(nn->next), &(next->next));
+				free_node(dict, next);
+			}
 			iter = nn;
-			array->data[array_size - 1] = nn;
+			path[depth - 1] = nn;
 
 		} while(0);
 
 		//Check if this node should be freed
-		if ((iter->value) || byte_map_get_size(&(iter->next)) != 0)
+		if (node_has_value(iter) || byte_map_get_size(&(iter->next)) != 0)
 			break;
 
 		//Remove useless node	
-		byte_map_clear(&(iter->next));
-		free(iter);
+		free_map(dict, &(iter->next));
+		free_node(dict, iter);
 
 		//Correct data structures
-		byte_map_set(&(ptr_node->next), ptr_chr, NULL);
+		dict_map_set(dict, &(ptr_node->next), ptr_chr, NULL);
 
-		array_size--; 
-		if (array_size == 0)
+		depth--; 
+		if (depth == 0)
 			break;
-		iter = array->data[array_size - 1];
+		iter = path[depth - 1];
 		key_len -= reduce_len;
 	}
-
-
-	free(array->data);
-	return (void *) res;
-}
-
-void *mdsl_dict_set
-	(MdslDict *dict, const void *key, size_t key_len, const void *value)
-{
-	if (value)
-	{
-		DictNode *node = create_node(dict, key, key_len);
-		const void *old_value = node->value;
-		node->value = value;
-		return (void *) old_value;
-	}
-	else
-	{
-		return collect_node(dict, key, key_len);
-	}
 }
 
-void *mdsl_dict_get
-	(MdslDict *dict, const void *key, size_t key_len)
+//Removes the value of the key. Returns whether there was one, and copies 
+//it to old if given.
+static int collect_node(MdslDict *dict, DictNode *root, 
+		const void *key, size_t key_len, DictNode *old)
 {
 	const uint8_t *ekey = (const uint8_t *) key;
 	const uint8_t *lkey = ekey + key_len;
+	int res = 0;
+	//Every node on the path takes at least one byte of the key except root
+	DictNode **path = dict_scratch_reserve(dict, key_len + 1);
+	int depth = 0;
 
-	DictNode *iter = &(dict->root);
+	DictNode *iter = root;
 
+	//Find the node and set the value
 	while (iter)
 	{
-		int remains = lkey - ekey;
-		int run_len = iter->len;
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
 		if (remains < run_len)
-		{
-			return NULL;
-		}
+			return 0;
 
-		int i;
-		for (i = 0; i < run_len; i++)
-		{
-			if (ekey[i] != iter->ekey[i])
-				return NULL;
-		}
+		if (! mdsl_equal(ekey, iter->ekey, run_len))
+			return 0;
 
+		path[depth++] = iter;
 		if (remains == run_len)
 		{
-			return (void *) iter->value;
+			res = node_has_value(iter);
+			if (old)
+				node_copy_value(old, iter);
+			dict_uncount_value(dict, path, depth);
+			node_clear_value(iter);
+			break;
 		}
 		else
 		{
@@ -331,63 +753,2216 @@ void *mdsl_dict_get
 		}
 	}
 
-	return NULL;
+	if (iter)
+		collect_path(dict, path, depth, (const uint8_t *) key, key_len);
+
+	return res;
 }
 
-static void mdsl_dict_destroy(MdslDict *dict)
+typedef struct
 {
-	DictNodeArray stack[1];
-
-	dict_node_array_init(stack);
+	DictNode *node;
+	int release;
+} DictFreeFrame;
+
+//Drops a reference to the subtree. Nodes that are left without parents
+//are freed, and the walk stops at nodes that are still shared unless
+//values are to be counted. Returns number of values in the subtree if
+//count is set.
+static size_t free_subtree(MdslDict *dict, DictNode *top, int count)
+{
+	size_t n_values = 0, depth = 0;
+	DictFreeFrame *stack;
 
-	dict_node_array_append(stack, &(dict->root));
+	dict_rbuf_reserve(&(dict->scratch), sizeof(DictFreeFrame));
+	stack = (DictFreeFrame *) dict->scratch.data;
+	stack[depth].node = top;
+	stack[depth].release = 1;
+	depth++;
 
-	while (dict_node_array_size(stack) > 0)
+	while (depth > 0)
 	{
-		DictNode *node = dict_node_array_pop(stack);
-
-		uint8_t keys[256];
-		DictNode *values[256];
-		int n_tuples = byte_map_get_tuples
-			(&(node->next), keys, (void **) values);
-
-		int i;
-		for (i = 0; i < n_tuples; i++)
-			dict_node_array_append(stack, values[i]);
+		DictFreeFrame frame = stack[--depth];
+		DictNode *node = frame.node;
+		uint8_t chr;
+		DictNode *child;
+		int from = 0;
+
+		if (frame.release && --node->refcount > 0)
+			frame.release = 0;
+		if (! (frame.release || count))
+			continue;
+
+		if (node_has_value(node))
+			n_values++;
+
+		dict_rbuf_reserve(&(dict->scratch), sizeof(DictFreeFrame)
+				* (depth + byte_map_get_size(&(node->next))));
+		stack = (DictFreeFrame *) dict->scratch.data;
+		while ((child = byte_map_next(&(node->next), from, &chr)))
+		{
+			stack[depth].node = child;
+			stack[depth].release = frame.release;
+			depth++;
+			from = chr + 1;
+		}
 
-		byte_map_clear(&(node->next));
-		if (node != &(dict->root))
-			free(node);
+		if (frame.release)
+		{
+			free_map(dict, &(node->next));
+			free_node(dict, node);
+		}
 	}
 
-	free(stack->data);
-	free(dict);
+	return n_values;
+}
+
+static size_t remove_prefix
+	(MdslDict *dict, DictNode *root, const void *prefix, size_t prefix_len)
+{
+	const uint8_t *ekey = (const uint8_t *) prefix;
+	const uint8_t *lkey = ekey + prefix_len;
+	DictNode **path = dict_scratch_reserve(dict, prefix_len + 1);
+	int depth = 0;
+	size_t n_values;
+
+	//Find the first node whose key starts with the prefix
+	DictNode *iter = root;
+	while (iter)
+	{
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
+		path[depth++] = iter;
+		if (remains <= run_len)
+		{
+			if (! mdsl_equal(ekey, iter->ekey, remains))
+				return 0;
+			break;
+		}
+
+		if (! mdsl_equal(ekey, iter->ekey, run_len))
+			return 0;
+		iter = byte_map_get(&(iter->next), ekey[run_len]);
+		ekey += run_len + 1;
+	}
+	if (! iter)
+		return 0;
+
+	if (iter == root)
+	{
+		//Empty prefix, everything goes except root itself
+		n_values = node_has_value(root) ? 1 : 0;
+		DictNode *children[256];
+		uint8_t chrs[256];
+		int i, n = byte_map_get_tuples(&(root->next), chrs, (void **) children);
+		for (i = 0; i < n; i++)
+			n_values += free_subtree(dict, children[i], 1);
+		dict_count_map(dict, &(root->next), 0);
+		free_map(dict, &(root->next));
+		byte_map_init(&(root->next));
+		dict_count_map(dict, &(root->next), 1);
+		node_clear_value(root);
+		dict->n_keys -= root->n_values;
+		root->n_values = 0;
+		return n_values;
+	}
+
+	//Unlink the subtree, tidy up the path, then free the subtree
+	size_t parent_len = ekey - (const uint8_t *) prefix - 1;
+	DictNode *parent = path[depth - 2];
+	int i;
+	for (i = 0; i < depth - 1; i++)
+		path[i]->n_values -= iter->n_values;
+	dict->n_keys -= iter->n_values;
+	dict_map_set(dict, &(parent->next), ekey[-1], NULL);
+	collect_path(dict, path, depth - 1, (const uint8_t *) prefix, parent_len);
+
+	return free_subtree(dict, iter, 1);
+}
+
+static void *dict_set_in(MdslDict *dict, DictNode *root,
+		const void *key, size_t key_len, const void *value)
+{
+	if (value)
+	{
+		int depth;
+		DictNode *node = create_node(dict, root, key, key_len, &depth);
+		const void *old_value = node->value;
+		node->value = value;
+		if (! node->counted)
+			dict_count_value(dict, (DictNode **) dict->scratch.data, depth);
+		return (void *) old_value;
+	}
+	else
+	{
+		DictNode old;
+		old.value = NULL;
+		collect_node(dict, root, key, key_len, &old);
+		return (void *) old.value;
+	}
+}
+
+static void *dict_lookup(DictNode *root, const void *key, size_t key_len);
+static inline DictNode *dict_lookup_node
+	(DictNode *root, const void *key, size_t key_len);
+
+//Copies the nodes that a lookup of the key would visit, so that they can be
+//modified without affecting readers, and retires the originals.
+//Returns the new root.
+static DictNode *dict_copy_path
+	(MdslDict *dict, const void *key, size_t key_len)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	const uint8_t *lkey = ekey + key_len;
+	DictNode *iter = dict->root;
+	DictNode *root = NULL, *parent = NULL;
+	uint8_t parent_chr = 0;
+
+	while (iter)
+	{
+		DictNode *copy = alloc_node(dict, iter->ekey, iter->len);
+		node_copy_value(copy, iter);
+		copy->n_values = iter->n_values;
+		dict_count_map(dict, &(copy->next), 0);
+		byte_map_copy(&(copy->next), &(iter->next));
+		dict_count_map(dict, &(copy->next), 1);
+		if (parent)
+			dict_map_set(dict, &(parent->next), parent_chr, copy);
+		else
+			root = copy;
+
+		//Everything needed from the original is read before it goes
+		DictNode *old = iter;
+		size_t remains = lkey - ekey;
+		size_t run_len = old->len;
+		if (remains <= run_len || ! mdsl_equal(ekey, old->ekey, run_len))
+		{
+			iter = NULL;
+		}
+		else
+		{
+			parent = copy;
+			parent_chr = ekey[run_len];
+			iter = byte_map_get(&(old->next), parent_chr);
+			ekey += run_len + 1;
+		}
+
+		free_map(dict, &(old->next));
+		free_node(dict, old);
+	}
+
+	return root;
+}
+
+//Replaces shared nodes that a lookup of the key would visit with private
+//copies, so that they can be modified without affecting snapshots.
+static void dict_unshare_path
+	(MdslDict *dict, const void *key, size_t key_len)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	const uint8_t *lkey = ekey + key_len;
+	DictNode *iter = dict->root;
+	DictNode *parent = NULL;
+	uint8_t parent_chr = 0;
+
+	while (iter)
+	{
+		if (iter->refcount > 1)
+		{
+			DictNode *copy = alloc_node(dict, iter->ekey, iter->len);
+			node_copy_value(copy, iter);
+			copy->n_values = iter->n_values;
+			dict_map_share(dict, &(copy->next), &(iter->next));
+			iter->refcount--;
+			if (parent)
+				dict_map_set(dict, &(parent->next), parent_chr, copy);
+			else
+				dict->root = copy;
+			iter = copy;
+		}
+
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
+		if (remains <= run_len || ! mdsl_equal(ekey, iter->ekey, run_len))
+			break;
+
+		parent = iter;
+		parent_chr = ekey[run_len];
+		iter = byte_map_get(&(iter->next), parent_chr);
+		ekey += run_len + 1;
+	}
+}
+
+//Root table maintenance
+static void dict_table_build_row(MdslDict *dict, int b0)
+{
+	DictRootTable *table = dict->table;
+	DictNode **row = table->nodes + (b0 << 8);
+	DictNode *node = byte_map_get(&(dict->root->next), b0);
+	DictNode *child;
+	uint8_t chr;
+	int from = 0;
+
+	table->rows[b0] = node;
+	memset(row, 0, 256 * sizeof(DictNode *));
+	if (! node || node->len != 0)
+		return;
+	while ((child = byte_map_next(&(node->next), from, &chr)))
+	{
+		row[chr] = child;
+		from = chr + 1;
+	}
+}
+
+//Brings the table up to date after a change to the path of the key, or
+//to all of the dictionary if full is set. A change to the empty key only
+//touches the value of root and never needs the table.
+//Nodes on the path are replaced by new nodes allocated before the old 
+//ones are freed, so a row whose child for b0 is still the same node only 
+//differs in the entry for the second byte of the key.
+static void dict_table_update
+	(MdslDict *dict, const void *key, size_t key_len, int full)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	DictRootTable *table = dict->table;
+	int b0;
+
+	if (! (dict->flags & MDSL_DICT_ROOT_TABLE))
+		return;
+
+	if (! table)
+	{
+		if (byte_map_get_size(&(dict->root->next)) == 0)
+			return;
+		table = dict->table = (DictRootTable *) 
+			mdsl_alloc(sizeof(DictRootTable));
+		full = 1;
+	}
+
+	if (full)
+	{
+		for (b0 = 0; b0 < 256; b0++)
+			dict_table_build_row(dict, b0);
+		return;
+	}
+	if (key_len == 0)
+		return;
+
+	DictNode *node = byte_map_get(&(dict->root->next), ekey[0]);
+	if (node != table->rows[ekey[0]])
+		dict_table_build_row(dict, ekey[0]);
+	else if (node && node->len == 0 && key_len >= 2)
+		table->nodes[(ekey[0] << 8) | ekey[1]] 
+			= byte_map_get(&(node->next), ekey[1]);
+}
+
+//Node to continue a lookup from after the first two bytes of the key, or
+//NULL if the table does not help
+static inline DictNode *dict_table_get
+	(DictRootTable *table, const void *key, size_t key_len)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	if (! table || key_len < 2)
+		return NULL;
+	return table->nodes[(ekey[0] << 8) | ekey[1]];
+}
+
+//A location handed out by mdsl_dict_lookup_slot() is counted as a key
+//right away. If it was left NULL, the key is removed before the next 
+//modification, while the path to it is still as it was handed out.
+static void dict_settle_slot(MdslDict *dict)
+{
+	DictNode *node = dict->slot_node;
+
+	if (! node)
+		return;
+	dict->slot_node = NULL;
+	if (node_has_value(node))
+		return;
+	collect_node(dict, dict->root, 
+			dict->slot_key.data, dict->slot_key.len, NULL);
+	dict_table_update(dict, dict->slot_key.data, dict->slot_key.len, 0);
+}
+
+//Writers in concurrent mode never modify memory reachable from the
+//published root. They work on a private copy of the path and publish it
+//by swapping the root. Writers to a dictionary that shares nodes with 
+//snapshots first take private copies of shared nodes on the path.
+//Returns the root to apply the change to, or NULL if there is no node for
+//the key and insert is not set, in which case there is nothing to change.
+//Must be followed by dict_modify_end().
+static DictNode *dict_modify_begin(MdslDict *dict, 
+		const void *key, size_t key_len, int insert, int *locked_return)
+{
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+	{
+		pthread_mutex_lock(&(dict->lock));
+		*locked_return = 1;
+		if (! (insert || dict_lookup_node(dict->root, key, key_len)))
+			return NULL;
+		return dict_copy_path(dict, key, key_len);
+	}
+
+	*locked_return = dict_write_begin(dict);
+	if (*locked_return)
+	{
+		if (! (insert || dict_lookup_node(dict->root, key, key_len)))
+			return NULL;
+		dict_unshare_path(dict, key, key_len);
+	}
+	return dict->root;
+}
+
+static void dict_modify_end(MdslDict *dict, DictNode *root, 
+		const void *key, size_t key_len, int locked)
+{
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+	{
+		if (root)
+		{
+			__atomic_store_n(&(dict->root), root, __ATOMIC_RELEASE);
+			dict_reclaim(dict);
+		}
+		pthread_mutex_unlock(&(dict->lock));
+	}
+	else
+	{
+		if (root)
+			dict_table_update(dict, key, key_len, 0);
+		dict_store_unlock(dict, locked);
+	}
+}
+
+size_t mdsl_dict_remove_prefix
+	(MdslDict *dict, const void *prefix, size_t prefix_len)
+{
+	size_t res;
+	int locked;
+
+	DictNode *root = dict_modify_begin(dict, prefix, prefix_len, 1, &locked);
+	res = remove_prefix(dict, root, prefix, prefix_len);
+	//Every child of root is gone with an empty prefix
+	if (prefix_len == 0)
+		dict_table_update(dict, NULL, 0, 1);
+	dict_modify_end(dict, root, prefix, prefix_len, locked);
+
+	return res;
+}
+
+void *mdsl_dict_set
+	(MdslDict *dict, const void *key, size_t key_len, const void *value)
+{
+	void *res = NULL;
+	int locked;
+
+	mdsl_assert(! (dict->flags & MDSL_DICT_U64),
+			"Use mdsl_dict_u64_set() for dictionaries in MDSL_DICT_U64 mode");
+
+	DictNode *root = dict_modify_begin
+		(dict, key, key_len, value != NULL, &locked);
+	if (root)
+		res = dict_set_in(dict, root, key, key_len, value);
+	dict_modify_end(dict, root, key, key_len, locked);
+
+	return res;
+}
+
+//Integer values
+static uint64_t dict_u64_store(MdslDict *dict, const void *key, 
+		size_t key_len, uint64_t value, int add, int *present_return)
+{
+	uint64_t res;
+	int locked;
+
+	mdsl_assert(dict->flags & MDSL_DICT_U64, 
+			"Dictionary is not in MDSL_DICT_U64 mode");
+
+	DictNode *root = dict_modify_begin(dict, key, key_len, 1, &locked);
+	int depth;
+	DictNode *node = create_node(dict, root, key, key_len, &depth);
+	if (present_return)
+		*present_return = node->has_u64;
+	if (! node->has_u64)
+	{
+		node->has_u64 = 1;
+		dict_count_value(dict, (DictNode **) dict->scratch.data, depth);
+	}
+	res = node->value_u64 = add ? node->value_u64 + value : value;
+	dict_modify_end(dict, root, key, key_len, locked);
+
+	return res;
+}
+
+int mdsl_dict_u64_set
+	(MdslDict *dict, const void *key, size_t key_len, uint64_t value)
+{
+	int present;
+	dict_u64_store(dict, key, key_len, value, 0, &present);
+	return present;
+}
+
+uint64_t mdsl_dict_u64_add
+	(MdslDict *dict, const void *key, size_t key_len, uint64_t delta)
+{
+	return dict_u64_store(dict, key, key_len, delta, 1, NULL);
+}
+
+int mdsl_dict_u64_remove(MdslDict *dict, 
+		const void *key, size_t key_len, uint64_t *value_return)
+{
+	DictNode old;
+	int res = 0, locked;
+
+	DictNode *root = dict_modify_begin(dict, key, key_len, 0, &locked);
+	if (root)
+		res = collect_node(dict, root, key, key_len, &old);
+	dict_modify_end(dict, root, key, key_len, locked);
+
+	if (res && value_return)
+		*value_return = old.value_u64;
+	return res;
+}
+
+int mdsl_dict_u64_get(MdslDict *dict, 
+		const void *key, size_t key_len, uint64_t *value_return)
+{
+	DictNode *node;
+	int res = 0;
+
+	mdsl_dict_read_begin(dict);
+	node = dict_table_get(dict->table, key, key_len);
+	if (node)
+		node = dict_lookup_node(node, (const uint8_t *) key + 2, key_len - 2);
+	else
+		node = dict_lookup_node(dict_root(dict), key, key_len);
+	if (node && node->has_u64)
+	{
+		res = 1;
+		if (value_return)
+			*value_return = node->value_u64;
+	}
+	mdsl_dict_read_end(dict);
+
+	return res;
+}
+
+void mdsl_dict_read_begin(MdslDict *dict)
+{
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		mdsl_epoch_enter();
+}
+
+void mdsl_dict_read_end(MdslDict *dict)
+{
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		mdsl_epoch_exit();
+}
+
+void *mdsl_dict_get
+	(MdslDict *dict, const void *key, size_t key_len)
+{
+	void *res;
+
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+	{
+		mdsl_epoch_enter();
+		res = dict_lookup(dict_root(dict), key, key_len);
+		mdsl_epoch_exit();
+	}
+	else
+	{
+		DictNode *node = dict_table_get(dict->table, key, key_len);
+		if (node)
+			res = dict_lookup(node, (const uint8_t *) key + 2, key_len - 2);
+		else
+			res = dict_lookup(dict->root, key, key_len);
+	}
+
+	return res;
+}
+
+//Finds the node for the key, which may have no value
+static inline DictNode *dict_lookup_node
+	(DictNode *root, const void *key, size_t key_len)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	const uint8_t *lkey = ekey + key_len;
+
+	DictNode *iter = root;
+
+	while (iter)
+	{
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
+		if (remains < run_len)
+		{
+			return NULL;
+		}
+
+		if (! mdsl_equal(ekey, iter->ekey, run_len))
+			return NULL;
+
+		if (remains == run_len)
+		{
+			return iter;
+		}
+		else
+		{
+			iter = byte_map_get(&(iter->next), ekey[run_len]);
+			ekey += run_len + 1;
+		}
+	}
+
+	return NULL;
+}
+
+static void *dict_lookup(DictNode *root, const void *key, size_t key_len)
+{
+	DictNode *node = dict_lookup_node(root, key, key_len);
+	return node ? (void *) node->value : NULL;
+}
+
+void **mdsl_dict_lookup_slot
+	(MdslDict *dict, const void *key, size_t key_len, int create)
+{
+	mdsl_assert(! (dict->flags & MDSL_DICT_CONCURRENT), 
+			"mdsl_dict_lookup_slot() cannot be used in concurrent mode");
+
+	mdsl_assert(! (dict->flags & MDSL_DICT_U64), 
+			"mdsl_dict_lookup_slot() cannot be used in MDSL_DICT_U64 mode");
+
+	//Nodes shared with snapshots are copied before the location is handed
+	//out, so writes through it are private to the dictionary
+	DictNode *node = NULL;
+	int locked;
+	DictNode *root = dict_modify_begin(dict, key, key_len, create, &locked);
+	int depth;
+	if (root && create)
+	{
+		node = create_node(dict, root, key, key_len, &depth);
+		if (! node->counted)
+			dict_count_value(dict, (DictNode **) dict->scratch.data, depth);
+	}
+	else if (root)
+	{
+		node = dict_lookup_node(root, key, key_len);
+		//Nodes on the path of longer keys have no value of their own
+		if (node && ! node_has_value(node))
+			node = NULL;
+	}
+
+	//Settled by the next modification
+	if (node)
+	{
+		dict->slot_node = node;
+		dict_rbuf_reserve(&(dict->slot_key), key_len);
+		memcpy(dict->slot_key.data, key, key_len);
+		dict->slot_key.len = key_len;
+	}
+	dict_modify_end(dict, root, key, key_len, locked);
+
+	return node ? (void **) &(node->value) : NULL;
+}
+
+static void *dict_lookup_longest_prefix(DictNode *root, 
+		const void *key, size_t key_len, size_t *matched_len_return)
+{
+	const uint8_t *skey = (const uint8_t *) key;
+	const uint8_t *ekey = skey;
+	const uint8_t *lkey = ekey + key_len;
+	const void *res = NULL;
+	size_t matched_len = 0;
+
+	DictNode *iter = root;
+
+	while (iter)
+	{
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
+		if (remains < run_len)
+			break;
+
+		if (! mdsl_equal(ekey, iter->ekey, run_len))
+			break;
+
+		if (iter->value)
+		{
+			res = iter->value;
+			matched_len = ekey + run_len - skey;
+		}
+
+		if (remains == run_len)
+			break;
+
+		iter = byte_map_get(&(iter->next), ekey[run_len]);
+		ekey += run_len + 1;
+	}
+
+	if (matched_len_return)
+		*matched_len_return = matched_len;
+	return (void *) res;
+}
+
+void *mdsl_dict_get_longest_prefix(MdslDict *dict, 
+		const void *key, size_t key_len, size_t *matched_len_return)
+{
+	void *res;
+
+	mdsl_assert(! (dict->flags & MDSL_DICT_U64), 
+			"mdsl_dict_get_longest_prefix() cannot be used "
+			"in MDSL_DICT_U64 mode");
+
+	mdsl_dict_read_begin(dict);
+	res = dict_lookup_longest_prefix
+		(dict_root(dict), key, key_len, matched_len_return);
+	mdsl_dict_read_end(dict);
+
+	return res;
+}
+
+//Batched lookup.
+//Each slot holds one traversal. A step either examines a node (stage 0) or
+//looks up the child in its ByteMap (stage 1), and prefetches what the next
+//step needs. Slots are visited round robin, and a finished slot picks up
+//the next key.
+#define GET_MANY_GROUP 16
+
+typedef struct
+{
+	const uint8_t *ekey, *lkey;
+	DictNode *node;
+	size_t idx;
+	uint8_t chr;
+	int stage;
+} DictLookup;
+
+static inline void dict_lookup_start(DictLookup *s, DictNode *root,
+		DictRootTable *table, const void *key, size_t key_len, size_t idx)
+{
+	s->idx = idx;
+	s->ekey = (const uint8_t *) key;
+	s->lkey = s->ekey + key_len;
+	s->node = dict_table_get(table, key, key_len);
+	if (s->node)
+		s->ekey += 2;
+	else
+		s->node = root;
+	s->stage = 0;
+}
+
+void mdsl_dict_get_many(MdslDict *dict, const void * const *keys,
+		const size_t *key_lens, size_t n, void **values_return)
+{
+	DictLookup slots[GET_MANY_GROUP];
+	size_t next_key = 0;
+	int i, n_active = 0;
+
+	mdsl_assert(! (dict->flags & MDSL_DICT_U64), 
+			"mdsl_dict_get_many() cannot be used in MDSL_DICT_U64 mode");
+
+	mdsl_dict_read_begin(dict);
+	DictNode *root = dict_root(dict);
+
+	for (i = 0; i < GET_MANY_GROUP; i++)
+	{
+		if (next_key < n)
+		{
+			dict_lookup_start(slots + i, root, dict->table,
+					keys[next_key], key_lens[next_key], next_key);
+			next_key++;
+			n_active++;
+		}
+		else
+		{
+			slots[i].node = NULL;
+		}
+	}
+
+	while (n_active > 0)
+	{
+		for (i = 0; i < GET_MANY_GROUP; i++)
+		{
+			DictLookup *s = slots + i;
+			DictNode *node = s->node;
+			const void *res = NULL;
+			int done = 0;
+
+			if (! node)
+				continue;
+
+			if (s->stage == 0)
+			{
+				size_t remains = s->lkey - s->ekey;
+				size_t run_len = node->len;
+				if (remains < run_len 
+						|| ! mdsl_equal(s->ekey, node->ekey, run_len))
+				{
+					done = 1;
+				}
+				else if (remains == run_len)
+				{
+					res = node->value;
+					done = 1;
+				}
+				else
+				{
+					s->chr = s->ekey[run_len];
+					s->ekey += run_len + 1;
+					byte_map_prefetch(&(node->next), s->chr);
+					s->stage = 1;
+				}
+			}
+			else
+			{
+				DictNode *child = byte_map_get(&(node->next), s->chr);
+				if (! child)
+				{
+					done = 1;
+				}
+				else
+				{
+					mdsl_prefetch(child);
+					s->node = child;
+					s->stage = 0;
+				}
+			}
+
+			if (! done)
+				continue;
+
+			values_return[s->idx] = (void *) res;
+			if (next_key < n)
+			{
+				dict_lookup_start(s, root, dict->table,
+						keys[next_key], key_lens[next_key], next_key);
+				next_key++;
+			}
+			else
+			{
+				s->node = NULL;
+				n_active--;
+			}
+		}
+	}
+
+	mdsl_dict_read_end(dict);
+}
+
+//Statistics
+typedef struct
+{
+	DictNode *node;
+	size_t depth;
+} DictStatsFrame;
+
+void mdsl_dict_get_stats(MdslDict *dict, MdslDictStats *stats, int walk)
+{
+	int shared;
+
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		pthread_mutex_lock(&(dict->lock));
+	shared = dict_store_lock(dict);
+
+	*stats = dict->store->stats;
+	stats->n_keys = dict->n_keys;
+
+	if (walk)
+	{
+		DictStatsFrame *stack;
+		size_t n_frames = 0, n_keys = 0;
+
+		dict_rbuf_reserve(&(dict->scratch), sizeof(DictStatsFrame));
+		stack = (DictStatsFrame *) dict->scratch.data;
+		stack[n_frames].node = dict->root;
+		stack[n_frames].depth = 0;
+		n_frames++;
+
+		while (n_frames > 0)
+		{
+			DictStatsFrame frame = stack[--n_frames];
+			DictNode *child;
+			uint8_t chr;
+			int from = 0;
+
+			if (frame.node->counted)
+			{
+				n_keys++;
+				stats->depths[frame.depth < MDSL_DICT_N_DEPTHS 
+					? frame.depth : MDSL_DICT_N_DEPTHS - 1]++;
+			}
+
+			dict_rbuf_reserve(&(dict->scratch), sizeof(DictStatsFrame)
+					* (n_frames + byte_map_get_size(&(frame.node->next))));
+			stack = (DictStatsFrame *) dict->scratch.data;
+			while ((child = byte_map_next(&(frame.node->next), from, &chr)))
+			{
+				stack[n_frames].node = child;
+				stack[n_frames].depth = frame.depth + 1;
+				n_frames++;
+				from = chr + 1;
+			}
+		}
+
+		stats->n_keys = n_keys;
+		stats->have_depths = 1;
+	}
+
+	stats->total_bytes = sizeof(MdslDict) + sizeof(DictStore) 
+		+ dict->store->pool.reserved + stats->map_bytes 
+		+ dict->scratch.alloc_len;
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		stats->total_bytes += dict->retired.alloc_len * sizeof(DictRetired);
+	if (dict->table)
+		stats->total_bytes += sizeof(DictRootTable);
+	stats->avg_run_len = stats->n_nodes 
+		? (double) stats->run_bytes / stats->n_nodes : 0;
+	stats->bytes_per_key = stats->n_keys 
+		? (double) stats->total_bytes / stats->n_keys : 0;
+
+	dict_store_unlock(dict, shared);
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		pthread_mutex_unlock(&(dict->lock));
+}
+
+static void mdsl_dict_destroy(MdslDict *dict)
+{
+	DictStore *store = dict->store;
+
+	pthread_mutex_lock(&(store->lock));
+
+	free_subtree(dict, dict->root, 0);
+
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+	{
+		while (dict_retired_queue_size(&(dict->retired)) > 0)
+		{
+			dict_release(dict, dict_retired_queue_head(&(dict->retired)));
+			dict_retired_queue_pop_n(&(dict->retired), 1);
+		}
+		dict_retired_queue_destroy(&(dict->retired));
+		pthread_mutex_destroy(&(dict->lock));
+	}
+
+	pthread_mutex_unlock(&(store->lock));
+
+	free(dict->scratch.data);
+	free(dict->slot_key.data);
+	free(dict->table);
+	free(dict);
+
+	if (__atomic_sub_fetch(&(store->refcount), 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		node_pool_destroy(&(store->pool));
+		pthread_mutex_destroy(&(store->lock));
+		free(store);
+	}
+}
+
+MdslDict *mdsl_dict_new_with_flags(MdslDictFlags flags)
+{
+	mdsl_assert(! ((flags & MDSL_DICT_CONCURRENT) 
+				&& (flags & MDSL_DICT_ROOT_TABLE)),
+			"MDSL_DICT_ROOT_TABLE cannot be combined with MDSL_DICT_CONCURRENT");
+
+	MdslDict *dict = (MdslDict *) mdsl_alloc(sizeof(MdslDict));
+	DictStore *store = (DictStore *) mdsl_alloc(sizeof(DictStore));
+
+	store->refcount = 1;
+	if (pthread_mutex_init(&(store->lock), NULL) != 0)
+		mdsl_error("pthread_mutex_init() failed");
+	node_pool_init(&(store->pool));
+	memset(&(store->stats), 0, sizeof(MdslDictStats));
+
+	mdsl_rc_init(dict);
+
+	dict->flags = flags;
+	dict->store = store;
+	dict->n_keys = 0;
+	dict->table = NULL;
+	mdsl_rbuf_init(&(dict->scratch));
+	dict->slot_node = NULL;
+	mdsl_rbuf_init(&(dict->slot_key));
+	dict->root = alloc_node(dict, NULL, 0);
+
+	if (flags & MDSL_DICT_CONCURRENT)
+	{
+		if (pthread_mutex_init(&(dict->lock), NULL) != 0)
+			mdsl_error("pthread_mutex_init() failed");
+		dict_retired_queue_init(&(dict->retired));
+	}
+
+	return dict;
+}
+
+MdslDict *mdsl_dict_snapshot(MdslDict *dict)
+{
+	mdsl_assert(! (dict->flags & MDSL_DICT_CONCURRENT),
+			"Dictionaries in concurrent mode do not support snapshots");
+
+	MdslDict *snapshot = (MdslDict *) mdsl_alloc(sizeof(MdslDict));
+	DictStore *store = dict->store;
+
+	mdsl_rc_init(snapshot);
+
+	snapshot->flags = (dict->flags | DICT_SNAPSHOT) & ~MDSL_DICT_ROOT_TABLE;
+	snapshot->table = NULL;
+	snapshot->store = store;
+	mdsl_rbuf_init(&(snapshot->scratch));
+	snapshot->slot_node = NULL;
+	mdsl_rbuf_init(&(snapshot->slot_key));
+
+	pthread_mutex_lock(&(store->lock));
+	dict_settle_slot(dict);
+	snapshot->n_keys = dict->n_keys;
+	dict->root->refcount++;
+	snapshot->root = dict->root;
+	__atomic_add_fetch(&(store->refcount), 1, __ATOMIC_ACQ_REL);
+	pthread_mutex_unlock(&(store->lock));
+
+	return snapshot;
 }
 
 MdslDict *mdsl_dict_new()
 {
-	MdslDict *dict = (MdslDict *) mdsl_alloc(sizeof(MdslDict));
+	return mdsl_dict_new_with_flags(0);
+}
+
+//Convenience functions
+void *mdsl_dict_set_str
+	(MdslDict *dict, const char *str, const void *value)
+{
+	return mdsl_dict_set(dict, str, strlen(str), value);
+}
+
+void *mdsl_dict_get_str
+	(MdslDict *dict, const char *str)
+{
+	return mdsl_dict_get(dict, str, strlen(str));
+}
+
+//Bulk loading.
+//Nodes along the path of the previous key are kept open in a stack of
+//frames. A node is closed, i.e. allocated with its final ByteMap, when a
+//key that does not start with it arrives. Children of open nodes wait in
+//a shared stack, with children of deeper nodes on top.
+typedef struct
+{
+	size_t start, len;
+	const void *value;
+	size_t child_base;
+} DictLoadFrame;
+
+mdsl_declare_array(DictLoadFrame, DictLoadFrameArray, dict_load_frame_array);
+mdsl_declare_array(uint8_t, DictChrArray, dict_chr_array);
+
+typedef struct
+{
+	MdslDict *dict;
+	MdslRBuf key;
+	DictLoadFrameArray frames;
+	DictChrArray chrs;
+	DictNodeArray children;
+} DictLoader;
+
+//Builds the ByteMap of a node from the children on top of the stack
+static void dict_loader_take_children
+	(DictLoader *loader, DictNode *node, size_t child_base)
+{
+	size_t n = dict_node_array_size(&(loader->children)) - child_base;
+	dict_count_map(loader->dict, &(node->next), 0);
+	byte_map_build(&(node->next), 
+			(uint8_t *) loader->chrs.data + child_base,
+			(void **) loader->children.data + child_base, n);
+	dict_count_map(loader->dict, &(node->next), 1);
+	dict_chr_array_resize(&(loader->chrs), child_base);
+	dict_node_array_resize(&(loader->children), child_base);
+	node_recount(node);
+}
+
+static void dict_loader_close(DictLoader *loader)
+{
+	DictLoadFrame frame = dict_load_frame_array_pop(&(loader->frames));
+	const uint8_t *key = (const uint8_t *) loader->key.data;
+
+	DictNode *node = alloc_node(loader->dict, key + frame.start, frame.len);
+	node->value = frame.value;
+	dict_loader_take_children(loader, node, frame.child_base);
+
+	dict_chr_array_append(&(loader->chrs), key[frame.start - 1]);
+	dict_node_array_append(&(loader->children), node);
+}
+
+static MdslStatus dict_loader_add
+	(DictLoader *loader, const uint8_t *ekey, size_t key_len, 
+	 const void *value, int first)
+{
+	const uint8_t *key = (const uint8_t *) loader->key.data;
+	size_t prev_len = loader->key.len;
+	size_t l = 0;
+
+	//Longest common prefix with previous key, and order check
+	if (! first)
+	{
+		size_t cmp_len = prev_len < key_len ? prev_len : key_len;
+		while (l < cmp_len && key[l] == ekey[l])
+			l++;
+		if (l == key_len)
+			return MDSL_FAILURE;
+		if (l < prev_len && key[l] > ekey[l])
+			return MDSL_FAILURE;
+	}
+
+	//Close the nodes that do not lie on the path of new key
+	DictLoadFrame *top;
+	while (1)
+	{
+		size_t n_frames = dict_load_frame_array_size(&(loader->frames));
+		top = loader->frames.data + n_frames - 1;
+		if (n_frames == 1 || top->start <= l)
+			break;
+		dict_loader_close(loader);
+	}
+
+	//New key branches off in the middle of a node, split it
+	if (l < top->start + top->len)
+	{
+		DictNode *lower = alloc_node(loader->dict, key + l + 1, 
+				top->start + top->len - l - 1);
+		lower->value = top->value;
+		dict_loader_take_children(loader, lower, top->child_base);
+		dict_chr_array_append(&(loader->chrs), key[l]);
+		dict_node_array_append(&(loader->children), lower);
+
+		top->len = l - top->start;
+		top->value = NULL;
+	}
+
+	//Remember the new key
+	mdsl_rbuf_resize(&(loader->key), key_len);
+	memcpy(loader->key.data + l, ekey + l, key_len - l);
+
+	//Open a node for rest of the key
+	if (l < key_len)
+	{
+		DictLoadFrame frame;
+		frame.start = l + 1;
+		frame.len = key_len - l - 1;
+		frame.value = NULL;
+		frame.child_base = dict_node_array_size(&(loader->children));
+		dict_load_frame_array_append(&(loader->frames), frame);
+	}
+	top = loader->frames.data 
+		+ dict_load_frame_array_size(&(loader->frames)) - 1;
+	top->value = value;
+
+	return MDSL_SUCCESS;
+}
+
+MdslStatus mdsl_dict_bulk_load
+	(MdslDict *dict, MdslDictSource source, void *user_data)
+{
+	DictLoader loader[1];
+	MdslStatus res = MDSL_SUCCESS;
+	int first = 1;
+	size_t i, n_keys = 0;
+	int shared;
+
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		pthread_mutex_lock(&(dict->lock));
+	shared = dict_write_begin(dict);
+
+	mdsl_assert(! (dict->flags & MDSL_DICT_U64), 
+			"mdsl_dict_bulk_load() cannot be used in MDSL_DICT_U64 mode");
+
+	if (node_has_value(dict->root) 
+			|| byte_map_get_size(&(dict->root->next)) != 0)
+		res = MDSL_FAILURE;
+
+	loader->dict = dict;
+	mdsl_rbuf_init(&(loader->key));
+	dict_load_frame_array_init(&(loader->frames));
+	dict_chr_array_init(&(loader->chrs));
+	dict_node_array_init(&(loader->children));
+
+	DictLoadFrame root_frame = {0, 0, NULL, 0};
+	dict_load_frame_array_append(&(loader->frames), root_frame);
+
+	const void *key, *value;
+	size_t key_len;
+	while (res == MDSL_SUCCESS && source(user_data, &key, &key_len, &value))
+	{
+		if (! value)
+			continue;
+		res = dict_loader_add(loader, key, key_len, value, first);
+		if (res != MDSL_SUCCESS)
+			break;
+		first = 0;
+		n_keys++;
+	}
+
+	while (dict_load_frame_array_size(&(loader->frames)) > 1)
+		dict_loader_close(loader);
+
+	if (res == MDSL_SUCCESS)
+	{
+		DictNode *root = alloc_node(dict, NULL, 0);
+		root->value = loader->frames.data[0].value;
+		dict_loader_take_children(loader, root, 0);
+
+		DictNode *old_root = dict->root;
+		__atomic_store_n(&(dict->root), root, __ATOMIC_RELEASE);
+		free_subtree(dict, old_root, 0);
+		dict->n_keys = n_keys;
+		dict_table_update(dict, NULL, 0, 1);
+	}
+	else
+	{
+		for (i = 0; i < dict_node_array_size(&(loader->children)); i++)
+			free_subtree(dict, loader->children.data[i], 0);
+	}
+
+	free(loader->key.data);
+	free(loader->frames.data);
+	free(loader->chrs.data);
+	free(loader->children.data);
+
+	dict_store_unlock(dict, shared);
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+	{
+		dict_reclaim(dict);
+		pthread_mutex_unlock(&(dict->lock));
+	}
+
+	return res;
+}
+
+//Parallel building.
+//Keys are partitioned by their first byte after the longest prefix that
+//all non-empty keys share, so that keys like paths that all start with 
+//"/" still spread out. Partitioning is a radix pass: every thread counts
+//its slice of the input, then scatters it to offsets computed from all
+//counts, so each partition keeps input order. Threads then take 
+//partitions one at a time, largest first, sort them and build their 
+//subtrees with a DictLoader. Nodes are allocated from a DictStore private
+//to the thread, which is merged into the dictionary at the end when the
+//subtrees are grafted under the node for the common prefix.
+typedef struct
+{
+	const uint8_t *key;
+	size_t key_len;
+	const void *value;
+	size_t idx;
+} DictBuildEntry;
+
+typedef enum
+{
+	DICT_BUILD_PREFIX,
+	DICT_BUILD_COUNT,
+	DICT_BUILD_SCATTER,
+	DICT_BUILD_TREES
+} DictBuildPhase;
+
+typedef struct _DictBuilder DictBuilder;
+
+typedef struct
+{
+	DictBuilder *builder;
+	size_t begin, end;
+	//Common prefix of the slice and the reference key
+	size_t prefix_len;
+	//Counts of the slice for each partition, then offsets to scatter to
+	size_t counts[256];
+	//Index of the last pair in the slice with empty key or with key equal
+	//to the common prefix, or SIZE_MAX
+	size_t last_empty, last_prefix;
+	//Nodes are allocated through shell, whose only valid member is store
+	MdslDict shell;
+	DictStore store;
+	pthread_t thread;
+} DictBuildWorker;
+
+struct _DictBuilder
+{
+	const void * const *keys;
+	const size_t *key_lens;
+	const void * const *values;
+	DictBuildPhase phase;
+	//First non-empty key
+	const uint8_t *ref;
+	size_t ref_len;
+	//Length of the prefix common to all non-empty keys
+	size_t prefix_len;
+	DictBuildEntry *entries;
+	size_t starts[257];
+	int order[256];
+	int next_part;
+	DictNode *subtrees[256];
+	size_t n_keys[256];
+	int n_workers;
+	DictBuildWorker *workers;
+};
+
+//Byte of the key at depth, -1 past its end
+static inline int dict_build_chr(DictBuildEntry *e, size_t depth)
+{
+	return depth < e->key_len ? e->key[depth] : -1;
+}
+
+static inline void dict_build_swap(DictBuildEntry *a, DictBuildEntry *b)
+{
+	DictBuildEntry tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+//Order of keys that agree on the first depth bytes, ties broken by
+//position in the input
+static int dict_build_less(DictBuildEntry *a, DictBuildEntry *b, size_t depth)
+{
+	size_t len = a->key_len < b->key_len ? a->key_len : b->key_len;
+	int cmp = memcmp(a->key + depth, b->key + depth, len - depth);
+
+	if (cmp != 0)
+		return cmp < 0;
+	if (a->key_len != b->key_len)
+		return a->key_len < b->key_len;
+	return a->idx < b->idx;
+}
+
+//Multikey quicksort of entries whose keys agree on the first depth bytes.
+//Entries are split three ways on the byte at depth, and the middle part
+//moves on to the next byte, so shared prefixes are read only once. 
+//Pairs with equal keys only need the last one at the end of their run.
+static void dict_build_sort(DictBuildEntry *entries, size_t n, size_t depth)
+{
+	size_t i, j;
+
+	while (n > 1)
+	{
+		if (n < 12)
+		{
+			for (i = 1; i < n; i++)
+			{
+				for (j = i; j > 0 
+						&& dict_build_less(entries + j, entries + j - 1, depth);
+						j--)
+					dict_build_swap(entries + j, entries + j - 1);
+			}
+			return;
+		}
+
+		//Median of three
+		int a = dict_build_chr(entries, depth);
+		int b = dict_build_chr(entries + n / 2, depth);
+		int c = dict_build_chr(entries + n - 1, depth);
+		int pivot = a < b ? (b < c ? b : (a < c ? c : a))
+			: (a < c ? a : (b < c ? c : b));
+
+		//entries[0, lt) < pivot, [lt, k) == pivot, [gt, n) > pivot
+		size_t lt = 0, k = 0, gt = n;
+		while (k < gt)
+		{
+			int chr = dict_build_chr(entries + k, depth);
+			if (chr < pivot)
+				dict_build_swap(entries + lt++, entries + k++);
+			else if (chr > pivot)
+				dict_build_swap(entries + k, entries + --gt);
+			else
+				k++;
+		}
+
+		dict_build_sort(entries, lt, depth);
+		dict_build_sort(entries + gt, n - gt, depth);
+
+		if (pivot < 0)
+		{
+			//Same key throughout, the last pair goes to the end
+			size_t last = lt;
+			for (i = lt + 1; i < gt; i++)
+				if (entries[i].idx > entries[last].idx)
+					last = i;
+			dict_build_swap(entries + last, entries + gt - 1);
+			return;
+		}
+
+		entries += lt;
+		n = gt - lt;
+		depth++;
+	}
+}
+
+//Builds the subtree for one partition, NULL if no key remains in it
+static DictNode *dict_build_subtree(DictBuildWorker *worker,
+		DictBuildEntry *entries, size_t n, size_t *n_keys_return)
+{
+	DictLoader loader[1];
+	DictNode *res = NULL;
+	size_t i, n_keys = 0;
+
+	//All keys share the first byte
+	dict_build_sort(entries, n, 1);
+
+	loader->dict = &(worker->shell);
+	mdsl_rbuf_init(&(loader->key));
+	dict_load_frame_array_init(&(loader->frames));
+	dict_chr_array_init(&(loader->chrs));
+	dict_node_array_init(&(loader->children));
+
+	DictLoadFrame root_frame = {0, 0, NULL, 0};
+	dict_load_frame_array_append(&(loader->frames), root_frame);
+
+	for (i = 0; i < n; i++)
+	{
+		DictBuildEntry *e = entries + i;
+
+		//The last pair for a key wins
+		if (i + 1 < n && e[1].key_len == e->key_len
+				&& memcmp(e[1].key, e->key, e->key_len) == 0)
+			continue;
+		if (! e->value)
+			continue;
+
+		if (dict_loader_add(loader, e->key, e->key_len, e->value, n_keys == 0)
+				!= MDSL_SUCCESS)
+			mdsl_error("Assertion failure");
+		n_keys++;
+	}
+
+	while (dict_load_frame_array_size(&(loader->frames)) > 1)
+		dict_loader_close(loader);
+
+	//All keys share the first byte, so there is at most one child
+	if (dict_node_array_size(&(loader->children)) > 0)
+		res = loader->children.data[0];
+
+	free(loader->key.data);
+	free(loader->frames.data);
+	free(loader->chrs.data);
+	free(loader->children.data);
+
+	*n_keys_return = n_keys;
+	return res;
+}
+
+static void *dict_build_worker_run(void *data)
+{
+	DictBuildWorker *worker = (DictBuildWorker *) data;
+	DictBuilder *builder = worker->builder;
+	size_t i, l, prefix_len = builder->prefix_len;
+
+	if (builder->phase == DICT_BUILD_PREFIX)
+	{
+		worker->prefix_len = builder->ref_len;
+		for (i = worker->begin; i < worker->end && worker->prefix_len; i++)
+		{
+			const uint8_t *key = (const uint8_t *) builder->keys[i];
+			size_t len = builder->key_lens[i];
+			if (len == 0)
+				continue;
+			if (len < worker->prefix_len)
+				worker->prefix_len = len;
+			for (l = 0; l < worker->prefix_len; l++)
+				if (key[l] != builder->ref[l])
+					break;
+			worker->prefix_len = l;
+		}
+	}
+	else if (builder->phase == DICT_BUILD_COUNT)
+	{
+		memset(worker->counts, 0, sizeof(worker->counts));
+		worker->last_empty = SIZE_MAX;
+		worker->last_prefix = SIZE_MAX;
+		for (i = worker->begin; i < worker->end; i++)
+		{
+			size_t len = builder->key_lens[i];
+			if (len == 0)
+				worker->last_empty = i;
+			else if (len == prefix_len)
+				worker->last_prefix = i;
+			else
+				worker->counts[((const uint8_t *) builder->keys[i])
+					[prefix_len]]++;
+		}
+	}
+	else if (builder->phase == DICT_BUILD_SCATTER)
+	{
+		for (i = worker->begin; i < worker->end; i++)
+		{
+			size_t len = builder->key_lens[i];
+			if (len == 0 || len == prefix_len)
+				continue;
+			const uint8_t *key 
+				= (const uint8_t *) builder->keys[i] + prefix_len;
+			DictBuildEntry *e = builder->entries + worker->counts[key[0]]++;
+			e->key = key;
+			e->key_len = len - prefix_len;
+			e->value = builder->values[i];
+			e->idx = i;
+		}
+	}
+	else
+	{
+		while (1)
+		{
+			int part = __atomic_fetch_add
+				(&(builder->next_part), 1, __ATOMIC_RELAXED);
+			if (part >= 256)
+				break;
+			int c = builder->order[part];
+			size_t start = builder->starts[c];
+			builder->subtrees[c] = dict_build_subtree(worker,
+					builder->entries + start, builder->starts[c + 1] - start,
+					builder->n_keys + c);
+		}
+	}
+
+	return NULL;
+}
+
+//Runs a phase on all workers, the calling thread being the first one
+static void dict_builder_run(DictBuilder *builder, DictBuildPhase phase)
+{
+	int i;
 
-	mdsl_rc_init(dict);
+	builder->phase = phase;
+	for (i = 1; i < builder->n_workers; i++)
+	{
+		if (pthread_create(&(builder->workers[i].thread), NULL,
+					dict_build_worker_run, builder->workers + i) != 0)
+			mdsl_error("pthread_create() failed");
+	}
+	dict_build_worker_run(builder->workers);
+	for (i = 1; i < builder->n_workers; i++)
+		pthread_join(builder->workers[i].thread, NULL);
+}
 
-    dict->root.value = NULL;
-    byte_map_init(&(dict->root.next));
-    dict->root.len = 0;
+static int dict_builder_get_subtrees
+	(DictBuilder *builder, uint8_t *chrs, void **children)
+{
+	int c, n_children = 0;
 
-	return dict;
+	for (c = 0; c < 256; c++)
+	{
+		if (! builder->subtrees[c])
+			continue;
+		chrs[n_children] = c;
+		children[n_children] = builder->subtrees[c];
+		n_children++;
+	}
+
+	return n_children;
 }
 
-//Convenience functions
-void *mdsl_dict_set_str
-	(MdslDict *dict, const char *str, const void *value)
+//Creates the node for a non-empty common prefix over the subtrees,
+//NULL if it would be empty
+static DictNode *dict_builder_graft
+	(DictBuilder *builder, MdslDict *dict, const void *value)
 {
-	return mdsl_dict_set(dict, str, strlen(str), value);
+	const uint8_t *prefix = builder->ref;
+	size_t prefix_len = builder->prefix_len;
+	uint8_t chrs[256];
+	void *children[256];
+	int n_children = dict_builder_get_subtrees(builder, chrs, children);
+	DictNode *node;
+
+	if (n_children == 0 && ! value)
+		return NULL;
+
+	//A node with neither value nor branches is merged into its child
+	if (n_children == 1 && ! value)
+	{
+		DictNode *child = (DictNode *) children[0];
+		node = alloc_node(dict, NULL, prefix_len + child->len);
+		memcpy(node->ekey, prefix + 1, prefix_len - 1);
+		node->ekey[prefix_len - 1] = chrs[0];
+		memcpy(node->ekey + prefix_len, child->ekey, child->len);
+		node_copy_value(node, child);
+		node->n_values = child->n_values;
+		dict_map_move(dict, &(node->next), &(child->next));
+		free_node(dict, child);
+		return node;
+	}
+
+	node = alloc_node(dict, prefix + 1, prefix_len - 1);
+	node->value = value;
+	dict_count_map(dict, &(node->next), 0);
+	byte_map_build(&(node->next), chrs, children, n_children);
+	dict_count_map(dict, &(node->next), 1);
+	node_recount(node);
+	return node;
 }
 
-void *mdsl_dict_get_str
-	(MdslDict *dict, const char *str)
+MdslStatus mdsl_dict_build_parallel(MdslDict *dict, const void * const *keys,
+		const size_t *key_lens, const void * const *values, size_t n,
+		int n_threads)
 {
-	return mdsl_dict_get(dict, str, strlen(str));
+	DictBuilder builder[1];
+	MdslStatus res = MDSL_SUCCESS;
+	size_t last_empty = SIZE_MAX, last_prefix = SIZE_MAX, n_keys = 0;
+	size_t i;
+	int j, c, shared;
+
+	mdsl_assert(n_threads > 0, "Number of threads must be positive");
+	mdsl_assert(! (dict->flags & MDSL_DICT_U64),
+			"mdsl_dict_build_parallel() cannot be used in MDSL_DICT_U64 mode");
+
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+		pthread_mutex_lock(&(dict->lock));
+	shared = dict_write_begin(dict);
+
+	if (node_has_value(dict->root)
+			|| byte_map_get_size(&(dict->root->next)) != 0)
+		res = MDSL_FAILURE;
+
+	if (res == MDSL_SUCCESS)
+	{
+		builder->keys = keys;
+		builder->key_lens = key_lens;
+		builder->values = values;
+		builder->ref = NULL;
+		builder->ref_len = 0;
+		builder->prefix_len = 0;
+		builder->next_part = 0;
+		builder->n_workers = n_threads;
+		builder->workers = (DictBuildWorker *) mdsl_alloc
+			(sizeof(DictBuildWorker) * n_threads);
+		for (j = 0; j < n_threads; j++)
+		{
+			DictBuildWorker *worker = builder->workers + j;
+			worker->builder = builder;
+			worker->begin = (n * j) / n_threads;
+			worker->end = (n * (j + 1)) / n_threads;
+			node_pool_init(&(worker->store.pool));
+			memset(&(worker->store.stats), 0, sizeof(MdslDictStats));
+			memset(&(worker->shell), 0, sizeof(MdslDict));
+			worker->shell.store = &(worker->store);
+		}
+
+		//Common prefix
+		for (i = 0; i < n && ! builder->ref; i++)
+		{
+			if (key_lens[i] == 0)
+				continue;
+			builder->ref = (const uint8_t *) keys[i];
+			builder->ref_len = key_lens[i];
+		}
+		if (builder->ref)
+		{
+			dict_builder_run(builder, DICT_BUILD_PREFIX);
+			builder->prefix_len = builder->ref_len;
+			for (j = 0; j < n_threads; j++)
+			{
+				if (builder->workers[j].prefix_len < builder->prefix_len)
+					builder->prefix_len = builder->workers[j].prefix_len;
+			}
+		}
+
+		//Partition
+		dict_builder_run(builder, DICT_BUILD_COUNT);
+		size_t offset = 0;
+		for (c = 0; c < 256; c++)
+		{
+			builder->starts[c] = offset;
+			for (j = 0; j < n_threads; j++)
+			{
+				size_t count = builder->workers[j].counts[c];
+				builder->workers[j].counts[c] = offset;
+				offset += count;
+			}
+		}
+		builder->starts[256] = offset;
+		builder->entries = (DictBuildEntry *) mdsl_alloc
+			(sizeof(DictBuildEntry) * (offset ? offset : 1));
+		dict_builder_run(builder, DICT_BUILD_SCATTER);
+
+		//Largest partitions first, so that threads finish together
+		for (c = 0; c < 256; c++)
+		{
+			size_t size = builder->starts[c + 1] - builder->starts[c];
+			for (j = c; j > 0; j--)
+			{
+				int prev = builder->order[j - 1];
+				if (builder->starts[prev + 1] - builder->starts[prev] >= size)
+					break;
+				builder->order[j] = prev;
+			}
+			builder->order[j] = c;
+		}
+		dict_builder_run(builder, DICT_BUILD_TREES);
+
+		//Take over the memory of the workers
+		for (j = 0; j < n_threads; j++)
+		{
+			DictBuildWorker *worker = builder->workers + j;
+			MdslDictStats *stats = &(dict->store->stats);
+			node_pool_merge(&(dict->store->pool), &(worker->store.pool));
+			stats->n_nodes += worker->store.stats.n_nodes;
+			stats->node_bytes += worker->store.stats.node_bytes;
+			stats->map_bytes += worker->store.stats.map_bytes;
+			stats->run_bytes += worker->store.stats.run_bytes;
+			for (c = 0; c < MDSL_DICT_N_MAP_MODES; c++)
+				stats->map_modes[c] += worker->store.stats.map_modes[c];
+			stats->n_map_grows += worker->store.stats.n_map_grows;
+			stats->n_map_shrinks += worker->store.stats.n_map_shrinks;
+			stats->n_map_resizes += worker->store.stats.n_map_resizes;
+			if (worker->last_empty != SIZE_MAX)
+				last_empty = worker->last_empty;
+			if (worker->last_prefix != SIZE_MAX)
+				last_prefix = worker->last_prefix;
+		}
+		for (c = 0; c < 256; c++)
+			n_keys += builder->n_keys[c];
+
+		//Graft the subtrees under a new root
+		DictNode *root = alloc_node(dict, NULL, 0);
+		if (last_empty != SIZE_MAX && values[last_empty])
+		{
+			root->value = values[last_empty];
+			n_keys++;
+		}
+		if (builder->prefix_len == 0)
+		{
+			uint8_t chrs[256];
+			void *children[256];
+			int n_children = dict_builder_get_subtrees(builder, chrs, children);
+			dict_count_map(dict, &(root->next), 0);
+			byte_map_build(&(root->next), chrs, children, n_children);
+			dict_count_map(dict, &(root->next), 1);
+		}
+		else
+		{
+			const void *value = NULL;
+			if (last_prefix != SIZE_MAX && values[last_prefix])
+			{
+				value = values[last_prefix];
+				n_keys++;
+			}
+			DictNode *node = dict_builder_graft(builder, dict, value);
+			if (node)
+				dict_map_set(dict, &(root->next), builder->ref[0], node);
+		}
+		node_recount(root);
+
+		DictNode *old_root = dict->root;
+		__atomic_store_n(&(dict->root), root, __ATOMIC_RELEASE);
+		free_subtree(dict, old_root, 0);
+		dict->n_keys = n_keys;
+		dict_table_update(dict, NULL, 0, 1);
+
+		free(builder->entries);
+		free(builder->workers);
+	}
+
+	dict_store_unlock(dict, shared);
+	if (dict->flags & MDSL_DICT_CONCURRENT)
+	{
+		dict_reclaim(dict);
+		pthread_mutex_unlock(&(dict->lock));
+	}
+
+	return res;
+}
+
+//Ordered iteration
+typedef struct
+{
+	DictNode *node;
+	size_t key_len;
+	int next_chr; //< -1 if value of the node is not visited yet
+} DictIterFrame;
+
+//Grows the buffer if needed, but never shrinks it
+static void dict_iter_push
+	(MdslDictIter *iter, DictNode *node, size_t key_len)
+{
+	size_t n_frames = iter->stack.len / sizeof(DictIterFrame);
+	dict_rbuf_reserve(&(iter->stack), (n_frames + 1) * sizeof(DictIterFrame));
+	DictIterFrame *frame = ((DictIterFrame *) iter->stack.data) + n_frames;
+	frame->node = node;
+	frame->key_len = key_len;
+	frame->next_chr = -1;
+	iter->stack.len += sizeof(DictIterFrame);
+}
+
+void mdsl_dict_iter_init(MdslDictIter *iter, MdslDict *dict)
+{
+	iter->dict = dict;
+	iter->key = NULL;
+	iter->key_len = 0;
+	iter->value = NULL;
+	iter->u64 = 0;
+	mdsl_rbuf_init(&(iter->key_buf));
+	mdsl_rbuf_init(&(iter->stack));
+	dict_iter_push(iter, dict_root(dict), 0);
+}
+
+void mdsl_dict_iter_seek
+	(MdslDictIter *iter, const void *prefix, size_t prefix_len)
+{
+	const uint8_t *ekey = (const uint8_t *) prefix;
+	const uint8_t *lkey = ekey + prefix_len;
+	DictNode *iter_node = dict_root(iter->dict);
+
+	iter->stack.len = 0;
+	iter->key = NULL;
+	iter->key_len = 0;
+	iter->value = NULL;
+	iter->u64 = 0;
+
+	//Find the topmost node whose key starts with the prefix
+	while (iter_node)
+	{
+		size_t remains = lkey - ekey;
+		size_t run_len = iter_node->len;
+		size_t cmp_len = remains < run_len ? remains : run_len;
+
+		if (! mdsl_equal(ekey, iter_node->ekey, cmp_len))
+			return;
+
+		if (remains <= run_len)
+			break;
+
+		iter_node = byte_map_get(&(iter_node->next), ekey[run_len]);
+		ekey += run_len + 1;
+	}
+	if (! iter_node)
+		return;
+
+	//Rest of the run becomes part of the key
+	size_t key_len = prefix_len + iter_node->len - (lkey - ekey);
+	dict_rbuf_reserve(&(iter->key_buf), key_len);
+	memcpy(iter->key_buf.data, prefix, prefix_len);
+	memcpy(iter->key_buf.data + prefix_len, iter_node->ekey + (lkey - ekey),
+			key_len - prefix_len);
+	dict_iter_push(iter, iter_node, key_len);
+}
+
+int mdsl_dict_iter_next(MdslDictIter *iter)
+{
+	while (iter->stack.len > 0)
+	{
+		size_t n_frames = iter->stack.len / sizeof(DictIterFrame);
+		DictIterFrame *frame = ((DictIterFrame *) iter->stack.data) 
+			+ n_frames - 1;
+		DictNode *node = frame->node;
+
+		//A key comes before all keys it is a prefix of
+		if (frame->next_chr < 0)
+		{
+			frame->next_chr = 0;
+			if (node_has_value(node))
+			{
+				iter->key = iter->key_buf.data;
+				iter->key_len = frame->key_len;
+				iter->value = (void *) node->value;
+				iter->u64 = node->value_u64;
+				return 1;
+			}
+		}
+
+		uint8_t chr;
+		DictNode *child = byte_map_next(&(node->next), frame->next_chr, &chr);
+		if (! child)
+		{
+			iter->stack.len -= sizeof(DictIterFrame);
+			continue;
+		}
+		frame->next_chr = chr + 1;
+
+		//Extend the key
+		size_t key_len = frame->key_len;
+		size_t child_key_len = key_len + 1 + child->len;
+		dict_rbuf_reserve(&(iter->key_buf), child_key_len);
+		iter->key_buf.data[key_len] = chr;
+		memcpy(iter->key_buf.data + key_len + 1, child->ekey, child->len);
+
+		dict_iter_push(iter, child, child_key_len);
+	}
+
+	iter->key = NULL;
+	iter->key_len = 0;
+	iter->value = NULL;
+	iter->u64 = 0;
+	return 0;
+}
+
+void mdsl_dict_iter_destroy(MdslDictIter *iter)
+{
+	free(iter->key_buf.data);
+	free(iter->stack.data);
+}
+
+//Order statistics.
+//Every node knows the number of values under it, so the position of a key
+//follows from the counts of the branches to its left on the way down.
+size_t mdsl_dict_count_prefix
+	(MdslDict *dict, const void *prefix, size_t prefix_len)
+{
+	const uint8_t *ekey = (const uint8_t *) prefix;
+	const uint8_t *lkey = ekey + prefix_len;
+	size_t res = 0;
+
+	mdsl_dict_read_begin(dict);
+	DictNode *iter = dict_root(dict);
+
+	//Find the topmost node whose key starts with the prefix
+	while (iter)
+	{
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
+		size_t cmp_len = remains < run_len ? remains : run_len;
+
+		if (! mdsl_equal(ekey, iter->ekey, cmp_len))
+			break;
+
+		if (remains <= run_len)
+		{
+			res = iter->n_values;
+			break;
+		}
+
+		iter = byte_map_get(&(iter->next), ekey[run_len]);
+		ekey += run_len + 1;
+	}
+	mdsl_dict_read_end(dict);
+
+	return res;
+}
+
+size_t mdsl_dict_rank(MdslDict *dict, const void *key, size_t key_len)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	const uint8_t *lkey = ekey + key_len;
+	size_t res = 0;
+
+	mdsl_dict_read_begin(dict);
+	DictNode *iter = dict_root(dict);
+
+	while (iter)
+	{
+		size_t remains = lkey - ekey;
+		size_t run_len = iter->len;
+		size_t cmp_len = remains < run_len ? remains : run_len;
+		size_t i = mdsl_mismatch(iter->ekey, ekey, cmp_len);
+
+		//Run differs from the key, the whole subtree is on one side
+		if (i < cmp_len)
+		{
+			if (iter->ekey[i] < ekey[i])
+				res += iter->n_values;
+			break;
+		}
+
+		//Key ends within the run, the subtree is not less than the key
+		if (remains <= run_len)
+			break;
+
+		//Key of the node is a proper prefix of the key and comes before
+		//it, as do branches for smaller bytes
+		uint8_t chr = 0, key_chr = ekey[run_len];
+		DictNode *child;
+		int from = 0;
+
+		if (iter->counted)
+			res++;
+		while ((child = byte_map_next(&(iter->next), from, &chr)))
+		{
+			if (chr >= key_chr)
+				break;
+			res += child->n_values;
+			from = chr + 1;
+		}
+
+		iter = child && chr == key_chr ? child : NULL;
+		ekey += run_len + 1;
+	}
+	mdsl_dict_read_end(dict);
+
+	return res;
+}
+
+int mdsl_dict_iter_select(MdslDictIter *iter, size_t k)
+{
+	DictNode *node = dict_root(iter->dict);
+	size_t key_len = 0;
+
+	iter->stack.len = 0;
+	iter->key = NULL;
+	iter->key_len = 0;
+	iter->value = NULL;
+	iter->u64 = 0;
+
+	if (k >= node->n_values)
+		return 0;
+
+	//Frames of ancestors resume after the branch taken
+	while (1)
+	{
+		dict_iter_push(iter, node, key_len);
+		if (node->counted)
+		{
+			if (k == 0)
+				return 1;
+			k--;
+		}
+
+		uint8_t chr;
+		DictNode *child;
+		int from = 0;
+		while ((child = byte_map_next(&(node->next), from, &chr)))
+		{
+			if (k < child->n_values)
+				break;
+			k -= child->n_values;
+			from = chr + 1;
+		}
+		mdsl_assert(child, "Assertion failure (counts out of sync)");
+
+		DictIterFrame *frame = ((DictIterFrame *) iter->stack.data) 
+			+ iter->stack.len / sizeof(DictIterFrame) - 1;
+		frame->next_chr = chr + 1;
+
+		//Extend the key
+		size_t child_key_len = key_len + 1 + child->len;
+		dict_rbuf_reserve(&(iter->key_buf), child_key_len);
+		iter->key_buf.data[key_len] = chr;
+		memcpy(iter->key_buf.data + key_len + 1, child->ekey, child->len);
+
+		node = child;
+		key_len = child_key_len;
+	}
+}
+
+//Frozen images.
+//The image starts with a header, followed by nodes in breadth first order.
+//Each node starts at an offset aligned to 8 bytes and consists of a
+//FrozenNode structure, the run of the key, and the children: either a
+//table of 256 offsets (dense nodes) or n_children sorted keys followed by
+//their offsets. Offset 0 means no child.
+#define FROZEN_MAGIC 0x4c53444d
+#define FROZEN_VERSION 1
+#define FROZEN_DENSE_MIN 48
+
+#define FROZEN_HAS_VALUE 1
+#define FROZEN_DENSE 2
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t len;
+	uint32_t root;
+	uint32_t reserved;
+} FrozenHeader;
+
+typedef struct
+{
+	uint64_t value;
+	uint32_t len;
+	uint16_t n_children;
+	uint8_t flags;
+	uint8_t reserved;
+	uint8_t ekey[];
+} FrozenNode;
+
+static inline size_t frozen_align(size_t offset, size_t align)
+{
+	return (offset + align - 1) - ((offset + align - 1) % align);
+}
+
+static size_t frozen_node_size(DictNode *node)
+{
+	int n_children = byte_map_get_size(&(node->next));
+	size_t size = frozen_align(sizeof(FrozenNode) + node->len, 4);
+	if (n_children >= FROZEN_DENSE_MIN)
+		size += 256 * sizeof(uint32_t);
+	else
+		size += frozen_align(n_children, 4) + n_children * sizeof(uint32_t);
+	return frozen_align(size, 8);
+}
+
+void *mdsl_dict_freeze(MdslDict *dict, MdslDictFreezeFunc func,
+		void *user_data, size_t *len_return)
+{
+	DictNodeArray queue[1];
+	MdslRBuf offsets[1];
+	size_t i, j, n_nodes;
+	size_t len;
+
+	//Breadth first traversal, children of a node end up consecutive
+	mdsl_dict_read_begin(dict);
+
+	dict_node_array_init(queue);
+	dict_node_array_append(queue, dict_root(dict));
+	for (i = 0; i < dict_node_array_size(queue); i++)
+	{
+		DictNode *node = queue->data[i];
+		DictNode *child;
+		uint8_t chr;
+		int from = 0;
+		while ((child = byte_map_next(&(node->next), from, &chr)))
+		{
+			dict_node_array_append(queue, child);
+			from = chr + 1;
+		}
+	}
+	n_nodes = dict_node_array_size(queue);
+
+	//Assign offsets
+	mdsl_rbuf_init(offsets);
+	mdsl_rbuf_resize(offsets, n_nodes * sizeof(size_t));
+	len = frozen_align(sizeof(FrozenHeader), 8);
+	for (i = 0; i < n_nodes; i++)
+	{
+		((size_t *) offsets->data)[i] = len;
+		len += frozen_node_size(queue->data[i]);
+	}
+	if (len > UINT32_MAX)
+		mdsl_error("Dictionary too large to freeze (%lu bytes)", 
+				(unsigned long) len);
+
+	//Write the image
+	char *image = (char *) mdsl_alloc(len);
+	memset(image, 0, len);
+
+	FrozenHeader *header = (FrozenHeader *) image;
+	header->magic = FROZEN_MAGIC;
+	header->version = FROZEN_VERSION;
+	header->len = len;
+	header->root = ((size_t *) offsets->data)[0];
+
+	size_t next_child = 1;
+	for (i = 0; i < n_nodes; i++)
+	{
+		DictNode *node = queue->data[i];
+		FrozenNode *fnode = (FrozenNode *) 
+			(image + ((size_t *) offsets->data)[i]);
+		size_t n_children = byte_map_get_size(&(node->next));
+
+		if (node->has_u64)
+		{
+			fnode->flags |= FROZEN_HAS_VALUE;
+			fnode->value = node->value_u64;
+		}
+		else if (node->value)
+		{
+			fnode->flags |= FROZEN_HAS_VALUE;
+			fnode->value = func ? func(user_data, node->value)
+				: (uint64_t) (uintptr_t) node->value;
+		}
+		fnode->len = node->len;
+		fnode->n_children = n_children;
+		memcpy(fnode->ekey, node->ekey, node->len);
+
+		uint8_t *keys = fnode->ekey + frozen_align(sizeof(FrozenNode) 
+				+ node->len, 4) - sizeof(FrozenNode);
+		uint32_t *children;
+		if (n_children >= FROZEN_DENSE_MIN)
+		{
+			fnode->flags |= FROZEN_DENSE;
+			children = (uint32_t *) keys;
+		}
+		else
+		{
+			children = (uint32_t *) (keys + frozen_align(n_children, 4));
+		}
+
+		uint8_t chr;
+		int from = 0;
+		for (j = 0; j < n_children; j++)
+		{
+			byte_map_next(&(node->next), from, &chr);
+			from = chr + 1;
+			uint32_t offset = ((size_t *) offsets->data)[next_child + j];
+			if (fnode->flags & FROZEN_DENSE)
+			{
+				children[chr] = offset;
+			}
+			else
+			{
+				keys[j] = chr;
+				children[j] = offset;
+			}
+		}
+		next_child += n_children;
+	}
+
+	free(queue->data);
+	free(offsets->data);
+
+	mdsl_dict_read_end(dict);
+
+	*len_return = len;
+	return image;
+}
+
+MdslStatus mdsl_frozen_dict_check(const void *image, size_t image_len)
+{
+	const FrozenHeader *header = (const FrozenHeader *) image;
+
+	if (image_len < sizeof(FrozenHeader) || ((uintptr_t) image) % 8)
+		return MDSL_FAILURE;
+	if (header->magic != FROZEN_MAGIC || header->version != FROZEN_VERSION)
+		return MDSL_FAILURE;
+	if (header->len != image_len || header->root >= image_len)
+		return MDSL_FAILURE;
+	return MDSL_SUCCESS;
+}
+
+int mdsl_frozen_dict_get(const void *image, 
+		const void *key, size_t key_len, uint64_t *value_return)
+{
+	const char *base = (const char *) image;
+	const uint8_t *ekey = (const uint8_t *) key;
+	const uint8_t *lkey = ekey + key_len;
+	uint32_t offset = ((const FrozenHeader *) image)->root;
+
+	while (offset)
+	{
+		const FrozenNode *fnode = (const FrozenNode *) (base + offset);
+		size_t remains = lkey - ekey;
+		size_t run_len = fnode->len;
+
+		if (remains < run_len || ! mdsl_equal(ekey, fnode->ekey, run_len))
+			return 0;
+
+		if (remains == run_len)
+		{
+			if (! (fnode->flags & FROZEN_HAS_VALUE))
+				return 0;
+			if (value_return)
+				*value_return = fnode->value;
+			return 1;
+		}
+
+		uint8_t chr = ekey[run_len];
+		const uint8_t *keys = fnode->ekey + frozen_align(sizeof(FrozenNode) 
+				+ run_len, 4) - sizeof(FrozenNode);
+		if (fnode->flags & FROZEN_DENSE)
+		{
+			offset = ((const uint32_t *) keys)[chr];
+		}
+		else
+		{
+			int n = fnode->n_children;
+			const uint32_t *children 
+				= (const uint32_t *) (keys + frozen_align(n, 4));
+			int lo = 0, hi = n;
+			while (lo < hi)
+			{
+				int mid = (lo + hi) / 2;
+				if (keys[mid] < chr)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			offset = (lo < n && keys[lo] == chr) ? children[lo] : 0;
+		}
+
+		ekey += run_len + 1;
+	}
+
+	return 0;
 }
 
 //Debugging functions
@@ -416,7 +2991,9 @@ static void mdsl_dict_dump_rec(DictNode *node, int level, FILE *stream)
 void mdsl_dict_fdump(MdslDict *dict, FILE *stream)
 {
 	fprintf(stream, "[#]");
-	mdsl_dict_dump_rec(&(dict->root), 0, stream);
+	mdsl_dict_read_begin(dict);
+	mdsl_dict_dump_rec(dict_root(dict), 0, stream);
+	mdsl_dict_read_end(dict);
 }
 
 void mdsl_dict_dump(MdslDict *dict)
@@ -26,8 +26,347 @@ void *mdsl_dict_set
 void *mdsl_dict_get
 	(MdslDict *dict, const void *key, size_t key_len);
 
+/**
+ * Removes all keys starting with the given prefix in one pass over the
+ * subtree.
+ *
+ * \param dict The dictionary
+ * \param prefix The prefix, all keys are removed if it is empty
+ * \param prefix_len Length of the prefix
+ * \return Number of keys removed
+ */
+size_t mdsl_dict_remove_prefix
+	(MdslDict *dict, const void *prefix, size_t prefix_len);
+
+/**
+ * Counts the keys starting with the given prefix, in time proportional 
+ * to the length of the prefix. Every node keeps the number of keys below
+ * it.
+ *
+ * \param dict The dictionary
+ * \param prefix The prefix, all keys are counted if it is empty
+ * \param prefix_len Length of the prefix
+ * \return Number of keys starting with the prefix
+ */
+size_t mdsl_dict_count_prefix
+	(MdslDict *dict, const void *prefix, size_t prefix_len);
+
+/**
+ * Counts the keys that come before the given key in lexicographic byte
+ * order, which need not be present. Takes time proportional to the length
+ * of the key times the number of branches of the nodes on its path.
+ *
+ * \param dict The dictionary
+ * \param key The key
+ * \param key_len Length of the key
+ * \return Number of keys less than the key, which is the position of the
+ *         key in the order if it is present.
+ */
+size_t mdsl_dict_rank(MdslDict *dict, const void *key, size_t key_len);
+
+/**
+ * Returns a pointer to the location where value for the key is stored,
+ * in a single traversal. Storing a non-NULL value there is same as 
+ * setting the key with mdsl_dict_set(), so "look up, insert if missing" 
+ * and in-place updates need only one walk of the trie. 
+ * The pointer is valid until the next modification of the dictionary or
+ * the next mdsl_dict_snapshot() of it, since nodes behind it are shared 
+ * with the snapshot from then on.
+ *
+ * The key is counted in mdsl_dict_count_prefix(), mdsl_dict_rank() and
+ * the statistics as soon as the location is returned. If the location is 
+ * left NULL, or NULL is stored there, the key is removed at the next 
+ * modification of the dictionary, and counted until then.
+ * Cannot be used with dictionaries created with MDSL_DICT_CONCURRENT or
+ * MDSL_DICT_U64, or with snapshots themselves.
+ *
+ * \param dict The dictionary
+ * \param key The key
+ * \param key_len Length of the key
+ * \param create Whether to create the location if the key is not present
+ * \return Pointer to the value, which is NULL if the key is not present. 
+ *         NULL if create is 0 and the key is not present.
+ */
+void **mdsl_dict_lookup_slot
+	(MdslDict *dict, const void *key, size_t key_len, int create);
+
+/**
+ * Finds the longest key in the dictionary that is a prefix of the given key,
+ * in a single traversal.
+ *
+ * \param dict The dictionary
+ * \param key The key to match
+ * \param key_len Length of the key
+ * \param matched_len_return Return location for length of the matching key,
+ *                           0 if there is no match. Can be NULL.
+ * \return Value of the longest matching key, NULL if no key matches.
+ */
+void *mdsl_dict_get_longest_prefix(MdslDict *dict, 
+		const void *key, size_t key_len, size_t *matched_len_return);
+
+/**
+ * Looks up many keys at once. Traversals of different keys are interleaved
+ * and memory needed for the next step of each traversal is prefetched, so
+ * that cache misses overlap. This is faster than calling mdsl_dict_get()
+ * in a loop when the dictionary does not fit in cache.
+ *
+ * \param dict The dictionary
+ * \param keys Array of n keys
+ * \param key_lens Array of n key lengths
+ * \param n Number of keys
+ * \param values_return Array where n values are stored, NULL for keys 
+ *                      that are not found
+ */
+void mdsl_dict_get_many(MdslDict *dict, const void * const *keys,
+		const size_t *key_lens, size_t n, void **values_return);
+
+/**
+ * Source of key-value pairs for mdsl_dict_bulk_load().
+ *
+ * \param user_data User data passed to mdsl_dict_bulk_load()
+ * \param key_return Return location for the key
+ * \param key_len_return Return location for length of the key
+ * \param value_return Return location for the value, pairs with NULL value
+ *                     are skipped
+ * \return 1 if a pair was returned, 0 if there are no more pairs.
+ */
+typedef int (*MdslDictSource)(void *user_data, const void **key_return,
+		size_t *key_len_return, const void **value_return);
+
+/**
+ * Fills an empty dictionary from keys sorted in lexicographic byte order.
+ * Each node is built once with its final ByteMap, in time linear in total
+ * length of the keys. The resulting dictionary is identical to one built by
+ * inserting the keys in the same order.
+ *
+ * \param dict An empty dictionary
+ * \param source Function returning the key-value pairs in order
+ * \param user_data User data for source
+ * \return MDSL_FAILURE if the dictionary is not empty or keys are not
+ *         strictly increasing, in which case the dictionary is unchanged.
+ */
+MdslStatus mdsl_dict_bulk_load
+	(MdslDict *dict, MdslDictSource source, void *user_data);
+
+/**
+ * Fills an empty dictionary from unsorted key-value pairs using several
+ * threads. Pairs are partitioned by the first byte of the key, then the
+ * partitions are sorted and built into subtrees in parallel. Speedup is 
+ * therefore limited when most keys share their first byte. The keys and
+ * values are those mdsl_dict_set() would leave for the pairs in order:
+ * later pairs for the same key replace earlier ones, and a NULL value
+ * removes the key. The nodes are identical to those from inserting the
+ * remaining pairs.
+ *
+ * \param dict An empty dictionary
+ * \param keys Array of n keys
+ * \param key_lens Array of n key lengths
+ * \param values Array of n values
+ * \param n Number of pairs
+ * \param n_threads Number of threads to use, including the calling thread
+ * \return MDSL_FAILURE if the dictionary is not empty, in which case it
+ *         is unchanged.
+ */
+MdslStatus mdsl_dict_build_parallel(MdslDict *dict, const void * const *keys,
+		const size_t *key_lens, const void * const *values, size_t n,
+		int n_threads);
+
 MdslDict *mdsl_dict_new();
 
+/**
+ * Number of ByteMap layouts counted in MdslDictStats: empty, single child,
+ * 4, 16 and 48 children, bitmap with packed children, 256 children.
+ */
+#define MDSL_DICT_N_MAP_MODES 7
+
+/**
+ * Number of depth buckets in MdslDictStats, the last bucket counts 
+ * all deeper keys.
+ */
+#define MDSL_DICT_N_DEPTHS 32
+
+/**
+ * Memory footprint and shape of a dictionary
+ */
+typedef struct
+{
+	/**Number of keys*/
+	size_t n_keys;
+	/**Number of nodes, including the root*/
+	size_t n_nodes;
+	/**Bytes in nodes that are in use*/
+	size_t node_bytes;
+	/**Bytes in child tables of nodes*/
+	size_t map_bytes;
+	/**All memory held by the dictionary, including memory reserved 
+	 * for future nodes*/
+	size_t total_bytes;
+	/**Total length of compressed key runs stored in nodes*/
+	size_t run_bytes;
+	/**Number of nodes using each child table layout*/
+	size_t map_modes[MDSL_DICT_N_MAP_MODES];
+	/**Child tables converted to a layout for more children, since the 
+	 * dictionary was created*/
+	size_t n_map_grows;
+	/**Child tables converted to a layout for fewer children*/
+	size_t n_map_shrinks;
+	/**Child tables reallocated without changing layout*/
+	size_t n_map_resizes;
+	/**Average length of compressed key runs*/
+	double avg_run_len;
+	/**total_bytes divided by n_keys*/
+	double bytes_per_key;
+	/**Whether depths was filled in*/
+	int have_depths;
+	/**Number of keys at each depth, counted in nodes from the root*/
+	size_t depths[MDSL_DICT_N_DEPTHS];
+} MdslDictStats;
+
+/**
+ * Fetches statistics of the dictionary. Counters other than the depth 
+ * histogram are maintained as the dictionary changes, so without walk
+ * this takes constant time and can be polled freely.
+ *
+ * \param dict The dictionary
+ * \param stats Return location for statistics
+ * \param walk Whether to walk the whole dictionary to fill in the depth
+ *             histogram and recount keys
+ */
+void mdsl_dict_get_stats(MdslDict *dict, MdslDictStats *stats, int walk);
+
+/**
+ * Flags for mdsl_dict_new_with_flags()
+ */
+typedef enum
+{
+	/**
+	 * Allows mdsl_dict_get() and mdsl_dict_get_many() to run from any 
+	 * number of threads concurrently with each other and with one writer.
+	 * Readers take no locks. Writers copy the path to the modified node,
+	 * publish it atomically and are serialized by a mutex. Memory that 
+	 * readers may still see is freed once all readers have moved past it.
+	 * Iterators, mdsl_dict_freeze() and mdsl_dict_fdump() must be 
+	 * enclosed between mdsl_dict_read_begin() and mdsl_dict_read_end() 
+	 * to be used concurrently with writers.
+	 */
+	MDSL_DICT_CONCURRENT = 1 << 0,
+	/**
+	 * Values are 64-bit integers stored inline in the nodes, so reading 
+	 * them needs no further dereference and no value needs an allocation
+	 * of its own. Any integer including 0 can be stored. Values are 
+	 * accessed with mdsl_dict_u64_set(), mdsl_dict_u64_add(), 
+	 * mdsl_dict_u64_get() and mdsl_dict_u64_remove(), and iterators 
+	 * return them in iter->u64. Functions taking or returning pointer 
+	 * values cannot be used, except mdsl_dict_freeze(), which stores the
+	 * integers as they are.
+	 */
+	MDSL_DICT_U64 = 1 << 1,
+	/**
+	 * Keeps a direct indexed table over the first two bytes of keys, so 
+	 * that mdsl_dict_get(), mdsl_dict_get_many() and mdsl_dict_u64_get() 
+	 * skip the top two levels of the trie when the keys below a first 
+	 * byte do not share a common prefix. The table has 65536 entries and
+	 * is allocated when the first key is stored. Writes keep it up to 
+	 * date at the cost of one more update per write. Snapshots do not 
+	 * inherit the table. Cannot be combined with MDSL_DICT_CONCURRENT.
+	 */
+	MDSL_DICT_ROOT_TABLE = 1 << 2
+} MdslDictFlags;
+
+/**
+ * Creates a new dictionary.
+ *
+ * \param flags Bitwise OR of MdslDictFlags
+ * \return A new dictionary
+ */
+MdslDict *mdsl_dict_new_with_flags(MdslDictFlags flags);
+
+/**
+ * Marks the start of a read-side critical section. Memory reachable from 
+ * the dictionary is not freed until the matching mdsl_dict_read_end().
+ * Calls can be nested. Does nothing unless the dictionary was created with
+ * MDSL_DICT_CONCURRENT.
+ *
+ * \param dict The dictionary
+ */
+void mdsl_dict_read_begin(MdslDict *dict);
+
+/**
+ * Marks the end of a read-side critical section.
+ *
+ * \param dict The dictionary
+ */
+void mdsl_dict_read_end(MdslDict *dict);
+
+/**
+ * Creates a read-only snapshot of the dictionary. The snapshot shares 
+ * nodes with the dictionary, so taking it costs O(1). Later writes to the
+ * dictionary copy the nodes on the path of the modified key that are 
+ * still shared, and the snapshot keeps seeing contents of the dictionary 
+ * at the time it was taken. Snapshots can be read from other threads 
+ * while the dictionary is modified, and can be snapshotted themselves. 
+ * Attempts to modify a snapshot are fatal errors. Release snapshots 
+ * with mdsl_dict_unref(), in any order.
+ *
+ * Memory statistics of a dictionary include memory of all nodes shared 
+ * with its snapshots. Cannot be used with dictionaries created with 
+ * MDSL_DICT_CONCURRENT.
+ *
+ * \param dict The dictionary
+ * \return A new snapshot
+ */
+MdslDict *mdsl_dict_snapshot(MdslDict *dict);
+
+/**
+ * Stores an integer value for the key in a dictionary created with 
+ * MDSL_DICT_U64.
+ *
+ * \param dict The dictionary
+ * \param key The key
+ * \param key_len Length of the key
+ * \param value The value
+ * \return 1 if the key already had a value, 0 otherwise
+ */
+int mdsl_dict_u64_set
+	(MdslDict *dict, const void *key, size_t key_len, uint64_t value);
+
+/**
+ * Adds to the integer value of the key in a single traversal. A missing 
+ * key counts as 0, so this is suitable for counting.
+ *
+ * \param dict A dictionary created with MDSL_DICT_U64
+ * \param key The key
+ * \param key_len Length of the key
+ * \param delta Amount to add, wraps around modulo 2^64
+ * \return The new value
+ */
+uint64_t mdsl_dict_u64_add
+	(MdslDict *dict, const void *key, size_t key_len, uint64_t delta);
+
+/**
+ * Looks up the integer value of the key.
+ *
+ * \param dict A dictionary created with MDSL_DICT_U64
+ * \param key The key
+ * \param key_len Length of the key
+ * \param value_return Return location for the value, or NULL
+ * \return 1 if the key is present, 0 otherwise
+ */
+int mdsl_dict_u64_get(MdslDict *dict, 
+		const void *key, size_t key_len, uint64_t *value_return);
+
+/**
+ * Removes the key.
+ *
+ * \param dict A dictionary created with MDSL_DICT_U64
+ * \param key The key
+ * \param key_len Length of the key
+ * \param value_return Return location for the removed value, or NULL
+ * \return 1 if the key was present, 0 otherwise
+ */
+int mdsl_dict_u64_remove(MdslDict *dict, 
+		const void *key, size_t key_len, uint64_t *value_return);
+
 mdsl_rc_declare(MdslDict, mdsl_dict);
 
 void *mdsl_dict_set_str
@@ -38,3 +377,123 @@ void *mdsl_dict_get_str
 
 void mdsl_dict_dump(MdslDict *dict);
 void mdsl_dict_fdump(MdslDict *dict, FILE *stream);
+
+//Ordered iteration
+typedef struct
+{
+	MdslDict *dict;
+	const void *key;
+	size_t key_len;
+	void *value;
+	/**Value for dictionaries created with MDSL_DICT_U64*/
+	uint64_t u64;
+
+	//Private
+	MdslRBuf key_buf;
+	MdslRBuf stack;
+} MdslDictIter;
+
+/**
+ * Initializes an iterator over all keys of a dictionary.
+ * Keys are visited in lexicographic byte order. Modifying the dictionary
+ * invalidates all iterators on it, except for mdsl_dict_iter_init and
+ * mdsl_dict_iter_destroy.
+ *
+ * \param iter An uninitialized iterator
+ * \param dict The dictionary to iterate over
+ */
+void mdsl_dict_iter_init(MdslDictIter *iter, MdslDict *dict);
+
+/**
+ * Restricts the iterator to keys starting with given prefix and rewinds it.
+ * Buffers of the iterator are reused, so repeated scans do not
+ * allocate memory.
+ *
+ * \param iter An initialized iterator
+ * \param prefix The prefix
+ * \param prefix_len Length of the prefix
+ */
+void mdsl_dict_iter_seek
+	(MdslDictIter *iter, const void *prefix, size_t prefix_len);
+
+/**
+ * Moves the iterator to the key at position k in order, counting from 0, 
+ * so that the next call to mdsl_dict_iter_next() returns it and later calls
+ * return the keys after it. Lifts any restriction set by 
+ * mdsl_dict_iter_seek(). Takes time proportional to the length of the key 
+ * times the number of branches of the nodes on its path, so pages of a 
+ * large dictionary can be fetched without walking the keys before them.
+ *
+ * \param iter An initialized iterator
+ * \param k Position of the key
+ * \return 1 if there is a key at position k, 0 if there are at most k 
+ *         keys, in which case iteration is finished.
+ */
+int mdsl_dict_iter_select(MdslDictIter *iter, size_t k);
+
+/**
+ * Advances the iterator to the next key.
+ * On success iter->key, iter->key_len and iter->value describe the 
+ * key-value pair. iter->key is valid till the next call.
+ *
+ * \param iter An initialized iterator
+ * \return 1 if a key was found, 0 if iteration is finished.
+ */
+int mdsl_dict_iter_next(MdslDictIter *iter);
+
+/**
+ * Frees memory held by the iterator.
+ *
+ * \param iter An initialized iterator
+ */
+void mdsl_dict_iter_destroy(MdslDictIter *iter);
+
+//Frozen images
+
+/**
+ * Converts a value to an integer to be stored in a frozen image.
+ *
+ * \param user_data User data passed to mdsl_dict_freeze()
+ * \param value The value stored in the dictionary
+ * \return The integer to store instead
+ */
+typedef uint64_t (*MdslDictFreezeFunc)(void *user_data, const void *value);
+
+/**
+ * Serializes a dictionary into one contiguous, position independent buffer.
+ * Nodes are laid out in breadth first order and refer to their children by
+ * offsets, so the image can be written to a file and used directly from
+ * a read-only mmap() in any number of processes. Values are stored as 64-bit
+ * integers. The image uses host byte order.
+ *
+ * \param dict The dictionary
+ * \param func Function to convert values to integers, or NULL to store
+ *             the pointers themselves
+ * \param user_data User data for func
+ * \param len_return Return location for length of the image
+ * \return Newly allocated image, free with free()
+ */
+void *mdsl_dict_freeze(MdslDict *dict, MdslDictFreezeFunc func,
+		void *user_data, size_t *len_return);
+
+/**
+ * Checks that a buffer looks like an image created by mdsl_dict_freeze().
+ * Only the header is checked, the image must come from a trusted source.
+ *
+ * \param image The image
+ * \param image_len Length of the image
+ * \return MDSL_SUCCESS if the image can be used with mdsl_frozen_dict_get()
+ */
+MdslStatus mdsl_frozen_dict_check(const void *image, size_t image_len);
+
+/**
+ * Looks up a key in a frozen image.
+ *
+ * \param image The image, aligned to 8 bytes
+ * \param key The key
+ * \param key_len Length of the key
+ * \param value_return Return location for the value, or NULL
+ * \return 1 if the key was found, 0 otherwise
+ */
+int mdsl_frozen_dict_get(const void *image, 
+		const void *key, size_t key_len, uint64_t *value_return);
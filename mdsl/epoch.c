@@ -0,0 +1,144 @@
+/* epoch.c
+ * Epoch based memory reclamation (library-private)
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#include "epoch.h"
+
+#include <pthread.h>
+
+//One record per thread that ever entered a critical section.
+//Records are never freed, records of exited threads are reused.
+typedef struct _EpochRecord EpochRecord;
+struct _EpochRecord
+{
+	//(epoch << 1) | 1 while in critical section, 0 otherwise
+	unsigned long state;
+	int nesting;
+	int in_use;
+	EpochRecord *next;
+};
+
+static unsigned long global_epoch = 0;
+static EpochRecord *records = NULL;
+
+static __thread EpochRecord *self = NULL;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+static void epoch_record_release(void *data)
+{
+	EpochRecord *record = (EpochRecord *) data;
+	__atomic_store_n(&(record->state), 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&(record->in_use), 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_key_init()
+{
+	if (pthread_key_create(&key, epoch_record_release) != 0)
+		mdsl_error("pthread_key_create() failed");
+}
+
+static EpochRecord *epoch_register()
+{
+	EpochRecord *record;
+
+	pthread_once(&key_once, epoch_key_init);
+
+	//Reuse a record of a thread that has exited
+	for (record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record;
+			record = record->next)
+	{
+		int expected = 0;
+		if (__atomic_compare_exchange_n(&(record->in_use), &expected, 1,
+					0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if (! record)
+	{
+		record = mdsl_new(EpochRecord);
+		record->state = 0;
+		record->in_use = 1;
+		record->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+		while (! __atomic_compare_exchange_n(&records, &(record->next), 
+					record, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	record->nesting = 0;
+	pthread_setspecific(key, record);
+	self = record;
+	return record;
+}
+
+void mdsl_epoch_enter()
+{
+	EpochRecord *record = self;
+	if (! record)
+		record = epoch_register();
+
+	if (record->nesting++ == 0)
+	{
+		unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+		__atomic_store_n(&(record->state), (epoch << 1) | 1, 
+				__ATOMIC_RELAXED);
+		//The store above must be visible before any shared memory is read
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+void mdsl_epoch_exit()
+{
+	EpochRecord *record = self;
+
+	if (--(record->nesting) == 0)
+		__atomic_store_n(&(record->state), 0, __ATOMIC_RELEASE);
+}
+
+unsigned long mdsl_epoch_get()
+{
+	return __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+}
+
+unsigned long mdsl_epoch_try_advance()
+{
+	EpochRecord *record;
+	unsigned long epoch;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+
+	for (record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record;
+			record = record->next)
+	{
+		unsigned long state = __atomic_load_n(&(record->state), 
+				__ATOMIC_ACQUIRE);
+		if ((state & 1) && (state >> 1) != epoch)
+			return epoch;
+	}
+
+	if (__atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1,
+				0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		epoch++;
+
+	return epoch;
+}
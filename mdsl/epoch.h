@@ -0,0 +1,37 @@
+/* epoch.h
+ * Epoch based memory reclamation (library-private)
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//Readers bracket their accesses to shared memory with mdsl_epoch_enter()
+//and mdsl_epoch_exit(). Memory unlinked while the global epoch is e can be
+//freed once the global epoch reaches e + 2, as no reader can hold
+//a reference to it by then. Calls can be nested.
+
+#define MDSL_EPOCH_GRACE 2
+
+void mdsl_epoch_enter();
+
+void mdsl_epoch_exit();
+
+//Returns the current global epoch
+unsigned long mdsl_epoch_get();
+
+//Advances the global epoch if all readers have observed the current one,
+//and returns the global epoch.
+unsigned long mdsl_epoch_try_advance();
@@ -21,6 +21,7 @@
 //TODO: Decide the includes in API headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -28,5 +29,8 @@
 //Include all modules in dependency-based order
 #include "utils.h"
 #include "arrays.h"
+#include "bytemap.h"
 #include "dict.h"
+#include "sharded.h"
+#include "scanner.h"
 #include "event.h"
@@ -18,348 +18,329 @@
  * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-//A small AVL tree for handling collisions in small hash tables
-typedef struct
-{
-	uint8_t key, left, right, height;
-} MiniAvlNode;
 
+#include "simd.h"
+
+#ifdef __GNUC__
+#define mdsl_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define mdsl_prefetch(addr) ((void) 0)
+#endif
+
+//A space efficient map that maps a byte to a pointer.
+//The layouts are those of adaptive radix trees:
+//mode 0: empty map
+//mode 1: single element, key stored in metainf, value in ptr
+//mode 2: Node4, sorted keys and values
+//mode 3: Node16, sorted keys and values, searched using SIMD
+//mode 4: Node48, 256-entry index into 48 value slots
+//mode 5: bitmap, occupancy bits and values packed in key order, 
+//        a value is found by counting the bits below its key
+//mode 6: Node256, direct indexed table
+//In bitmap mode, capacity is the number of value slots allocated, kept in
+//the map so that the size is known without touching the storage.
+//The structure is public as MdslByteMap.
+typedef MdslByteMap ByteMap;
 
-static inline int avl_do_hbf(MiniAvlNode *mem, int x)
+typedef struct
 {
-	int l = mem[x].left;
-	int lh = l ? mem[l].height : 0;
-	int r = mem[x].right;
-	int rh = r ? mem[r].height : 0;
-	mem[x].height = (lh > rh ? lh : rh) + 1;
-
-	return rh - lh;
-}
+	uint8_t keys[4];
+	void *values[4];
+} ByteMapNode4;
 
-static inline int avl_rotate_l(MiniAvlNode *mem, int x)
+typedef struct
 {
-	int r = mem[x].right;
-	int b = mem[r].left;
-
-	mem[r].left = x;
-	mem[x].right = b;
+	uint8_t keys[16];
+	void *values[16];
+} ByteMapNode16;
 
-	avl_do_hbf(mem, x);
-	avl_do_hbf(mem, r);
-
-	return r;
-}
-
-static inline int avl_rotate_r(MiniAvlNode *mem, int x)
+typedef struct
 {
-	int r = mem[x].left;
-	int b = mem[r].right;
-
-	mem[r].right = x;
-	mem[x].left = b;
-
-	avl_do_hbf(mem, x);
-	avl_do_hbf(mem, r);
+	uint8_t index[256];
+	void *values[48];
+} ByteMapNode48;
 
-	return r;
-}
-
-static inline int avl_balance1(MiniAvlNode *mem, int x)
+//Value slots are allocated BYTE_MAP_BITMAP_STEP at a time
+typedef struct
 {
-	int bf = avl_do_hbf(mem, x);
+	uint64_t bits[4];
+	//Number of keys below 64 * i
+	uint8_t before[4];
+	void *values[];
+} ByteMapBitmap;
 
-	if (bf < -1)
-	{
-		if (avl_do_hbf(mem, mem[x].left) > 0)
-			mem[x].left = avl_rotate_l(mem, mem[x].left);
-		x = avl_rotate_r(mem, x);
-	}
-	else if (bf > 1)
+typedef struct
+{
+	void *values[256];
+} ByteMapNode256;
+
+//A nearly full bitmap is almost as big as Node256, which is faster
+static const int mode_table[] = {0, 1, 4, 16, 48, 224, 256, -1};
+
+#define BYTE_MAP_MODE_NODE4 2
+#define BYTE_MAP_MODE_NODE16 3
+#define BYTE_MAP_MODE_NODE48 4
+#define BYTE_MAP_MODE_BITMAP 5
+#define BYTE_MAP_MODE_NODE256 6
+
+//Node256 shrinks to a bitmap this far below the bitmap capacity
+#define BYTE_MAP_BITMAP_SLACK 32
+
+//Bitmaps grow by a cache line of values and give memory back only when
+//two lines are unused, so that a map whose size goes up and down by one
+//is not reallocated every time
+#define BYTE_MAP_BITMAP_STEP 8
+
+//Sorted key arrays (Node4 and Node16), searched with one SIMD compare.
+//Keys past n are masked out.
+#ifdef MDSL_HAVE_SSE2
+static inline __m128i byte_map_sorted_load(const uint8_t *keys, int mode)
+{
+	if (mode == BYTE_MAP_MODE_NODE4)
 	{
-		if (avl_do_hbf(mem, mem[x].right) < 0)
-			mem[x].right = avl_rotate_r(mem, mem[x].right);
-		x = avl_rotate_l(mem, x);
+		uint32_t word;
+		memcpy(&word, keys, 4);
+		return _mm_cvtsi32_si128((int) word);
 	}
-
-	return x;
+	return _mm_loadu_si128((const __m128i *) keys);
 }
+#endif
 
-static int avl_set_rec(MiniAvlNode *mem, int x, int key, int *tray)
+//Index of key, or -1
+static inline int byte_map_sorted_find
+	(const uint8_t *keys, int mode, int n, int key)
 {
-	if (!x)
-	{
-		x = *tray;
-		*tray = 0;
-		mem[x].key = key;
-		mem[x].left = mem[x].right = 0;
-		mem[x].height = 1;
-	}
-	else if (key < mem[x].key)
-	{
-		mem[x].left = avl_set_rec(mem, mem[x].left, key, tray);
-		x = avl_balance1(mem, x);
-	}
-	else if (key > mem[x].key)
-	{
-		mem[x].right = avl_set_rec(mem, mem[x].right, key, tray);
-		x = avl_balance1(mem, x);
-	}
-	else
+#ifdef MDSL_HAVE_SSE2
+	__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char) key),
+			byte_map_sorted_load(keys, mode));
+	int mask = _mm_movemask_epi8(cmp) & ((1 << n) - 1);
+	return mask ? __builtin_ctz(mask) : -1;
+#else
+	int i;
+	for (i = 0; i < n; i++)
 	{
-		*tray = x;
+		if (keys[i] == key)
+			return i;
 	}
-	
-	return x;
+	return -1;
+#endif
 }
 
-static int avl_remove_min(MiniAvlNode *mem, int x, int *tray)
+//Index of the first key not less than given key, or n. key can be 256.
+static inline int byte_map_sorted_lower_bound
+	(const uint8_t *keys, int mode, int n, int key)
 {
-	if (mem[x].left)
-	{
-		mem[x].left = avl_remove_min(mem, mem[x].left, tray);
-		return avl_balance1(mem, x);
-	}
-	else
-	{
-		*tray = x;
-		return mem[x].right;
-	}
+#ifdef MDSL_HAVE_SSE2
+	if (key > 255)
+		return n;
+
+	//Unsigned comparison: k >= key exactly when max(k, key) == k
+	__m128i v = byte_map_sorted_load(keys, mode);
+	__m128i ge = _mm_cmpeq_epi8
+		(_mm_max_epu8(v, _mm_set1_epi8((char) key)), v);
+	int mask = _mm_movemask_epi8(ge) & ((1 << n) - 1);
+	return mask ? __builtin_ctz(mask) : n;
+#else
+	int i;
+	for (i = 0; i < n && keys[i] < key; i++)
+		;
+	return i;
+#endif
 }
 
-static int avl_unset_rec(MiniAvlNode *mem, int x, int key, int *tray)
+static inline void byte_map_sorted_insert
+	(uint8_t *keys, void **values, int n, int key, void *value)
 {
-	if (!x)
-	{
-		return 0;
-	}
-	if (key < mem[x].key)
+	int i;
+	for (i = n; i > 0 && keys[i - 1] > key; i--)
 	{
-		mem[x].left = avl_unset_rec(mem, mem[x].left, key, tray);
-		return avl_balance1(mem, x);
+		keys[i] = keys[i - 1];
+		values[i] = values[i - 1];
 	}
-	else if (key > mem[x].key)
+	keys[i] = key;
+	values[i] = value;
+}
+
+static inline void byte_map_sorted_remove
+	(uint8_t *keys, void **values, int n, int idx)
+{
+	int i;
+	for (i = idx + 1; i < n; i++)
 	{
-		mem[x].right = avl_unset_rec(mem, mem[x].right, key, tray);
-		return avl_balance1(mem, x);
-	}
-	else
-	{
-		*tray = x;
-		if (mem[x].right)
-		{
-			int new_x = 0;
-			mem[x].right = avl_remove_min(mem, mem[x].right, &new_x);
-			mem[new_x].left = mem[x].left;
-			mem[new_x].right = mem[x].right;
-			new_x = avl_balance1(mem, new_x);
-			return new_x;
-		}
-		else
-		{
-			return mem[x].left;	
-		}
+		keys[i - 1] = keys[i];
+		values[i - 1] = values[i];
 	}
+	keys[n - 1] = 0;
+	values[n - 1] = NULL;
 }
 
-//We use hash table + AVL trees for sizes: 5, 11, 23, 59
-//We use DIT for size 256.
-typedef struct
+//Bitmap
+static inline size_t byte_map_bitmap_size(int capacity)
 {
-	uint8_t freelist;
-} SizedMap;
+	return sizeof(ByteMapBitmap) + capacity * sizeof(void *);
+}
 
-typedef struct
+static inline int byte_map_bitmap_capacity(int n)
 {
-	void **values;
-	uint8_t *htable;
-	MiniAvlNode *avl_nodes;
-} SizedMapExt;
+	return (n + BYTE_MAP_BITMAP_STEP - 1) 
+		/ BYTE_MAP_BITMAP_STEP * BYTE_MAP_BITMAP_STEP;
+}
 
-static inline size_t align_offset(size_t x)
+//Position of key among the values, whether the key is present or not
+static inline int byte_map_bitmap_rank(const ByteMapBitmap *node, int key)
 {
-	size_t ap = sizeof(void *) * 2; //< This is debated
-	if (x % ap)
-		x += ap - (x % ap);
-	return x;
+	uint64_t below = (((uint64_t) 1) << (key % 64)) - 1;
+	return node->before[key / 64] 
+		+ mdsl_popcount64(node->bits[key / 64] & below);
 }
 
-static inline SizedMap *sized_map_ext
-	(int size, SizedMap *ds, SizedMapExt *dse)
+static inline int byte_map_bitmap_find(const ByteMapBitmap *node, int key)
 {
-	size_t values_offset = align_offset(sizeof(SizedMap));
-	size_t htable_offset = align_offset(values_offset + sizeof(void *) * size);
-	size_t avl_nodes_offset = align_offset(htable_offset + size);
-	size_t alloc_size = avl_nodes_offset + sizeof(MiniAvlNode) * size;
-
-	char *mem;
-	if (!ds)
-		ds = mdsl_alloc(alloc_size);
-	mem = (char *) ds;
-
-	dse->values = (void **) (mem + values_offset);
-	dse->htable = (uint8_t *) (mem + htable_offset);
-	dse->avl_nodes = (MiniAvlNode *) (mem + avl_nodes_offset);
-
-	return ds;
+	if (! (node->bits[key / 64] & (((uint64_t) 1) << (key % 64))))
+		return -1;
+	return byte_map_bitmap_rank(node, key);
 }
 
-static SizedMap *sized_map_new(size_t size)
+//Smallest key not less than from, or -1
+static inline int byte_map_bitmap_next(const ByteMapBitmap *node, int from)
 {
-	SizedMap *ds;
-	SizedMapExt dse;
-
-	ds = sized_map_ext(size, NULL, &dse);
-
 	int i;
-	for (i = 0; i < size; i++)
+
+	for (i = from / 64; i < 4; i++)
 	{
-		dse.htable[i] = 0;
-		dse.avl_nodes[i].key = i + 2;
-		dse.values[i] = NULL;
+		uint64_t bits = node->bits[i];
+		if (i == from / 64)
+			bits &= ~((uint64_t) 0) << (from % 64);
+		if (bits)
+			return i * 64 + __builtin_ctzll(bits);
 	}
-	dse.avl_nodes[size - 1].key = 0;
-	ds->freelist = 1;
-	return ds;
+	return -1;
 }
 
-static int sized_map_insert(size_t size, SizedMap *ds, int key, void *value) 
-{ 
-	SizedMapExt dse;
-	sized_map_ext(size, ds, &dse);
-
-	int alloc, tray; 
-	alloc = ds->freelist; 
-	if (!alloc) 
-		return -1; 
-	ds->freelist = dse.avl_nodes[ds->freelist - 1].key; 
-	tray = alloc; 
-	dse.htable[key % size] = avl_set_rec 
-		(dse.avl_nodes - 1, dse.htable[key % size], key, &tray); 
-	if (tray) 
-	{ 
-		dse.avl_nodes[alloc - 1].key = ds->freelist; 
-		ds->freelist = alloc; 
-		alloc = tray; 
-	} 
-	dse.values[alloc - 1] = value; 
-	return tray ? 0 : 1; 
-} 
-
-static int sized_map_delete(size_t size, SizedMap *ds, int key) 
-{ 
-	SizedMapExt dse;
-	sized_map_ext(size, ds, &dse);
-
-	int tray = 0; 
-	dse.htable[key % size] = avl_unset_rec 
-		(dse.avl_nodes - 1, dse.htable[key % size], key, &tray); 
-	if (tray) 
-	{ 
-		dse.avl_nodes[tray - 1].key = ds->freelist; 
-		ds->freelist = tray; 
-		dse.values[tray - 1] = NULL; 
-		return 1; 
-	} 
-	else 
-	{ 
-		return 0; 
-	} 
-} 
-
-static void *sized_map_get(size_t size, SizedMap *ds, int key) 
+//Allocates storage for given mode and fills it with sorted tuples.
+static void *byte_map_storage_new
+	(int mode, const uint8_t *keys, void **values, int n)
 {
-	SizedMapExt dse;
-	sized_map_ext(size, ds, &dse);
+	int i;
 
-	int idx = dse.htable[key % size];
-	while (idx)
+	if (mode == BYTE_MAP_MODE_NODE4)
 	{
-		if (key < dse.avl_nodes[idx - 1].key)
-			idx = dse.avl_nodes[idx - 1].left;
-		else if (key > dse.avl_nodes[idx - 1].key)
-			idx = dse.avl_nodes[idx - 1].right;
-		else
-			return dse.values[idx - 1];
+		ByteMapNode4 *node = mdsl_new(ByteMapNode4);
+		for (i = 0; i < 4; i++)
+		{
+			node->keys[i] = i < n ? keys[i] : 0;
+			node->values[i] = i < n ? values[i] : NULL;
+		}
+		return node;
 	}
-	return NULL;
-}
-
-static void sized_map_transfer
-	(size_t size, SizedMap *ds, size_t nsize, SizedMap *nds)
-{
-	SizedMapExt dse;
-	sized_map_ext(size, ds, &dse);
-	int i;
-	for (i = 0; i < size; i++)
+	else if (mode == BYTE_MAP_MODE_NODE16)
 	{
-		if (dse.values[i])
+		ByteMapNode16 *node = mdsl_new(ByteMapNode16);
+		for (i = 0; i < 16; i++)
 		{
-			int key = dse.avl_nodes[i].key;
-			void *value = dse.values[i];
-			sized_map_insert(nsize, nds, key, value);
+			node->keys[i] = i < n ? keys[i] : 0;
+			node->values[i] = i < n ? values[i] : NULL;
 		}
+		return node;
 	}
-}
-
-static void sized_map_to_dit(size_t size, SizedMap *ds, void **dit)
-{
-	SizedMapExt dse;
-	sized_map_ext(size, ds, &dse);
-	int i; 
-	for (i = 0; i < 256; i++)
+	else if (mode == BYTE_MAP_MODE_NODE48)
 	{
-		dit[i] = NULL;
+		ByteMapNode48 *node = mdsl_new(ByteMapNode48);
+		for (i = 0; i < 256; i++)
+			node->index[i] = 0;
+		for (i = 0; i < 48; i++)
+			node->values[i] = i < n ? values[i] : NULL;
+		for (i = 0; i < n; i++)
+			node->index[keys[i]] = i + 1;
+		return node;
 	}
-	for (i = 0; i < size; i++)
+	else if (mode == BYTE_MAP_MODE_BITMAP)
 	{
-		if (dse.values[i])
-			dit[dse.avl_nodes[i].key] = dse.values[i];
+		ByteMapBitmap *node = (ByteMapBitmap *) mdsl_alloc
+			(byte_map_bitmap_size(byte_map_bitmap_capacity(n)));
+		for (i = 0; i < 4; i++)
+			node->bits[i] = 0;
+		for (i = 0; i < n; i++)
+		{
+			node->bits[keys[i] / 64] |= ((uint64_t) 1) << (keys[i] % 64);
+			node->values[i] = values[i];
+		}
+		node->before[0] = 0;
+		for (i = 1; i < 4; i++)
+			node->before[i] = node->before[i - 1] 
+				+ mdsl_popcount64(node->bits[i - 1]);
+		return node;
+	}
+	else
+	{
+		ByteMapNode256 *node = mdsl_new(ByteMapNode256);
+		for (i = 0; i < 256; i++)
+			node->values[i] = NULL;
+		for (i = 0; i < n; i++)
+			node->values[keys[i]] = values[i];
+		return node;
 	}
 }
 
-static void sized_map_from_dit(size_t size, SizedMap *ds, void **dit)
+static void byte_map_init(ByteMap *m)
 {
-	int i; 
-	for (i = 0; i < 256; i++)
-	{
-		if (dit[i])
-			sized_map_insert(size, ds, i, dit[i]);
-	}
+	m->ptr = NULL;
+	m->metainf = 0;
+	m->capacity = 0;
 }
 
-static int sized_map_get_tuples
-	(size_t size, SizedMap *ds, uint8_t *keys, void **values)
+static int byte_map_get_tuples(ByteMap *m, uint8_t *keys, void **values);
+
+//Builds the map from sorted tuples, choosing the smallest mode that fits.
+//Any previous content is ignored.
+static void byte_map_build
+	(ByteMap *m, const uint8_t *keys, void **values, int n)
 {
-	SizedMapExt dse;
-	sized_map_ext(size, ds, &dse);
-	int i, j;
-	j = 0;
-	for (i = 0; i < size; i++)
+	int mode;
+
+	if (n == 0)
 	{
-		if (dse.values[i])
-		{
-			keys[j] = dse.avl_nodes[i].key;
-			values[j] = dse.values[i];
-			j++;
-		}
+		byte_map_init(m);
+	}
+	else if (n == 1)
+	{
+		m->ptr = values[0];
+		m->metainf = 1 | keys[0] * 16;
+	}
+	else
+	{
+		for (mode = BYTE_MAP_MODE_NODE4; mode_table[mode] < n; mode++)
+			;
+		m->ptr = byte_map_storage_new(mode, keys, values, n);
+		m->metainf = mode | n * 16;
+		if (mode == BYTE_MAP_MODE_BITMAP)
+			m->capacity = byte_map_bitmap_capacity(n);
 	}
-	return j;
 }
 
-
-//A space efficient map that maps a byte to a pointer
-typedef struct
+//Moves the contents of the map into storage of another mode
+static void byte_map_convert(ByteMap *m, int new_mode)
 {
-	void *ptr;
-	uint16_t metainf;
-} ByteMap;
+	uint8_t keys[256];
+	void *values[256];
+	int n = byte_map_get_tuples(m, keys, values);
+	int mode = m->metainf % 16;
 
-static const int mode_table[] = {0, 0, 5, 11, 23, 59, 256, -1};
+	if (mode >= 2)
+		free(m->ptr);
 
-static void byte_map_init(ByteMap *m)
-{
-	m->ptr = NULL;
-	m->metainf = 0;
+	if (new_mode < 2)
+	{
+		mdsl_assert(n == new_mode, "Assertion failure");
+		byte_map_build(m, keys, values, n);
+	}
+	else
+	{
+		m->ptr = byte_map_storage_new(new_mode, keys, values, n);
+		m->metainf = new_mode | n * 16;
+		if (new_mode == BYTE_MAP_MODE_BITMAP)
+			m->capacity = byte_map_bitmap_capacity(n);
+	}
 }
 
 static void byte_map_set(ByteMap *m, uint8_t key, void *value)
@@ -367,8 +348,6 @@ static void byte_map_set(ByteMap *m, uint8_t key, void *value)
 	int mode = m->metainf % 16;
 	int sec = m->metainf / 16;
 
-	int asize = mode_table[mode];
-
 	if (value)
 	{
 		if (mode == 0)
@@ -385,57 +364,123 @@ static void byte_map_set(ByteMap *m, uint8_t key, void *value)
 			}
 			else
 			{
-				int nasize = mode_table[mode + 1];
-				void *value0 = m->ptr;
-				m->ptr = sized_map_new(nasize);
-				SizedMap *ds = (SizedMap *) m->ptr;
-				sized_map_insert(nasize, ds, sec, value0);
-				sized_map_insert(nasize, ds, key, value);
+				uint8_t keys[2];
+				void *values[2];
+				int first = key < sec ? 1 : 0;
+				keys[first] = sec;
+				values[first] = m->ptr;
+				keys[1 - first] = key;
+				values[1 - first] = value;
+				m->ptr = byte_map_storage_new
+					(BYTE_MAP_MODE_NODE4, keys, values, 2);
+				mode = BYTE_MAP_MODE_NODE4;
 				sec = 2;
-				mode = 2;
 			}
 		}
-		else if (asize == 256)
+		else if (mode == BYTE_MAP_MODE_NODE4 || mode == BYTE_MAP_MODE_NODE16)
 		{
-			void **dit = (void **) m->ptr;
-			if (!dit[key])
+			uint8_t *keys;
+			void **values;
+			int idx;
+			if (mode == BYTE_MAP_MODE_NODE4)
+			{
+				ByteMapNode4 *node = m->ptr;
+				keys = node->keys;
+				values = node->values;
+				idx = byte_map_sorted_find(keys, mode, sec, key);
+			}
+			else
+			{
+				ByteMapNode16 *node = m->ptr;
+				keys = node->keys;
+				values = node->values;
+				idx = byte_map_sorted_find(keys, mode, sec, key);
+			}
+
+			if (idx >= 0)
+			{
+				values[idx] = value;
+			}
+			else if (sec < mode_table[mode])
+			{
+				byte_map_sorted_insert(keys, values, sec, key, value);
 				sec++;
-			dit[key] = value;
+			}
+			else
+			{
+				byte_map_convert(m, mode + 1);
+				byte_map_set(m, key, value);
+				return;
+			}
 		}
-		else
+		else if (mode == BYTE_MAP_MODE_NODE48)
 		{
-			SizedMap *ds = m->ptr;
-			int res = sized_map_insert(asize, ds, key, value);
-			if (res == 1)
+			ByteMapNode48 *node = m->ptr;
+			if (node->index[key])
+			{
+				node->values[node->index[key] - 1] = value;
+			}
+			else if (sec < 48)
 			{
+				int i;
+				for (i = 0; node->values[i]; i++)
+					;
+				node->values[i] = value;
+				node->index[key] = i + 1;
 				sec++;
 			}
-			else if (res == -1)
+			else
 			{
-				int nasize = mode_table[mode + 1];
-				if (nasize == 256)
-				{
-					void **dit = malloc(sizeof(void *) * 256);
-					sized_map_to_dit(asize, ds, dit);
-					free(ds);
-					m->ptr = dit;
-					dit[key] = value;
-				}
-				else
+				byte_map_convert(m, mode + 1);
+				byte_map_set(m, key, value);
+				return;
+			}
+		}
+		else if (mode == BYTE_MAP_MODE_BITMAP)
+		{
+			ByteMapBitmap *node = m->ptr;
+			int idx = byte_map_bitmap_rank(node, key);
+			if (node->bits[key / 64] & (((uint64_t) 1) << (key % 64)))
+			{
+				node->values[idx] = value;
+			}
+			else if (sec < mode_table[mode])
+			{
+				int i;
+				if (sec == m->capacity)
 				{
-					SizedMap *nds = sized_map_new(nasize);
-					sized_map_transfer(asize, ds, nasize, nds);
-					free(ds);
-					m->ptr = nds;
-					sized_map_insert(nasize, nds, key, value);
+					m->capacity += BYTE_MAP_BITMAP_STEP;
+					node = (ByteMapBitmap *) mdsl_realloc
+						(node, byte_map_bitmap_size(m->capacity));
 				}
-				mode++;
+				memmove(node->values + idx + 1, node->values + idx,
+						(sec - idx) * sizeof(void *));
+				node->values[idx] = value;
+				node->bits[key / 64] |= ((uint64_t) 1) << (key % 64);
+				for (i = key / 64 + 1; i < 4; i++)
+					node->before[i]++;
+				m->ptr = node;
 				sec++;
 			}
+			else
+			{
+				byte_map_convert(m, mode + 1);
+				byte_map_set(m, key, value);
+				return;
+			}
+		}
+		else
+		{
+			ByteMapNode256 *node = m->ptr;
+			if (!node->values[key])
+				sec++;
+			node->values[key] = value;
 		}
 	}
 	else
 	{
+		int removed = 0;
+
 		if (mode == 0)
 		{
 			//Nothing to delete?
@@ -449,51 +494,89 @@ static void byte_map_set(ByteMap *m, uint8_t key, void *value)
 				sec = 0;
 			}
 		}
-		else if (asize == 256)
+		else if (mode == BYTE_MAP_MODE_NODE4)
+		{
+			ByteMapNode4 *node = m->ptr;
+			int idx = byte_map_sorted_find(node->keys, mode, sec, key);
+			if (idx >= 0)
+			{
+				byte_map_sorted_remove(node->keys, node->values, sec, idx);
+				removed = 1;
+			}
+		}
+		else if (mode == BYTE_MAP_MODE_NODE16)
 		{
-			void **dit = (void **) m->ptr;
-			if (dit[key])
+			ByteMapNode16 *node = m->ptr;
+			int idx = byte_map_sorted_find(node->keys, mode, sec, key);
+			if (idx >= 0)
 			{
-				int nasize = mode_table[mode - 2];
-				sec--;
-				dit[key] = NULL;
-				if (sec <= nasize)
+				byte_map_sorted_remove(node->keys, node->values, sec, idx);
+				removed = 1;
+			}
+		}
+		else if (mode == BYTE_MAP_MODE_NODE48)
+		{
+			ByteMapNode48 *node = m->ptr;
+			if (node->index[key])
+			{
+				node->values[node->index[key] - 1] = NULL;
+				node->index[key] = 0;
+				removed = 1;
+			}
+		}
+		else if (mode == BYTE_MAP_MODE_BITMAP)
+		{
+			ByteMapBitmap *node = m->ptr;
+			int idx = byte_map_bitmap_find(node, key);
+			if (idx >= 0)
+			{
+				int i;
+				memmove(node->values + idx, node->values + idx + 1,
+						(sec - idx - 1) * sizeof(void *));
+				node->bits[key / 64] &= ~(((uint64_t) 1) << (key % 64));
+				for (i = key / 64 + 1; i < 4; i++)
+					node->before[i]--;
+
+				//Unless the map is about to be converted
+				if (m->capacity - (sec - 1) >= 2 * BYTE_MAP_BITMAP_STEP
+						&& sec - 1 > mode_table[mode - 2])
 				{
-					SizedMap *nds = sized_map_new(nasize);
-					sized_map_from_dit(nasize, nds, dit);
-					free(dit);
-					m->ptr = nds;
-					mode -= 2;
+					m->capacity -= BYTE_MAP_BITMAP_STEP;
+					m->ptr = mdsl_realloc
+						(node, byte_map_bitmap_size(m->capacity));
 				}
+				removed = 1;
 			}
 		}
 		else
 		{
-			SizedMap *ds = m->ptr;
-			int res = sized_map_delete(asize, ds, key);
-			if (res == 1)
+			ByteMapNode256 *node = m->ptr;
+			if (node->values[key])
 			{
-				int nasize = mode_table[mode - 2];
-				sec--;
-				if (sec <= nasize)
-				{
-					if (nasize == 0)
-					{
-						mode = 0;
-						sec = 0;
-						free(ds);
-						m->ptr = NULL;
-					}
-					else
-					{
-						SizedMap *nds = sized_map_new(nasize);
-						sized_map_transfer(asize, ds, nasize, nds);
-						free(ds);
-						m->ptr = nds;
-						mode -= 2;
-					}
-				}
+				node->values[key] = NULL;
+				removed = 1;
+			}
+		}
+
+		if (removed)
+		{
+			sec--;
+			m->metainf = mode | sec * 16;
+
+			//Shrink two modes down, so that a map oscillating around
+			//a boundary does not get converted on every operation.
+			//A bitmap is never bigger than Node48, so Node256 only
+			//goes down to a bitmap.
+			if (mode == BYTE_MAP_MODE_NODE256)
+			{
+				if (sec <= mode_table[mode - 1] - BYTE_MAP_BITMAP_SLACK)
+					byte_map_convert(m, mode - 1);
 			}
+			else if (sec <= mode_table[mode - 2])
+			{
+				byte_map_convert(m, sec == 0 ? 0 : mode - 2);
+			}
+			return;
 		}
 	}
 
@@ -504,7 +587,6 @@ static void *byte_map_get(ByteMap *m, uint8_t key)
 {
 	int mode = m->metainf % 16;
 	int sec = m->metainf / 16;
-	int asize = mode_table[mode];
 
 	if (mode == 0)
 	{
@@ -516,17 +598,99 @@ static void *byte_map_get(ByteMap *m, uint8_t key)
 			return m->ptr;
 		return NULL;
 	}
-	else if (asize == 256)
+	else if (mode == BYTE_MAP_MODE_NODE4)
+	{
+		ByteMapNode4 *node = m->ptr;
+		int idx = byte_map_sorted_find
+			(node->keys, BYTE_MAP_MODE_NODE4, sec, key);
+		return idx >= 0 ? node->values[idx] : NULL;
+	}
+	else if (mode == BYTE_MAP_MODE_NODE16)
 	{
-		void **dit = (void **) m->ptr;
-		return dit[key];
+		ByteMapNode16 *node = m->ptr;
+		int idx = byte_map_sorted_find
+			(node->keys, BYTE_MAP_MODE_NODE16, sec, key);
+		return idx >= 0 ? node->values[idx] : NULL;
+	}
+	else if (mode == BYTE_MAP_MODE_NODE48)
+	{
+		ByteMapNode48 *node = m->ptr;
+		int idx = node->index[key];
+		return idx ? node->values[idx - 1] : NULL;
+	}
+	else if (mode == BYTE_MAP_MODE_BITMAP)
+	{
+		ByteMapBitmap *node = m->ptr;
+		int idx = byte_map_bitmap_find(node, key);
+		return idx >= 0 ? node->values[idx] : NULL;
 	}
 	else
 	{
-		SizedMap *ds = m->ptr;
+		ByteMapNode256 *node = m->ptr;
+		return node->values[key];
+	}
+}
+
+//Returns the memory block owned by the map, or NULL
+static inline void *byte_map_storage(ByteMap *m)
+{
+	return (m->metainf % 16) >= 2 ? m->ptr : NULL;
+}
 
-		return sized_map_get(asize, ds, key);
+static inline int byte_map_get_mode(ByteMap *m)
+{
+	return m->metainf % 16;
+}
+
+//Size of the memory block owned by a map
+static inline size_t byte_map_storage_size(ByteMap *m)
+{
+	int mode = m->metainf % 16;
+
+	if (mode == BYTE_MAP_MODE_NODE4)
+		return sizeof(ByteMapNode4);
+	else if (mode == BYTE_MAP_MODE_NODE16)
+		return sizeof(ByteMapNode16);
+	else if (mode == BYTE_MAP_MODE_NODE48)
+		return sizeof(ByteMapNode48);
+	else if (mode == BYTE_MAP_MODE_BITMAP)
+		return byte_map_bitmap_size(m->capacity);
+	else if (mode == BYTE_MAP_MODE_NODE256)
+		return sizeof(ByteMapNode256);
+	else
+		return 0;
+}
+
+//Makes a copy of the map that does not share memory with the original
+static inline void byte_map_copy(ByteMap *dest, ByteMap *src)
+{
+	size_t size = byte_map_storage_size(src);
+
+	*dest = *src;
+	if (size)
+		dest->ptr = mdsl_memdup(src->ptr, size);
+}
+
+//Prefetches the memory byte_map_get() would touch to look up given key
+static inline void byte_map_prefetch(ByteMap *m, uint8_t key)
+{
+	int mode = m->metainf % 16;
+
+	if (mode == BYTE_MAP_MODE_NODE4)
+	{
+		mdsl_prefetch(m->ptr);
+	}
+	else if (mode == BYTE_MAP_MODE_NODE16)
+	{
+		mdsl_prefetch(m->ptr);
+		mdsl_prefetch(((ByteMapNode16 *) m->ptr)->values + 8);
 	}
+	else if (mode == BYTE_MAP_MODE_NODE48)
+		mdsl_prefetch(((ByteMapNode48 *) m->ptr)->index + key);
+	else if (mode == BYTE_MAP_MODE_BITMAP)
+		mdsl_prefetch(m->ptr);
+	else if (mode == BYTE_MAP_MODE_NODE256)
+		mdsl_prefetch(((ByteMapNode256 *) m->ptr)->values + key);
 }
 
 static void byte_map_clear(ByteMap *m)
@@ -539,7 +703,7 @@ static void byte_map_clear(ByteMap *m)
 	}
 }
 
-static int byte_map_get_size(ByteMap *m)
+static inline int byte_map_get_size(ByteMap *m)
 {
 	int mode = m->metainf % 16;
 	int sec = m->metainf / 16;
@@ -549,11 +713,12 @@ static int byte_map_get_size(ByteMap *m)
 		return mode;
 }
 
+//Fetches all key-value pairs, sorted by key.
 static int byte_map_get_tuples(ByteMap *m, uint8_t *keys, void **values)
 {
 	int mode = m->metainf % 16;
 	int sec = m->metainf / 16;
-	int asize = mode_table[mode];
+	int i, j;
 
 	if (mode == 0)
 	{
@@ -565,17 +730,38 @@ static int byte_map_get_tuples(ByteMap *m, uint8_t *keys, void **values)
 		values[0] = m->ptr;
 		return 1;
 	}
-	else if (asize == 256)
+	else if (mode == BYTE_MAP_MODE_NODE4 || mode == BYTE_MAP_MODE_NODE16)
+	{
+		const uint8_t *nkeys;
+		void **nvalues;
+		if (mode == BYTE_MAP_MODE_NODE4)
+		{
+			nkeys = ((ByteMapNode4 *) m->ptr)->keys;
+			nvalues = ((ByteMapNode4 *) m->ptr)->values;
+		}
+		else
+		{
+			nkeys = ((ByteMapNode16 *) m->ptr)->keys;
+			nvalues = ((ByteMapNode16 *) m->ptr)->values;
+		}
+		for (i = 0; i < sec; i++)
+		{
+			keys[i] = nkeys[i];
+			values[i] = nvalues[i];
+		}
+		return sec;
+	}
+	else if (mode == BYTE_MAP_MODE_NODE48)
 	{
-		void **dit = (void **) m->ptr;
-		int i, j;
+		ByteMapNode48 *node = m->ptr;
 		j = 0;
 		for (i = 0; i < 256; i++)
 		{
-			if (dit[i])
+			if (node->index[i])
 			{
 				keys[j] = i;
-				values[j] = dit[i];
+				values[j] = node->values[node->index[i] - 1];
+				j++;
 			}
 		}
 
@@ -583,9 +769,115 @@ static int byte_map_get_tuples(ByteMap *m, uint8_t *keys, void **values)
 
 		return j;
 	}
+	else if (mode == BYTE_MAP_MODE_BITMAP)
+	{
+		ByteMapBitmap *node = m->ptr;
+		j = 0;
+		for (i = byte_map_bitmap_next(node, 0); i >= 0; 
+				i = byte_map_bitmap_next(node, i + 1))
+		{
+			keys[j] = i;
+			values[j] = node->values[j];
+			j++;
+		}
+
+		mdsl_assert(j == sec, "Assertion failure");
+
+		return j;
+	}
+	else
+	{
+		ByteMapNode256 *node = m->ptr;
+		j = 0;
+		for (i = 0; i < 256; i++)
+		{
+			if (node->values[i])
+			{
+				keys[j] = i;
+				values[j] = node->values[i];
+				j++;
+			}
+		}
+
+		mdsl_assert(j == sec, "Assertion failure");
+
+		return j;
+	}
+}
+
+//Finds the entry with the smallest key that is not less than from.
+//Returns the value and stores the key in key_return, or returns NULL
+//if there is no such entry. from can be 256 to indicate the end.
+static void *byte_map_next(ByteMap *m, int from, uint8_t *key_return)
+{
+	int mode = m->metainf % 16;
+	int sec = m->metainf / 16;
+	int i;
+
+	if (mode == 0)
+	{
+		return NULL;
+	}
+	else if (mode == 1)
+	{
+		if (sec < from)
+			return NULL;
+		*key_return = sec;
+		return m->ptr;
+	}
+	else if (mode == BYTE_MAP_MODE_NODE4 || mode == BYTE_MAP_MODE_NODE16)
+	{
+		const uint8_t *keys;
+		void **values;
+		if (mode == BYTE_MAP_MODE_NODE4)
+		{
+			keys = ((ByteMapNode4 *) m->ptr)->keys;
+			values = ((ByteMapNode4 *) m->ptr)->values;
+		}
+		else
+		{
+			keys = ((ByteMapNode16 *) m->ptr)->keys;
+			values = ((ByteMapNode16 *) m->ptr)->values;
+		}
+		i = byte_map_sorted_lower_bound(keys, mode, sec, from);
+		if (i == sec)
+			return NULL;
+		*key_return = keys[i];
+		return values[i];
+	}
+	else if (mode == BYTE_MAP_MODE_NODE48)
+	{
+		ByteMapNode48 *node = m->ptr;
+		for (i = from; i < 256; i++)
+		{
+			if (node->index[i])
+			{
+				*key_return = i;
+				return node->values[node->index[i] - 1];
+			}
+		}
+		return NULL;
+	}
+	else if (mode == BYTE_MAP_MODE_BITMAP)
+	{
+		ByteMapBitmap *node = m->ptr;
+		i = byte_map_bitmap_next(node, from);
+		if (i < 0)
+			return NULL;
+		*key_return = i;
+		return node->values[byte_map_bitmap_rank(node, i)];
+	}
 	else
 	{
-		SizedMap *ds = m->ptr;
-		return sized_map_get_tuples(asize, ds, keys, values);
+		ByteMapNode256 *node = m->ptr;
+		for (i = from; i < 256; i++)
+		{
+			if (node->values[i])
+			{
+				*key_return = i;
+				return node->values[i];
+			}
+		}
+		return NULL;
 	}
 }
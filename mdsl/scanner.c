@@ -0,0 +1,303 @@
+/* scanner.c
+ * Multi-pattern scanner for keys of a dictionary
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+//States are numbered in breadth first order, so the children of a state 
+//are consecutive states, found by searching the bytes leading to them in
+//chrs. A state in a run of the radix tree has one child, whose byte is
+//kept in the state itself. States below n_dense have a row in dense 
+//instead, in which failure links are already followed.
+//Only what the scanning loop needs is kept in states. Keys found at a 
+//state are a chain in keys, starting at report.
+#define SCAN_NONE UINT32_MAX
+
+typedef struct
+{
+	uint32_t fail;
+	uint32_t report;
+	uint32_t first_child;
+	uint16_t n_children;
+	uint8_t first_chr;
+} ScanState;
+
+typedef struct
+{
+	void *value;
+	uint64_t u64;
+	uint32_t len;
+	//Next shorter key that is a suffix of this one
+	uint32_t next;
+} ScanKey;
+
+struct _MdslDictScanner
+{
+	MdslRC parent;
+	uint32_t n_states, n_dense;
+	ScanState *states;
+	uint8_t *chrs;
+	uint32_t *dense;
+	ScanKey *keys;
+};
+
+mdsl_rc_define(MdslDictScanner, mdsl_dict_scanner);
+
+//Sparse states mostly have one or a few children, for which a plain loop
+//beats a call to memchr()
+static inline uint32_t scanner_step
+	(MdslDictScanner *scanner, uint32_t state, uint8_t chr)
+{
+	while (state >= scanner->n_dense)
+	{
+		ScanState *s = scanner->states + state;
+		uint32_t i, n = s->n_children;
+
+		if (n == 1)
+		{
+			if (s->first_chr == chr)
+				return s->first_child;
+		}
+		else if (n > 16)
+		{
+			const uint8_t *child = (const uint8_t *) memchr
+				(scanner->chrs + s->first_child, chr, n);
+			if (child)
+				return child - scanner->chrs;
+		}
+		else
+		{
+			const uint8_t *chrs = scanner->chrs + s->first_child;
+			for (i = 0; i < n; i++)
+			{
+				if (chrs[i] == chr)
+					return s->first_child + i;
+			}
+		}
+		state = s->fail;
+	}
+	return scanner->dense[((size_t) state << 8) | chr];
+}
+
+//Trie of the keys as they arrive in order. A new child always comes after
+//the existing children of its parent, so they form a list in order.
+typedef struct
+{
+	uint32_t first_child, last_child, next_sibling;
+	uint32_t key;
+	uint8_t chr;
+} ScanTrieNode;
+
+mdsl_declare_array(ScanTrieNode, ScanTrieNodeArray, scan_trie_node_array);
+mdsl_declare_array(ScanKey, ScanKeyArray, scan_key_array);
+mdsl_declare_array(uint32_t, ScanIdArray, scan_id_array);
+
+static uint32_t scan_trie_add
+	(ScanTrieNodeArray *trie, uint32_t parent, uint8_t chr)
+{
+	size_t n = scan_trie_node_array_size(trie);
+	ScanTrieNode node = {SCAN_NONE, SCAN_NONE, SCAN_NONE, SCAN_NONE, chr};
+
+	mdsl_assert(n < SCAN_NONE, "Too many states");
+	scan_trie_node_array_append(trie, node);
+	if (trie->data[parent].last_child == SCAN_NONE)
+		trie->data[parent].first_child = n;
+	else
+		trie->data[trie->data[parent].last_child].next_sibling = n;
+	trie->data[parent].last_child = n;
+
+	return n;
+}
+
+MdslDictScanner *mdsl_dict_scanner_new(MdslDict *dict, size_t n_dense)
+{
+	MdslDictScanner *scanner;
+	ScanTrieNodeArray trie;
+	ScanKeyArray keys;
+	ScanIdArray path, order;
+	MdslRBuf prev;
+	MdslDictIter iter[1];
+	uint32_t n_states, i, j;
+	int c;
+
+	scan_trie_node_array_init(&trie);
+	scan_key_array_init(&keys);
+	scan_id_array_init(&path);
+	scan_id_array_init(&order);
+	mdsl_rbuf_init(&prev);
+
+	//Trie of all non-empty keys. path holds the nodes for the prefixes of
+	//the previous key.
+	ScanTrieNode root = {SCAN_NONE, SCAN_NONE, SCAN_NONE, SCAN_NONE, 0};
+	scan_trie_node_array_append(&trie, root);
+	scan_id_array_append(&path, 0);
+	mdsl_dict_read_begin(dict);
+	mdsl_dict_iter_init(iter, dict);
+	while (mdsl_dict_iter_next(iter))
+	{
+		const uint8_t *key = (const uint8_t *) iter->key;
+		size_t l = 0;
+
+		if (iter->key_len == 0)
+			continue;
+		while (l < prev.len && key[l] == (uint8_t) prev.data[l])
+			l++;
+		scan_id_array_resize(&path, l + 1);
+		for (; l < iter->key_len; l++)
+			scan_id_array_append(&path, 
+					scan_trie_add(&trie, path.data[l], key[l]));
+
+		ScanKey k = {iter->value, iter->u64, iter->key_len, SCAN_NONE};
+		trie.data[path.data[l]].key = scan_key_array_size(&keys);
+		scan_key_array_append(&keys, k);
+
+		mdsl_rbuf_resize(&prev, iter->key_len);
+		memcpy(prev.data, key, iter->key_len);
+	}
+	mdsl_dict_iter_destroy(iter);
+	mdsl_dict_read_end(dict);
+
+	n_states = scan_trie_node_array_size(&trie);
+	if (n_dense < 1)
+		n_dense = 1;
+	if (n_dense > n_states)
+		n_dense = n_states;
+
+	scanner = (MdslDictScanner *) mdsl_alloc(sizeof(MdslDictScanner));
+	mdsl_rc_init(scanner);
+	scanner->n_states = n_states;
+	scanner->n_dense = n_dense;
+	scanner->states = (ScanState *) mdsl_alloc(sizeof(ScanState) * n_states);
+	scanner->chrs = (uint8_t *) mdsl_alloc(n_states);
+	scanner->dense = (uint32_t *) mdsl_alloc
+		(sizeof(uint32_t) * 256 * n_dense);
+	scanner->keys = keys.data;
+
+	//Number states in breadth first order. The children of each state are
+	//numbered when it is reached, so that they get consecutive numbers.
+	scan_id_array_append(&order, 0);
+	scanner->chrs[0] = 0;
+	for (i = 0; i < n_states; i++)
+	{
+		ScanTrieNode *node = trie.data + order.data[i];
+		ScanState *s = scanner->states + i;
+		uint32_t child;
+
+		s->first_child = scan_id_array_size(&order);
+		s->n_children = 0;
+		for (child = node->first_child; child != SCAN_NONE; 
+				child = trie.data[child].next_sibling)
+		{
+			uint32_t id = scan_id_array_size(&order);
+			scan_id_array_append(&order, child);
+			scanner->chrs[id] = trie.data[child].chr;
+			s->n_children++;
+		}
+		s->first_chr = s->n_children ? scanner->chrs[s->first_child] : 0;
+	}
+
+	//Failure links of children follow from the failure link of the parent.
+	//Everything they depend on is shallower, so it is complete by the time
+	//the parent is reached in breadth first order.
+	scanner->states[0].fail = 0;
+	scanner->states[0].report = SCAN_NONE;
+	for (i = 0; i < n_states; i++)
+	{
+		ScanState *s = scanner->states + i;
+
+		for (j = 0; j < s->n_children; j++)
+		{
+			uint32_t id = s->first_child + j;
+			uint32_t key = trie.data[order.data[id]].key;
+			ScanState *child = scanner->states + id;
+			child->fail = i == 0 
+				? 0 : scanner_step(scanner, s->fail, scanner->chrs[id]);
+			child->report = scanner->states[child->fail].report;
+			if (key != SCAN_NONE)
+			{
+				scanner->keys[key].next = child->report;
+				child->report = key;
+			}
+		}
+
+		if (i < n_dense)
+		{
+			uint32_t *row = scanner->dense + ((size_t) i << 8);
+			for (c = 0; c < 256; c++)
+				row[c] = i == 0 ? 0 : scanner_step(scanner, s->fail, c);
+			for (j = 0; j < s->n_children; j++)
+				row[scanner->chrs[s->first_child + j]] = s->first_child + j;
+		}
+	}
+
+	free(trie.data);
+	free(path.data);
+	free(order.data);
+	free(prev.data);
+
+	return scanner;
+}
+
+static void mdsl_dict_scanner_destroy(MdslDictScanner *scanner)
+{
+	free(scanner->states);
+	free(scanner->chrs);
+	free(scanner->dense);
+	free(scanner->keys);
+	free(scanner);
+}
+
+size_t mdsl_dict_scanner_scan(MdslDictScanner *scanner, const void *buf, 
+		size_t len, MdslDictScanFunc func, void *user_data)
+{
+	const uint8_t *data = (const uint8_t *) buf;
+	uint32_t state = 0;
+	size_t i, n_matches = 0;
+	MdslDictMatch match;
+
+	for (i = 0; i < len; i++)
+	{
+		state = scanner_step(scanner, state, data[i]);
+
+		//Keys ending here, longest first
+		uint32_t r = scanner->states[state].report;
+		while (r != SCAN_NONE)
+		{
+			ScanKey *key = scanner->keys + r;
+			n_matches++;
+			if (func)
+			{
+				match.offset = i + 1 - key->len;
+				match.len = key->len;
+				match.value = key->value;
+				match.u64 = key->u64;
+				if (! func(user_data, &match))
+					return n_matches;
+			}
+			r = key->next;
+		}
+	}
+
+	return n_matches;
+}
+
+size_t mdsl_dict_scanner_get_n_states(MdslDictScanner *scanner)
+{
+	return scanner->n_states;
+}
@@ -0,0 +1,94 @@
+/* scanner.h
+ * Multi-pattern scanner for keys of a dictionary
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+typedef struct _MdslDictScanner MdslDictScanner;
+
+/**
+ * Occurrence of a key in the scanned buffer
+ */
+typedef struct
+{
+	/**Offset of the key in the buffer*/
+	size_t offset;
+	/**Length of the key*/
+	size_t len;
+	/**Value of the key when the scanner was built*/
+	void *value;
+	/**Value for dictionaries created with MDSL_DICT_U64*/
+	uint64_t u64;
+} MdslDictMatch;
+
+/**
+ * Receives matches from mdsl_dict_scanner_scan().
+ *
+ * \param user_data User data passed to mdsl_dict_scanner_scan()
+ * \param match The match, valid only during the call
+ * \return 1 to continue scanning, 0 to stop.
+ */
+typedef int (*MdslDictScanFunc)(void *user_data, const MdslDictMatch *match);
+
+/**
+ * Compiles the keys of a dictionary into an Aho-Corasick automaton, which
+ * finds all occurrences of all keys in a buffer in one pass, in time 
+ * linear in the length of the buffer plus the number of matches.
+ * States are the prefixes of keys. A state has a failure link to the
+ * longest proper suffix of its prefix that is also a state, followed when
+ * the next byte has no transition. Runs of the radix tree become chains of
+ * states with a single child, which are stored without any transition 
+ * table. The shallowest n_dense states, where scanning spends most of its
+ * time in typical text, get a full table of 256 transitions with failure
+ * links already followed, costing 1 KiB each.
+ *
+ * The scanner is a copy and does not change with the dictionary. It can be
+ * used from any number of threads at once. The empty key is never matched.
+ *
+ * \param dict The dictionary, which may be in concurrent mode and be 
+ *             modified meanwhile
+ * \param n_dense Number of states with full transition tables, the root 
+ *                always has one
+ * \return A new scanner
+ */
+MdslDictScanner *mdsl_dict_scanner_new(MdslDict *dict, size_t n_dense);
+
+/**
+ * Reports all occurrences of keys in the buffer, including overlapping 
+ * ones. Matches are reported in order of their end. Matches that end at
+ * the same byte are reported longest first.
+ *
+ * \param scanner The scanner
+ * \param buf The buffer to scan
+ * \param len Length of the buffer
+ * \param func Function called for every match, can be NULL to only 
+ *             count matches
+ * \param user_data User data for func
+ * \return Number of matches reported
+ */
+size_t mdsl_dict_scanner_scan(MdslDictScanner *scanner, const void *buf, 
+		size_t len, MdslDictScanFunc func, void *user_data);
+
+/**
+ * Returns the number of states of the automaton.
+ *
+ * \param scanner The scanner
+ * \return Number of states, including the root
+ */
+size_t mdsl_dict_scanner_get_n_states(MdslDictScanner *scanner);
+
+mdsl_rc_declare(MdslDictScanner, mdsl_dict_scanner);
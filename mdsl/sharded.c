@@ -0,0 +1,342 @@
+/* sharded.c
+ * Dictionary partitioned into independently locked shards
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#include <pthread.h>
+
+//Shards are padded, and the array of them aligned to SHARD_SIZE, so that
+//locks of different shards never share a cache line
+#define SHARD_SIZE 128
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	MdslDict *dict;
+	char pad[SHARD_SIZE - sizeof(pthread_mutex_t) - sizeof(MdslDict *)];
+} ShardedDictShard;
+
+struct _MdslShardedDict
+{
+	MdslRC parent;
+	MdslShardMode mode;
+	MdslDictFlags flags;
+	int n_shards;
+	ShardedDictShard *shards;
+};
+
+mdsl_rc_define(MdslShardedDict, mdsl_sharded_dict);
+
+static inline ShardedDictShard *sharded_dict_find
+	(MdslShardedDict *sdict, const void *key, size_t key_len)
+{
+	const uint8_t *ekey = (const uint8_t *) key;
+	size_t i;
+
+	if (sdict->mode == MDSL_SHARD_BY_FIRST_BYTE)
+	{
+		int idx = key_len ? (ekey[0] * sdict->n_shards) / 256 : 0;
+		return sdict->shards + idx;
+	}
+
+	//FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (i = 0; i < key_len; i++)
+	{
+		hash ^= ekey[i];
+		hash *= 1099511628211ULL;
+	}
+	hash ^= hash >> 32;
+	return sdict->shards + (hash % sdict->n_shards);
+}
+
+//Shards in concurrent mode have their own writer lock
+static inline int sharded_dict_needs_lock(MdslShardedDict *sdict)
+{
+	return ! (sdict->flags & MDSL_DICT_CONCURRENT);
+}
+
+void *mdsl_sharded_dict_set(MdslShardedDict *sdict,
+		const void *key, size_t key_len, const void *value)
+{
+	ShardedDictShard *shard = sharded_dict_find(sdict, key, key_len);
+	void *res;
+
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_lock(&(shard->lock));
+	res = mdsl_dict_set(shard->dict, key, key_len, value);
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_unlock(&(shard->lock));
+
+	return res;
+}
+
+void *mdsl_sharded_dict_get
+	(MdslShardedDict *sdict, const void *key, size_t key_len)
+{
+	ShardedDictShard *shard = sharded_dict_find(sdict, key, key_len);
+	void *res;
+
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_lock(&(shard->lock));
+	res = mdsl_dict_get(shard->dict, key, key_len);
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_unlock(&(shard->lock));
+
+	return res;
+}
+
+uint64_t mdsl_sharded_dict_u64_add(MdslShardedDict *sdict,
+		const void *key, size_t key_len, uint64_t delta)
+{
+	ShardedDictShard *shard = sharded_dict_find(sdict, key, key_len);
+	uint64_t res;
+
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_lock(&(shard->lock));
+	res = mdsl_dict_u64_add(shard->dict, key, key_len, delta);
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_unlock(&(shard->lock));
+
+	return res;
+}
+
+int mdsl_sharded_dict_u64_get(MdslShardedDict *sdict,
+		const void *key, size_t key_len, uint64_t *value_return)
+{
+	ShardedDictShard *shard = sharded_dict_find(sdict, key, key_len);
+	int res;
+
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_lock(&(shard->lock));
+	res = mdsl_dict_u64_get(shard->dict, key, key_len, value_return);
+	if (sharded_dict_needs_lock(sdict))
+		pthread_mutex_unlock(&(shard->lock));
+
+	return res;
+}
+
+size_t mdsl_sharded_dict_get_n_keys(MdslShardedDict *sdict)
+{
+	MdslDictStats stats[1];
+	size_t res = 0;
+	int i;
+
+	for (i = 0; i < sdict->n_shards; i++)
+	{
+		ShardedDictShard *shard = sdict->shards + i;
+		if (sharded_dict_needs_lock(sdict))
+			pthread_mutex_lock(&(shard->lock));
+		mdsl_dict_get_stats(shard->dict, stats, 0);
+		if (sharded_dict_needs_lock(sdict))
+			pthread_mutex_unlock(&(shard->lock));
+		res += stats->n_keys;
+	}
+
+	return res;
+}
+
+void *mdsl_sharded_dict_set_str
+	(MdslShardedDict *sdict, const char *str, const void *value)
+{
+	return mdsl_sharded_dict_set(sdict, str, strlen(str), value);
+}
+
+void *mdsl_sharded_dict_get_str
+	(MdslShardedDict *sdict, const char *str)
+{
+	return mdsl_sharded_dict_get(sdict, str, strlen(str));
+}
+
+static void mdsl_sharded_dict_destroy(MdslShardedDict *sdict)
+{
+	int i;
+
+	for (i = 0; i < sdict->n_shards; i++)
+	{
+		pthread_mutex_destroy(&(sdict->shards[i].lock));
+		mdsl_dict_unref(sdict->shards[i].dict);
+	}
+
+	free(sdict->shards);
+	free(sdict);
+}
+
+MdslShardedDict *mdsl_sharded_dict_new
+	(int n_shards, MdslShardMode mode, MdslDictFlags flags)
+{
+	size_t shards_size = sizeof(ShardedDictShard) * n_shards;
+	void *shards = NULL;
+	int i;
+
+	mdsl_assert(n_shards > 0, "Number of shards must be positive");
+	mdsl_assert(mode != MDSL_SHARD_BY_FIRST_BYTE || n_shards <= 256,
+			"At most 256 shards can be used with MDSL_SHARD_BY_FIRST_BYTE");
+
+	MdslShardedDict *sdict = mdsl_new(MdslShardedDict);
+
+	mdsl_rc_init(sdict);
+
+	sdict->mode = mode;
+	sdict->flags = flags;
+	sdict->n_shards = n_shards;
+	if (posix_memalign(&shards, SHARD_SIZE, shards_size) != 0)
+		mdsl_error("Cannot allocate memory of %d bytes", (int) shards_size);
+	sdict->shards = (ShardedDictShard *) shards;
+	for (i = 0; i < n_shards; i++)
+	{
+		if (pthread_mutex_init(&(sdict->shards[i].lock), NULL) != 0)
+			mdsl_error("pthread_mutex_init() failed");
+		sdict->shards[i].dict = mdsl_dict_new_with_flags(flags);
+	}
+
+	return sdict;
+}
+
+//Ordered iteration.
+//Iterators of the shards are kept in a binary heap ordered by their
+//current keys, the smallest one is on top.
+static int sharded_dict_iter_less(MdslShardedDictIter *iter, int a, int b)
+{
+	MdslDictIter *ia = iter->iters + a, *ib = iter->iters + b;
+	size_t len = ia->key_len < ib->key_len ? ia->key_len : ib->key_len;
+	int cmp = memcmp(ia->key, ib->key, len);
+	if (cmp != 0)
+		return cmp < 0;
+	return ia->key_len < ib->key_len;
+}
+
+static void sharded_dict_iter_sift_down(MdslShardedDictIter *iter, int pos)
+{
+	int *heap = iter->heap;
+	while (1)
+	{
+		int min = pos;
+		int l = 2 * pos + 1, r = 2 * pos + 2;
+		if (l < iter->heap_len 
+				&& sharded_dict_iter_less(iter, heap[l], heap[min]))
+			min = l;
+		if (r < iter->heap_len 
+				&& sharded_dict_iter_less(iter, heap[r], heap[min]))
+			min = r;
+		if (min == pos)
+			break;
+		int tmp = heap[pos];
+		heap[pos] = heap[min];
+		heap[min] = tmp;
+		pos = min;
+	}
+}
+
+void mdsl_sharded_dict_iter_init
+	(MdslShardedDictIter *iter, MdslShardedDict *sdict)
+{
+	int i, n_shards = sdict->n_shards;
+
+	mdsl_sharded_dict_ref(sdict);
+	iter->sdict = sdict;
+	iter->key = NULL;
+	iter->key_len = 0;
+	iter->value = NULL;
+	iter->u64 = 0;
+	iter->views = (MdslDict **) mdsl_alloc(sizeof(MdslDict *) * n_shards);
+	iter->iters = (MdslDictIter *) mdsl_alloc
+		(sizeof(MdslDictIter) * n_shards);
+	iter->heap = (int *) mdsl_alloc(sizeof(int) * n_shards);
+	iter->heap_len = 0;
+	iter->started = 0;
+
+	for (i = 0; i < n_shards; i++)
+	{
+		ShardedDictShard *shard = sdict->shards + i;
+		if (sharded_dict_needs_lock(sdict))
+		{
+			pthread_mutex_lock(&(shard->lock));
+			iter->views[i] = mdsl_dict_snapshot(shard->dict);
+			pthread_mutex_unlock(&(shard->lock));
+		}
+		else
+		{
+			iter->views[i] = shard->dict;
+			mdsl_dict_ref(shard->dict);
+			mdsl_dict_read_begin(shard->dict);
+		}
+		mdsl_dict_iter_init(iter->iters + i, iter->views[i]);
+	}
+}
+
+int mdsl_sharded_dict_iter_next(MdslShardedDictIter *iter)
+{
+	int i;
+
+	if (! iter->started)
+	{
+		iter->started = 1;
+		for (i = 0; i < iter->sdict->n_shards; i++)
+		{
+			if (mdsl_dict_iter_next(iter->iters + i))
+				iter->heap[iter->heap_len++] = i;
+		}
+		for (i = iter->heap_len / 2 - 1; i >= 0; i--)
+			sharded_dict_iter_sift_down(iter, i);
+	}
+	else if (iter->heap_len > 0)
+	{
+		//Advance the shard the last key came from
+		if (! mdsl_dict_iter_next(iter->iters + iter->heap[0]))
+			iter->heap[0] = iter->heap[--iter->heap_len];
+		sharded_dict_iter_sift_down(iter, 0);
+	}
+
+	if (iter->heap_len == 0)
+	{
+		iter->key = NULL;
+		iter->key_len = 0;
+		iter->value = NULL;
+		iter->u64 = 0;
+		return 0;
+	}
+
+	MdslDictIter *top = iter->iters + iter->heap[0];
+	iter->key = top->key;
+	iter->key_len = top->key_len;
+	iter->value = top->value;
+	iter->u64 = top->u64;
+	return 1;
+}
+
+void mdsl_sharded_dict_iter_destroy(MdslShardedDictIter *iter)
+{
+	MdslShardedDict *sdict = iter->sdict;
+	int i;
+
+	for (i = 0; i < sdict->n_shards; i++)
+	{
+		mdsl_dict_iter_destroy(iter->iters + i);
+		if (! sharded_dict_needs_lock(sdict))
+			mdsl_dict_read_end(iter->views[i]);
+		mdsl_dict_unref(iter->views[i]);
+	}
+
+	free(iter->views);
+	free(iter->iters);
+	free(iter->heap);
+	mdsl_sharded_dict_unref(sdict);
+}
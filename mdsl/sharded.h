@@ -0,0 +1,148 @@
+/* sharded.h
+ * Dictionary partitioned into independently locked shards
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+typedef struct _MdslShardedDict MdslShardedDict;
+
+/**
+ * How keys are assigned to shards
+ */
+typedef enum
+{
+	/**Hash of the whole key, spreads any set of keys evenly*/
+	MDSL_SHARD_BY_HASH,
+	/**
+	 * Ranges of the first byte of the key. Keeps keys with the same first
+	 * byte together, but works well only if first bytes are spread out.
+	 */
+	MDSL_SHARD_BY_FIRST_BYTE
+} MdslShardMode;
+
+/**
+ * Creates a dictionary that can be modified by any number of threads at
+ * the same time. Keys are partitioned across n_shards independent
+ * dictionaries, so that writers only contend when they hit the same
+ * shard. Shards are protected by a mutex each, or, if flags include
+ * MDSL_DICT_CONCURRENT, by their own writer lock, in which case readers
+ * take no locks.
+ *
+ * \param n_shards Number of shards, at most 256 for
+ *                 MDSL_SHARD_BY_FIRST_BYTE
+ * \param mode How keys are assigned to shards
+ * \param flags Flags for the dictionaries of the shards
+ * \return A new sharded dictionary
+ */
+MdslShardedDict *mdsl_sharded_dict_new
+	(int n_shards, MdslShardMode mode, MdslDictFlags flags);
+
+/**
+ * Same as mdsl_dict_set(), can be called from any thread.
+ */
+void *mdsl_sharded_dict_set(MdslShardedDict *sdict,
+		const void *key, size_t key_len, const void *value);
+
+/**
+ * Same as mdsl_dict_get(), can be called from any thread.
+ */
+void *mdsl_sharded_dict_get
+	(MdslShardedDict *sdict, const void *key, size_t key_len);
+
+/**
+ * Same as mdsl_dict_u64_add(), can be called from any thread.
+ * The shards must have been created with MDSL_DICT_U64.
+ */
+uint64_t mdsl_sharded_dict_u64_add(MdslShardedDict *sdict,
+		const void *key, size_t key_len, uint64_t delta);
+
+/**
+ * Same as mdsl_dict_u64_get(), can be called from any thread.
+ */
+int mdsl_sharded_dict_u64_get(MdslShardedDict *sdict,
+		const void *key, size_t key_len, uint64_t *value_return);
+
+/**
+ * Returns the number of keys in all shards.
+ *
+ * \param sdict The sharded dictionary
+ * \return Number of keys
+ */
+size_t mdsl_sharded_dict_get_n_keys(MdslShardedDict *sdict);
+
+void *mdsl_sharded_dict_set_str
+	(MdslShardedDict *sdict, const char *str, const void *value);
+
+void *mdsl_sharded_dict_get_str
+	(MdslShardedDict *sdict, const char *str);
+
+mdsl_rc_declare(MdslShardedDict, mdsl_sharded_dict);
+
+//Ordered iteration
+typedef struct
+{
+	MdslShardedDict *sdict;
+	const void *key;
+	size_t key_len;
+	void *value;
+	/**Value for shards created with MDSL_DICT_U64*/
+	uint64_t u64;
+
+	//Private
+	MdslDict **views;
+	MdslDictIter *iters;
+	int *heap;
+	int heap_len;
+	int started;
+} MdslShardedDictIter;
+
+/**
+ * Initializes an iterator over all keys of all shards in sorted order,
+ * merged from the iterators of the shards. Each shard is seen as it was
+ * when the iterator was initialized: shards are snapshotted, or, if they
+ * are in MDSL_DICT_CONCURRENT mode, read within a read-side critical
+ * section. Writers are not blocked meanwhile.
+ *
+ * With MDSL_DICT_CONCURRENT the critical section lasts until 
+ * mdsl_sharded_dict_iter_destroy(). Critical sections belong to the 
+ * calling thread, so the iterator must be destroyed by the thread that 
+ * initialized it. While the iterator lives, memory retired by any 
+ * dictionary in MDSL_DICT_CONCURRENT mode, not only by these shards, 
+ * cannot be freed, so iterators should not be kept around.
+ *
+ * \param iter An uninitialized iterator
+ * \param sdict The sharded dictionary
+ */
+void mdsl_sharded_dict_iter_init
+	(MdslShardedDictIter *iter, MdslShardedDict *sdict);
+
+/**
+ * Advances the iterator to the next key.
+ * On success iter->key, iter->key_len and iter->value describe the
+ * key-value pair. iter->key is valid till the next call.
+ *
+ * \param iter An initialized iterator
+ * \return 1 if a key was found, 0 if iteration is finished.
+ */
+int mdsl_sharded_dict_iter_next(MdslShardedDictIter *iter);
+
+/**
+ * Frees memory held by the iterator and releases the shards.
+ *
+ * \param iter An initialized iterator
+ */
+void mdsl_sharded_dict_iter_destroy(MdslShardedDictIter *iter);
@@ -0,0 +1,135 @@
+/* simd.c
+ * Runtime selection of vectorized functions
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "incl.h"
+
+#include "simd.h"
+
+#include <pthread.h>
+
+#if defined(MDSL_HAVE_SSE2) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MDSL_HAVE_AVX2_DISPATCH
+#endif
+
+//Long run comparison
+static size_t mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		if (a[i] != b[i])
+			break;
+	}
+	return i;
+}
+
+#ifdef MDSL_HAVE_SSE2
+static size_t mismatch_sse2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8
+			(_mm_loadu_si128((const __m128i *) (a + i)),
+			 _mm_loadu_si128((const __m128i *) (b + i))));
+		if (mask != 0xffff)
+			return i + __builtin_ctz(~mask);
+	}
+	if (i < len)
+		return len - 16 + mismatch_sse2(a + len - 16, b + len - 16, 16);
+	return len;
+}
+#endif
+
+#ifdef MDSL_HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8
+			(_mm256_loadu_si256((const __m256i *) (a + i)),
+			 _mm256_loadu_si256((const __m256i *) (b + i))));
+		if (mask != 0xffffffff)
+			return i + __builtin_ctz(~mask);
+	}
+	if (i < len)
+	{
+		i = len - 32;
+		mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8
+			(_mm256_loadu_si256((const __m256i *) (a + i)),
+			 _mm256_loadu_si256((const __m256i *) (b + i))));
+		if (mask != 0xffffffff)
+			return i + __builtin_ctz(~mask);
+	}
+	return len;
+}
+#endif
+
+//Picks the best implementation on first call
+static size_t mismatch_resolve(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	MdslMismatchFunc func = mismatch_scalar;
+
+#ifdef MDSL_HAVE_SSE2
+	func = mismatch_sse2;
+#endif
+#ifdef MDSL_HAVE_AVX2_DISPATCH
+	__builtin_cpu_init();
+	//MDSL_NO_AVX2 in the environment selects SSE2, for benchmarking
+	if (__builtin_cpu_supports("avx2") && ! getenv("MDSL_NO_AVX2"))
+		func = mismatch_avx2;
+#endif
+
+	__atomic_store_n(&mdsl_mismatch_long, func, __ATOMIC_RELAXED);
+	return func(a, b, len);
+}
+
+MdslMismatchFunc mdsl_mismatch_long = mismatch_resolve;
+
+//Population count
+#ifdef MDSL_HAVE_POPCNT_DISPATCH
+int mdsl_have_popcnt = 0;
+
+static pthread_once_t popcount_once = PTHREAD_ONCE_INIT;
+
+static void popcount_detect()
+{
+	__builtin_cpu_init();
+	//MDSL_NO_POPCNT in the environment selects the bit parallel count
+	if (__builtin_cpu_supports("popcnt") && ! getenv("MDSL_NO_POPCNT"))
+		__atomic_store_n(&mdsl_have_popcnt, 1, __ATOMIC_RELAXED);
+}
+
+//Runs when the library is loaded, before any bitmap is used
+__attribute__((constructor))
+#endif
+void mdsl_popcount_init()
+{
+#ifdef MDSL_HAVE_POPCNT_DISPATCH
+	pthread_once(&popcount_once, popcount_detect);
+#endif
+}
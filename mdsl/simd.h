@@ -0,0 +1,147 @@
+/* simd.h
+ * Vectorized helpers (library-private)
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define MDSL_HAVE_SSE2
+#endif
+
+//Comparison of byte runs.
+//Runs of at least MDSL_MISMATCH_LONG bytes are compared by an out-of-line 
+//function chosen at runtime according to CPU features (see simd.c).
+#define MDSL_MISMATCH_LONG 64
+
+typedef size_t (*MdslMismatchFunc)
+	(const uint8_t *a, const uint8_t *b, size_t len);
+
+extern MdslMismatchFunc mdsl_mismatch_long;
+
+//Returns index of the first byte that differs between a and b, 
+//or len if the first len bytes are equal. Never reads past len bytes.
+static inline size_t mdsl_mismatch(const void *a_ptr, const void *b_ptr, 
+		size_t len)
+{
+	const uint8_t *a = (const uint8_t *) a_ptr;
+	const uint8_t *b = (const uint8_t *) b_ptr;
+	size_t i = 0;
+
+#ifdef MDSL_HAVE_SSE2
+	//Whole vectors, then one vector overlapping the ones already compared
+	if (len >= 16)
+	{
+		//Replaced by the first call, which may run on another thread
+		if (len >= MDSL_MISMATCH_LONG)
+			return __atomic_load_n(&mdsl_mismatch_long, __ATOMIC_RELAXED)
+				(a, b, len);
+
+		unsigned int mask;
+		for (i = 0; i + 16 <= len; i += 16)
+		{
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi8
+				(_mm_loadu_si128((const __m128i *) (a + i)),
+				 _mm_loadu_si128((const __m128i *) (b + i))));
+			if (mask != 0xffff)
+				return i + __builtin_ctz(~mask);
+		}
+		if (i < len)
+		{
+			i = len - 16;
+			mask = _mm_movemask_epi8(_mm_cmpeq_epi8
+				(_mm_loadu_si128((const __m128i *) (a + i)),
+				 _mm_loadu_si128((const __m128i *) (b + i))));
+			if (mask != 0xffff)
+				return i + __builtin_ctz(~mask);
+		}
+		return len;
+	}
+
+	//Same with words, x86 is little endian
+	if (len >= 8)
+	{
+		uint64_t wa, wb;
+		memcpy(&wa, a, 8);
+		memcpy(&wb, b, 8);
+		if (wa != wb)
+			return __builtin_ctzll(wa ^ wb) / 8;
+		memcpy(&wa, a + len - 8, 8);
+		memcpy(&wb, b + len - 8, 8);
+		if (wa != wb)
+			return len - 8 + __builtin_ctzll(wa ^ wb) / 8;
+		return len;
+	}
+	if (len >= 4)
+	{
+		uint32_t wa, wb;
+		memcpy(&wa, a, 4);
+		memcpy(&wb, b, 4);
+		if (wa != wb)
+			return __builtin_ctz(wa ^ wb) / 8;
+		memcpy(&wa, a + len - 4, 4);
+		memcpy(&wb, b + len - 4, 4);
+		if (wa != wb)
+			return len - 4 + __builtin_ctz(wa ^ wb) / 8;
+		return len;
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (a[i] != b[i])
+			break;
+	}
+	return i;
+}
+
+static inline int mdsl_equal(const void *a, const void *b, size_t len)
+{
+	return mdsl_mismatch(a, b, len) == len;
+}
+
+//Population count. Unless the compiler may use POPCNT anyway, the 
+//instruction is used once mdsl_popcount_init() has found it on the CPU.
+//The check is done once, when the library is loaded.
+#if defined(__GNUC__) && defined(__x86_64__) && ! defined(__POPCNT__)
+#define MDSL_HAVE_POPCNT_DISPATCH
+extern int mdsl_have_popcnt;
+#endif
+
+void mdsl_popcount_init();
+
+//Number of set bits. Without the POPCNT instruction the builtin becomes
+//a library call, the bit parallel version is faster inline.
+static inline int mdsl_popcount64(uint64_t x)
+{
+#if defined(__GNUC__) && defined(__POPCNT__)
+	return __builtin_popcountll(x);
+#else
+#ifdef MDSL_HAVE_POPCNT_DISPATCH
+	if (__atomic_load_n(&mdsl_have_popcnt, __ATOMIC_RELAXED))
+	{
+		uint64_t res;
+		__asm__ ("popcnt %1, %0" : "=r" (res) : "rm" (x) : "cc");
+		return (int) res;
+	}
+#endif
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int) ((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
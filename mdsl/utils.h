@@ -205,7 +205,9 @@ char *mdsl_strdup(const char *str);
  */
 void *mdsl_memdup(const void *mem, size_t len);
 
-//Template code for reference counting
+//Template code for reference counting.
+//The count is updated atomically so that references can be taken and
+//dropped from different threads.
 typedef struct 
 {
 	int refcount;
@@ -222,14 +224,13 @@ typedef struct
 	{ \
 		MdslRC *x = (MdslRC *) object; \
 		 \
-		x->refcount++; \
+		__atomic_add_fetch(&(x->refcount), 1, __ATOMIC_RELAXED); \
 	} \
 	void type_name ## _unref(TypeName *object) \
 	{ \
 		MdslRC *x = (MdslRC *) object; \
 		 \
-		x->refcount--; \
-		if (x->refcount <= 0) \
+		if (__atomic_sub_fetch(&(x->refcount), 1, __ATOMIC_ACQ_REL) <= 0) \
 		{ \
 			type_name ## _destroy(object); \
 		} \
@@ -238,7 +239,7 @@ typedef struct
 	{ \
 		MdslRC *x = (MdslRC *) object; \
 		 \
-		return x->refcount; \
+		return __atomic_load_n(&(x->refcount), __ATOMIC_RELAXED); \
 	} \
 	typedef int MdslRcDefineTemplateEnd ## TypeName;
 
@@ -89,6 +89,90 @@ void test_stack(int msize)
 	free(test_array->data);
 }
 
+mdsl_declare_ring(int, IntRing, int_ring);
+
+//Pushes and pops in bursts of random size, keeping the depth between
+//min_depth and max_depth, against a reference of all pushed values
+void test_ring(int min_depth, int max_depth, int n_ops)
+{
+	IntRing ring[1];
+	int *ref = (int *) mdsl_alloc(sizeof(int) * n_ops * 8);
+	size_t ref_start = 0, ref_end = 0, steady_alloc_len = 0;
+	unsigned int rand_state = 1;
+	int op, i;
+
+	int_ring_init(ring);
+
+	for (op = 0; op < n_ops; op++)
+	{
+		rand_state = rand_state * 1103515245 + 12345;
+		int burst = (rand_state >> 16) % 8;
+		int depth = ref_end - ref_start;
+
+		if (depth + burst <= max_depth && ((op & 1) || depth < min_depth))
+		{
+			for (i = 0; i < burst; i++)
+			{
+				ref[ref_end] = ref_end;
+				int_ring_push(ring, ref[ref_end++]);
+			}
+		}
+		else if (depth - burst >= min_depth)
+		{
+			if (burst == 1)
+			{
+				int val = int_ring_pop(ring);
+				mdsl_assert(val == ref[ref_start], 
+						"Incorrect pop(), got %d instead of %d", 
+						val, ref[ref_start]);
+				ref_start++;
+			}
+			else
+			{
+				int_ring_pop_n(ring, burst);
+				ref_start += burst;
+			}
+		}
+
+		mdsl_assert(int_ring_size(ring) == ref_end - ref_start, 
+				"Size %lu instead of %lu", 
+				(unsigned long) int_ring_size(ring), 
+				(unsigned long) (ref_end - ref_start));
+		if (int_ring_size(ring) > 0)
+		{
+			mdsl_assert(*int_ring_head(ring) == ref[ref_start], 
+					"Incorrect head");
+		}
+		for (i = 0; i < int_ring_size(ring); i++)
+		{
+			mdsl_assert(*int_ring_get(ring, i) == ref[ref_start + i],
+					"Data corruption, i = %d", i);
+		}
+
+		//Once the depth has been reached, the capacity must not change
+		if (op == n_ops / 2)
+			steady_alloc_len = ring->alloc_len;
+		if (op > n_ops / 2 && min_depth > 0)
+		{
+			mdsl_assert(ring->alloc_len == steady_alloc_len, 
+					"Capacity changed in steady state");
+		}
+	}
+
+	//Drain, the capacity goes back to the minimum
+	while (int_ring_size(ring) > 0)
+	{
+		mdsl_assert(int_ring_pop(ring) == ref[ref_start], 
+				"Incorrect pop() while draining");
+		ref_start++;
+	}
+	mdsl_assert(ring->alloc_len == MDSL_RBUF_MIN_LEN, 
+			"Capacity %lu after draining", (unsigned long) ring->alloc_len);
+
+	int_ring_destroy(ring);
+	free(ref);
+}
+
 int main()
 {
 	test_init();
@@ -103,5 +187,10 @@ int main()
 
 	testcase(test_stack(1));
 
+	testcase(test_ring(0, 1, 1000));
+	testcase(test_ring(0, 40, 10000));
+	testcase(test_ring(100, 130, 10000));
+	testcase(test_ring(1000, 3000, 20000));
+
 	return 0;
 }
@@ -0,0 +1,347 @@
+/* bytemap.c
+ * Unit test for maps with small integer keys
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include <mdsl/mdsl.h>
+
+#define testcase(x) \
+	do { \
+		fprintf(stderr, "Test " #x "\n"); \
+		x; \
+	} while (0)
+
+#define MAX_KEYS 5000
+
+//Any of the three maps, selected by key width
+typedef struct
+{
+	int width;
+	MdslByteMap m8;
+	MdslByteMap16 m16;
+	MdslByteMap32 m32;
+} TestMap;
+
+static void test_map_init(TestMap *map, int width)
+{
+	map->width = width;
+	mdsl_byte_map_init(&(map->m8));
+	mdsl_byte_map16_init(&(map->m16));
+	mdsl_byte_map32_init(&(map->m32));
+}
+
+static void test_map_clear(TestMap *map)
+{
+	if (map->width == 8)
+		mdsl_byte_map_clear(&(map->m8));
+	else if (map->width == 16)
+		mdsl_byte_map16_clear(&(map->m16));
+	else
+		mdsl_byte_map32_clear(&(map->m32));
+}
+
+static void *test_map_get(TestMap *map, uint32_t key)
+{
+	if (map->width == 8)
+		return mdsl_byte_map_get(&(map->m8), key);
+	else if (map->width == 16)
+		return mdsl_byte_map16_get(&(map->m16), key);
+	else
+		return mdsl_byte_map32_get(&(map->m32), key);
+}
+
+static void *test_map_set(TestMap *map, uint32_t key, void *value)
+{
+	if (map->width == 8)
+		return mdsl_byte_map_set(&(map->m8), key, value);
+	else if (map->width == 16)
+		return mdsl_byte_map16_set(&(map->m16), key, value);
+	else
+		return mdsl_byte_map32_set(&(map->m32), key, value);
+}
+
+static void *test_map_next(TestMap *map, uint64_t from, uint32_t *key_return)
+{
+	void *res;
+
+	if (map->width == 8)
+	{
+		uint8_t key;
+		res = mdsl_byte_map_next(&(map->m8), from, &key);
+		*key_return = key;
+	}
+	else if (map->width == 16)
+	{
+		uint16_t key;
+		res = mdsl_byte_map16_next(&(map->m16), from, &key);
+		*key_return = key;
+	}
+	else
+	{
+		res = mdsl_byte_map32_next(&(map->m32), from, key_return);
+	}
+
+	return res;
+}
+
+static size_t test_map_get_size(TestMap *map)
+{
+	if (map->width == 8)
+		return mdsl_byte_map_get_size(&(map->m8));
+	else if (map->width == 16)
+		return mdsl_byte_map16_get_size(&(map->m16));
+	else
+		return mdsl_byte_map32_get_size(&(map->m32));
+}
+
+static uint64_t test_rand_state = 88172645463325252ULL;
+
+static uint32_t test_rand()
+{
+	test_rand_state ^= test_rand_state >> 12;
+	test_rand_state ^= test_rand_state << 25;
+	test_rand_state ^= test_rand_state >> 27;
+	return (test_rand_state * 2685821657736338717ULL) >> 32;
+}
+
+static int test_key_cmp(const void *a, const void *b)
+{
+	uint32_t ka = *((const uint32_t *) a);
+	uint32_t kb = *((const uint32_t *) b);
+	return ka < kb ? -1 : ka > kb;
+}
+
+//Checks the map against the reference: keys sorted and distinct,
+//values[i] the value of keys[i] or NULL if absent
+static void test_check(TestMap *map, uint32_t *keys, void **values, int n_keys)
+{
+	size_t n_present = 0;
+	uint64_t from = 0;
+	int i;
+
+	for (i = 0; i < n_keys; i++)
+	{
+		void *value = test_map_get(map, keys[i]);
+		mdsl_assert(value == values[i],
+				"Wrong value for key %u: %p instead of %p",
+				keys[i], value, values[i]);
+		if (values[i])
+			n_present++;
+	}
+
+	mdsl_assert(test_map_get_size(map) == n_present,
+			"Size is %lu instead of %lu",
+			(unsigned long) test_map_get_size(map),
+			(unsigned long) n_present);
+
+	//Walk in key order, also starting from keys that are not present
+	for (i = 0; i < n_keys; i++)
+	{
+		uint32_t key;
+		void *value;
+		int j;
+
+		if (i % 7 == 0)
+			from = keys[i];
+		else if (! values[i])
+			continue;
+
+		value = test_map_next(map, from, &key);
+		for (j = i; j < n_keys && ! values[j]; j++)
+			;
+		if (j == n_keys)
+		{
+			mdsl_assert(value == NULL, "Key %u found past the end", key);
+			continue;
+		}
+		mdsl_assert(value == values[j] && key == keys[j],
+				"Walk from %lu found %u instead of %u",
+				(unsigned long) from, key, keys[j]);
+		from = (uint64_t) key + 1;
+		i = j;
+	}
+}
+
+//Random sets and removals over n_keys keys made by gen_key
+static void test_random(int width, int n_keys, int n_ops,
+		uint32_t (*gen_key)(int i))
+{
+	uint32_t keys[MAX_KEYS];
+	void *values[MAX_KEYS];
+	char targets[MAX_KEYS];
+	TestMap map[1];
+	uint32_t key;
+	int i, n_distinct, op;
+
+	for (i = 0; i < n_keys; i++)
+		keys[i] = gen_key(i);
+	qsort(keys, n_keys, sizeof(uint32_t), test_key_cmp);
+	for (i = 0, n_distinct = 0; i < n_keys; i++)
+	{
+		if (n_distinct == 0 || keys[n_distinct - 1] != keys[i])
+			keys[n_distinct++] = keys[i];
+	}
+	n_keys = n_distinct;
+	for (i = 0; i < n_keys; i++)
+		values[i] = NULL;
+
+	test_map_init(map, width);
+
+	for (op = 0; op < n_ops; op++)
+	{
+		int pos = test_rand() % n_keys;
+		//Fill up during the first half, then mostly remove
+		int fill = op < n_ops / 2 ? 3 : 1;
+		void *value = test_rand() % 4 < fill
+			? targets + (test_rand() % MAX_KEYS) : NULL;
+		void *old = test_map_set(map, keys[pos], value);
+
+		mdsl_assert(old == values[pos],
+				"Set of key %u returned %p instead of %p",
+				keys[pos], old, values[pos]);
+		values[pos] = value;
+
+		if (op % (n_ops / 16 + 1) == 0)
+			test_check(map, keys, values, n_keys);
+	}
+	test_check(map, keys, values, n_keys);
+
+	//Remove everything, the map must become empty
+	for (i = 0; i < n_keys; i++)
+	{
+		test_map_set(map, keys[i], NULL);
+		values[i] = NULL;
+	}
+	test_check(map, keys, values, n_keys);
+	mdsl_assert(test_map_next(map, 0, &key) == NULL, "Key %u left", key);
+
+	//Clear a filled map
+	for (i = 0; i < n_keys; i++)
+	{
+		values[i] = targets + i;
+		test_map_set(map, keys[i], values[i]);
+	}
+	test_check(map, keys, values, n_keys);
+	test_map_clear(map);
+	for (i = 0; i < n_keys; i++)
+		values[i] = NULL;
+	test_check(map, keys, values, n_keys);
+}
+
+static uint32_t gen_all(int i)
+{
+	return i;
+}
+
+static uint32_t gen_random(int i)
+{
+	return test_rand();
+}
+
+//Runs of consecutive ids with gaps, like allocated descriptors
+static uint32_t gen_runs(int i)
+{
+	return (i / 64) * 1000 + i % 64;
+}
+
+//Keys that differ in one byte only, at any position
+static uint32_t gen_bytes(int i)
+{
+	return 0x12345678 ^ ((uint32_t) (test_rand() % 256) << ((i % 4) * 8));
+}
+
+static uint32_t gen_random8(int i)
+{
+	return test_rand() % 256;
+}
+
+static uint32_t gen_random16(int i)
+{
+	return test_rand() % 65536;
+}
+
+//Limits of each key width
+static void test_limits()
+{
+	MdslByteMap m8[1];
+	MdslByteMap16 m16[1];
+	MdslByteMap32 m32[1];
+	int x;
+	uint8_t k8;
+	uint16_t k16;
+	uint32_t k32;
+
+	mdsl_byte_map_init(m8);
+	mdsl_byte_map_set(m8, 255, &x);
+	mdsl_assert(mdsl_byte_map_next(m8, 0, &k8) == &x && k8 == 255, "8");
+	mdsl_assert(mdsl_byte_map_next(m8, 256, &k8) == NULL, "8");
+	mdsl_assert(mdsl_byte_map_next(m8, 1000, &k8) == NULL, "8");
+	//Node48 layout, whose index is looked up by from
+	for (x = 0; x < 40; x++)
+		mdsl_byte_map_set(m8, x * 2, &x);
+	mdsl_assert(mdsl_byte_map_next(m8, -1, &k8) == &x && k8 == 0, "8");
+	mdsl_assert(mdsl_byte_map_next(m8, -1000, &k8) == &x && k8 == 0, "8");
+	mdsl_byte_map_clear(m8);
+
+	mdsl_byte_map16_init(m16);
+	mdsl_byte_map16_set(m16, 65535, &x);
+	mdsl_byte_map16_set(m16, 0, &x);
+	mdsl_assert(mdsl_byte_map16_next(m16, 1, &k16) == &x && k16 == 65535,
+			"16");
+	mdsl_assert(mdsl_byte_map16_next(m16, 65536, &k16) == NULL, "16");
+	mdsl_assert(mdsl_byte_map16_next(m16, 0xffffffff, &k16) == NULL, "16");
+	mdsl_byte_map16_clear(m16);
+
+	mdsl_byte_map32_init(m32);
+	mdsl_byte_map32_set(m32, 0xffffffff, &x);
+	mdsl_byte_map32_set(m32, 0, &x);
+	mdsl_assert(mdsl_byte_map32_next(m32, 1, &k32) == &x
+			&& k32 == 0xffffffff, "32");
+	mdsl_assert(mdsl_byte_map32_next(m32, 0x100000000ULL, &k32) == NULL,
+			"32");
+	mdsl_assert(mdsl_byte_map32_get_size(m32) == 2, "32");
+	mdsl_assert(mdsl_byte_map32_next(m32, ~0ULL, &k32) == NULL, "32");
+	//Keys from 2^31 on
+	mdsl_byte_map32_set(m32, 0x80000000, &x);
+	mdsl_byte_map32_set(m32, 0xfffffffe, &x);
+	mdsl_assert(mdsl_byte_map32_next(m32, 0x7fffffff, &k32) == &x
+			&& k32 == 0x80000000, "32");
+	mdsl_assert(mdsl_byte_map32_next(m32, 0x80000001, &k32) == &x
+			&& k32 == 0xfffffffe, "32");
+	mdsl_assert(mdsl_byte_map32_next(m32, 0xffffffff, &k32) == &x
+			&& k32 == 0xffffffff, "32");
+	mdsl_byte_map32_clear(m32);
+}
+
+int main()
+{
+	testcase(test_limits());
+
+	testcase(test_random(8, 256, 2000, gen_all));
+	testcase(test_random(8, 40, 1000, gen_random8));
+	testcase(test_random(16, 3000, 20000, gen_all));
+	testcase(test_random(16, 3000, 20000, gen_runs));
+	testcase(test_random(16, 2000, 20000, gen_random16));
+	testcase(test_random(32, 5000, 20000, gen_runs));
+	testcase(test_random(32, 2000, 20000, gen_random));
+	testcase(test_random(32, 1000, 10000, gen_bytes));
+
+	return 0;
+}
@@ -24,6 +24,9 @@
 
 #include <stdarg.h>
 
+#include <sys/mman.h>
+#include <pthread.h>
+
 #define run_test(x) \
 	do { \
 		fprintf(stderr, "Running test %s\n", #x); \
@@ -336,21 +339,1810 @@ int test_dict_insert_delete(char** strings, int n_ops)
 }
 
 
-int main()
+static int key_cmp(const void *a, size_t a_len, const void *b, size_t b_len)
 {
+	int res = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	if (res)
+		return res;
+	return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
 
-#if 0
-	run_test(test_permutator(2));
-	run_test(test_permutator(4));
-#endif
+static int str_ptr_cmp(const void *a, const void *b)
+{
+	const char *sa = *((const char **) a);
+	const char *sb = *((const char **) b);
+	return key_cmp(sa, strlen(sa), sb, strlen(sb));
+}
 
-	run_test(test_dict_insert(test_strings_1));
-	run_test(test_dict_insert(test_strings_2));
-	run_test(test_dict_insert(test_strings_3));
-	run_test(test_dict_insert(test_strings_4));
+//Checks that the iterator visits exactly given sorted keys
+static void check_iter
+	(MdslDictIter *iter, char **sorted, int n, const char *prefix)
+{
+	int i, count = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (strncmp(sorted[i], prefix, strlen(prefix)) != 0)
+			continue;
+		if (! mdsl_dict_iter_next(iter))
+			mdsl_error("Iteration ended early (prefix=%s, i=%d)", prefix, i);
+		if (key_cmp(iter->key, iter->key_len, sorted[i], strlen(sorted[i]))
+				|| iter->value != sorted[i])
+		{
+			mdsl_error("Wrong key (prefix=%s, expected=%s, found=%.*s)",
+					prefix, sorted[i], (int) iter->key_len, 
+					(const char *) iter->key);
+		}
+		count++;
+	}
+	if (mdsl_dict_iter_next(iter))
+	{
+		mdsl_error("Extra key (prefix=%s, found=%.*s)",
+				prefix, (int) iter->key_len, (const char *) iter->key);
+	}
+}
 
-	run_test(test_dict_insert_delete(test_strings_5, 4));
-	run_test(test_dict_insert_delete(test_strings_4, 4));
+//Positions and prefix counts should agree with the order of iteration
+static void check_order_stats(MdslDict *dict)
+{
+	MdslDictIter iter[1];
+	size_t n = 0, total_len = 0, i, j;
+
+	mdsl_dict_iter_init(iter, dict);
+	while (mdsl_dict_iter_next(iter))
+	{
+		n++;
+		total_len += iter->key_len;
+	}
+
+	char *data = (char *) mdsl_alloc(total_len + 1);
+	char **keys = (char **) mdsl_alloc(sizeof(char *) * (n + 1));
+	size_t *key_lens = (size_t *) mdsl_alloc(sizeof(size_t) * (n + 1));
+	total_len = 0;
+	mdsl_dict_iter_seek(iter, "", 0);
+	for (i = 0; mdsl_dict_iter_next(iter); i++)
+	{
+		keys[i] = data + total_len;
+		key_lens[i] = iter->key_len;
+		memcpy(keys[i], iter->key, iter->key_len);
+		total_len += iter->key_len;
+	}
+
+	if (mdsl_dict_count_prefix(dict, "", 0) != n)
+		mdsl_error("Wrong total count");
+	for (i = 0; i < n; i++)
+	{
+		if (mdsl_dict_rank(dict, keys[i], key_lens[i]) != i)
+			mdsl_error("Wrong rank for %.*s", (int) key_lens[i], keys[i]);
+
+		//Selected key and the one after it
+		if (! mdsl_dict_iter_select(iter, i))
+			mdsl_error("Selection failed");
+		for (j = i; j < n && j < i + 2; j++)
+		{
+			if (! mdsl_dict_iter_next(iter)
+					|| key_cmp(iter->key, iter->key_len, keys[j], key_lens[j]))
+				mdsl_error("Wrong key after selecting %d", (int) i);
+		}
+
+		//Rank of a prefix is the position of the first key having it
+		size_t prefix_len = key_lens[i] / 2;
+		size_t first = mdsl_dict_rank(dict, keys[i], prefix_len);
+		if (first > i || (first > 0 && key_cmp(keys[first - 1], 
+						key_lens[first - 1], keys[i], prefix_len) >= 0))
+			mdsl_error("Wrong rank for prefix of %.*s", 
+					(int) key_lens[i], keys[i]);
+		for (j = first; j < n; j++)
+		{
+			if (key_lens[j] < prefix_len 
+					|| memcmp(keys[j], keys[i], prefix_len) != 0)
+				break;
+		}
+		if (j <= i || mdsl_dict_count_prefix(dict, keys[i], prefix_len) 
+				!= j - first)
+			mdsl_error("Wrong count for prefix of %.*s", 
+					(int) key_lens[i], keys[i]);
+	}
+	if (mdsl_dict_iter_select(iter, n) || mdsl_dict_iter_next(iter))
+		mdsl_error("Selected past the last key");
+	mdsl_dict_iter_destroy(iter);
+
+	free(key_lens);
+	free(keys);
+	free(data);
+}
+
+//Removes node addresses from output of mdsl_dict_fdump(), so that
+//dumps of dictionaries with the same structure compare equal
+static void strip_node_addresses(char *dump)
+{
+	char *in = dump, *out = dump;
+	while (*in)
+	{
+		char *eol = strchr(in, '\n');
+		char *end = eol ? eol : in + strlen(in);
+		char *last = NULL, *prev = NULL, *iter;
+		for (iter = in; iter < end; iter++)
+		{
+			if (*iter == '|')
+			{
+				prev = last;
+				last = iter;
+			}
+		}
+		if (prev)
+		{
+			memmove(out, in, prev + 1 - in);
+			out += prev + 1 - in;
+			in = last + 1;
+		}
+		memmove(out, in, end - in);
+		out += end - in;
+		in = end;
+		if (eol)
+		{
+			*(out++) = '\n';
+			in++;
+		}
+	}
+	*out = 0;
+}
+
+//Compares contents of two dictionaries
+static void check_same_dump(MdslDict *a, MdslDict *b)
+{
+	MdslDictIter ia[1], ib[1];
+	mdsl_dict_iter_init(ia, a);
+	mdsl_dict_iter_init(ib, b);
+	while (mdsl_dict_iter_next(ia))
+	{
+		if (! mdsl_dict_iter_next(ib) 
+				|| key_cmp(ia->key, ia->key_len, ib->key, ib->key_len)
+				|| ia->value != ib->value)
+			mdsl_error("Dictionaries differ");
+	}
+	if (mdsl_dict_iter_next(ib))
+		mdsl_error("Dictionaries differ");
+	mdsl_dict_iter_destroy(ia);
+	mdsl_dict_iter_destroy(ib);
+}
+
+int test_dict_iter(char** strings)
+{
+	int i, j, n_strings;
+	for (n_strings = 0; strings[n_strings]; n_strings++)
+		;
+
+	char **sorted = (char **) mdsl_alloc(sizeof(char *) * (n_strings + 1));
+	memcpy(sorted, strings, sizeof(char *) * n_strings);
+	qsort(sorted, n_strings, sizeof(char *), str_ptr_cmp);
+
+	MdslDict *dict = mdsl_dict_new();
+	for (i = 0; i < n_strings; i++)
+		mdsl_dict_set_str(dict, sorted[i], sorted[i]);
+
+	MdslDictIter iter[1];
+	mdsl_dict_iter_init(iter, dict);
+	check_iter(iter, sorted, n_strings, "");
+
+	//Scan every prefix of every key
+	for (i = 0; i < n_strings; i++)
+	{
+		char *prefix = (char *) mdsl_alloc(strlen(sorted[i]) + 1);
+		for (j = 0; j <= strlen(sorted[i]); j++)
+		{
+			memcpy(prefix, sorted[i], j);
+			prefix[j] = 0;
+			mdsl_dict_iter_seek(iter, prefix, j);
+			check_iter(iter, sorted, n_strings, prefix);
+		}
+		free(prefix);
+	}
+
+	//Prefixes that do not exist
+	mdsl_dict_iter_seek(iter, "zzz", 3);
+	check_iter(iter, sorted, n_strings, "zzz");
+
+	mdsl_dict_iter_destroy(iter);
+	mdsl_dict_unref(dict);
+	free(sorted);
+
+	return 1;
+}
+
+//Random keys over a small alphabet, so that they share prefixes
+int test_dict_iter_random(int n_strings, int max_len)
+{
+	char **strings = (char **) mdsl_alloc(sizeof(char *) * (n_strings + 1));
+	int i, j;
+	unsigned int seed = 1;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		int len = rand_r(&seed) % (max_len + 1);
+		strings[i] = (char *) mdsl_alloc(len + 1);
+		for (j = 0; j < len; j++)
+			strings[i][j] = "abc"[rand_r(&seed) % 3];
+		strings[i][len] = 0;
+
+		for (j = 0; j < i; j++)
+		{
+			if (strcmp(strings[i], strings[j]) == 0)
+				break;
+		}
+		if (j < i)
+		{
+			free(strings[i]);
+			i--;
+		}
+	}
+	strings[n_strings] = NULL;
+
+	test_dict_iter(strings);
+
+	for (i = 0; i < n_strings; i++)
+		free(strings[i]);
+	free(strings);
+
+	return 1;
+}
+
+//Removing by prefix should agree with removing keys one by one
+int test_dict_remove_prefix(int n_strings, int max_len, int flags)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	MdslDict *cdict = mdsl_dict_new();
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	char *prefix = (char *) mdsl_alloc(max_len + 2);
+	unsigned int seed = 7;
+	int i, j;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "abc"[rand_r(&seed) % 3];
+		mdsl_dict_set(dict, key, len, key);
+		mdsl_dict_set(cdict, key, len, key);
+	}
+
+	for (i = 0; i < 40; i++)
+	{
+		int prefix_len = 1 + rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < prefix_len; j++)
+			prefix[j] = "abc"[rand_r(&seed) % 3];
+
+		//Collect matching keys first, deletion invalidates iterators
+		MdslDictIter iter[1];
+		char **matches = (char **) mdsl_alloc(sizeof(char *) * (n_strings + 1));
+		size_t *match_lens = (size_t *) mdsl_alloc
+			(sizeof(size_t) * (n_strings + 1));
+		size_t n_matches = 0, k;
+		mdsl_dict_iter_init(iter, cdict);
+		mdsl_dict_iter_seek(iter, prefix, prefix_len);
+		while (mdsl_dict_iter_next(iter))
+		{
+			matches[n_matches] = (char *) iter->value;
+			match_lens[n_matches] = iter->key_len;
+			n_matches++;
+		}
+		mdsl_dict_iter_destroy(iter);
+		for (k = 0; k < n_matches; k++)
+			mdsl_dict_set(cdict, matches[k], match_lens[k], NULL);
+		free(matches);
+		free(match_lens);
+
+		size_t n_removed = mdsl_dict_remove_prefix(dict, prefix, prefix_len);
+		if (n_removed != n_matches)
+			mdsl_error("Removed %d keys for prefix %.*s, expected %d", 
+					(int) n_removed, prefix_len, prefix, (int) n_matches);
+		check_same_dump(dict, cdict);
+		check_order_stats(dict);
+	}
+
+	//Remaining keys are still found
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		for (j = 0; j <= max_len; j++)
+		{
+			if (mdsl_dict_get(dict, key, j) != mdsl_dict_get(cdict, key, j))
+				mdsl_error("Wrong value after removing prefixes");
+		}
+	}
+
+	//Empty prefix removes everything and leaves an empty tree
+	MdslDict *edict = mdsl_dict_new();
+	mdsl_dict_remove_prefix(dict, "", 0);
+	check_same_dump(dict, edict);
+	FILE *stream;
+	char *dump = NULL, *edump = NULL;
+	size_t dump_len = 0, edump_len = 0;
+	stream = open_memstream(&dump, &dump_len);
+	mdsl_dict_fdump(dict, stream);
+	fclose(stream);
+	stream = open_memstream(&edump, &edump_len);
+	mdsl_dict_fdump(edict, stream);
+	fclose(stream);
+	strip_node_addresses(dump);
+	strip_node_addresses(edump);
+	if (strcmp(dump, edump) != 0)
+		mdsl_error("Dictionary not empty:\n%s", dump);
+
+	free(dump);
+	free(edump);
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+	mdsl_dict_unref(edict);
+	free(prefix);
+	free(data);
+
+	return 1;
+}
+
+//Statistics maintained during changes should match those of a dictionary
+//built from scratch with the same keys
+static void check_stats(MdslDict *dict, MdslDict *cdict)
+{
+	MdslDictStats stats[1], cstats[1];
+	int i;
+	size_t n_nodes = 0, n_keys = 0;
+
+	mdsl_dict_get_stats(dict, stats, 0);
+	mdsl_dict_get_stats(cdict, cstats, 1);
+
+	if (stats->n_keys != cstats->n_keys
+			|| stats->n_nodes != cstats->n_nodes
+			|| stats->node_bytes != cstats->node_bytes
+			|| stats->run_bytes != cstats->run_bytes
+			|| stats->have_depths)
+		mdsl_error("Statistics differ (n_keys %d/%d, n_nodes %d/%d)",
+				(int) stats->n_keys, (int) cstats->n_keys,
+				(int) stats->n_nodes, (int) cstats->n_nodes);
+	for (i = 0; i < MDSL_DICT_N_MAP_MODES; i++)
+		n_nodes += stats->map_modes[i];
+	if (n_nodes != stats->n_nodes)
+		mdsl_error("Map modes do not add up");
+	if (stats->total_bytes < stats->node_bytes + stats->map_bytes)
+		mdsl_error("Total memory too small");
+
+	mdsl_dict_get_stats(dict, stats, 1);
+	if (! stats->have_depths)
+		mdsl_error("Depths not computed");
+	for (i = 0; i < MDSL_DICT_N_DEPTHS; i++)
+	{
+		if (stats->depths[i] != cstats->depths[i])
+			mdsl_error("Depth histograms differ at %d", i);
+		n_keys += stats->depths[i];
+	}
+	if (n_keys != stats->n_keys)
+		mdsl_error("Depth histogram does not add up");
+}
+
+int test_dict_stats(int n_strings, int max_len, int flags)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	char *present = (char *) mdsl_alloc(n_strings + 1);
+	unsigned int seed = 8;
+	int i, j, round;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % max_len;
+		for (j = 0; j < len; j++)
+			key[j] = "abc"[rand_r(&seed) % 3];
+		key[len] = 0;
+		present[i] = 0;
+	}
+
+	for (round = 0; round < 6; round++)
+	{
+		for (i = 0; i < n_strings; i++)
+		{
+			char *key = data + i * (max_len + 1);
+			int op = rand_r(&seed) % 3;
+			if (op == 0)
+				mdsl_dict_set_str(dict, key, key);
+			else if (op == 1)
+				mdsl_dict_set_str(dict, key, NULL);
+		}
+		if (round == 3)
+			mdsl_dict_remove_prefix(dict, "ab", 2);
+
+		MdslDict *cdict = mdsl_dict_new();
+		for (i = 0; i < n_strings; i++)
+		{
+			char *key = data + i * (max_len + 1);
+			present[i] = mdsl_dict_get_str(dict, key) != NULL;
+			if (present[i])
+				mdsl_dict_set_str(cdict, key, key);
+		}
+		check_stats(dict, cdict);
+		mdsl_dict_unref(cdict);
+	}
+
+	mdsl_dict_unref(dict);
+	free(data);
+	free(present);
+
+	return 1;
+}
+
+//Memory held other than child tables: the node pool, nodes too long for 
+//the pool, and buffers that only grow
+static size_t node_memory(MdslDict *dict, MdslDictStats *stats)
+{
+	mdsl_dict_get_stats(dict, stats, 0);
+	return stats->total_bytes - stats->map_bytes;
+}
+
+//Nodes of up to 32 bytes come from the pool and are reused after removal, 
+//longer nodes are allocated and freed one by one
+int test_dict_node_pool(int n_short, int n_long)
+{
+	MdslDict *dict = mdsl_dict_new();
+	MdslDict *cdict;
+	MdslDictStats stats[1];
+	char *shorts = (char *) mdsl_alloc(n_short * 16);
+	char *longs = (char *) mdsl_alloc(n_long * 64);
+	char big[256];
+	unsigned int seed = 23;
+	size_t held, held_full = 0;
+	int i, j, round;
+
+	mdsl_assert(n_long < 128, "Too many long keys");
+	for (i = 0; i < n_short; i++)
+	{
+		char *key = shorts + i * 16;
+		int len = 1 + rand_r(&seed) % 12;
+		key[0] = 's';
+		for (j = 1; j < len; j++)
+			key[j] = "abcd"[rand_r(&seed) % 4];
+		key[len] = 0;
+	}
+	//Each long key is a single child of the root, with a 60 byte run
+	for (i = 0; i < n_long; i++)
+	{
+		char *key = longs + i * 64;
+		key[0] = 128 + i;
+		for (j = 1; j < 61; j++)
+			key[j] = 'a' + rand_r(&seed) % 26;
+		key[61] = 0;
+	}
+
+	//Grow the buffers that never shrink first
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = 0;
+	mdsl_dict_set_str(dict, big, big);
+	mdsl_dict_set_str(dict, big, NULL);
+
+	for (round = 0; round < 3; round++)
+	{
+		//Short keys: removal keeps the memory in the pool, and inserting 
+		//the same keys again takes all of it from the free lists
+		for (i = 0; i < n_short; i++)
+			mdsl_dict_set_str(dict, shorts + i * 16, shorts + i * 16);
+		held = node_memory(dict, stats);
+		if (round == 0)
+			held_full = held;
+		else if (held != held_full)
+			mdsl_error("Freed nodes not reused (%lu bytes instead of %lu)",
+					(unsigned long) held, (unsigned long) held_full);
+
+		//Long keys: memory follows the node bytes exactly
+		for (i = 0; i < 2 * n_long; i++)
+		{
+			char *key = longs + (i % n_long) * 64;
+			size_t node_bytes;
+
+			held = node_memory(dict, stats);
+			node_bytes = stats->node_bytes;
+			mdsl_dict_set_str(dict, key, i < n_long ? key : NULL);
+			if (node_memory(dict, stats) - held 
+					!= stats->node_bytes - node_bytes)
+				mdsl_error("Long node not allocated on its own");
+		}
+		if (node_memory(dict, stats) != held_full)
+			mdsl_error("Long keys left memory behind");
+
+		for (i = 0; i < n_short; i++)
+			mdsl_dict_set_str(dict, shorts + i * 16, NULL);
+		if (node_memory(dict, stats) != held_full)
+			mdsl_error("Pool memory released by removal");
+		if (stats->n_nodes != 1)
+			mdsl_error("Nodes left after removing all keys");
+	}
+
+	//Mixed churn, then the counters must match a fresh dictionary
+	for (round = 0; round < 4; round++)
+	{
+		for (i = 0; i < n_short + n_long; i++)
+		{
+			int k = rand_r(&seed) % (n_short + n_long);
+			char *key = k < n_short ? shorts + k * 16 
+				: longs + (k - n_short) * 64;
+			mdsl_dict_set_str(dict, key, rand_r(&seed) % 2 ? key : NULL);
+		}
+		cdict = mdsl_dict_new();
+		for (i = 0; i < n_short + n_long; i++)
+		{
+			char *key = i < n_short ? shorts + i * 16 
+				: longs + (i - n_short) * 64;
+			if (mdsl_dict_get_str(dict, key))
+				mdsl_dict_set_str(cdict, key, key);
+		}
+		check_stats(dict, cdict);
+		mdsl_dict_unref(cdict);
+	}
+
+	mdsl_dict_unref(dict);
+	free(shorts);
+	free(longs);
+
+	return 1;
+}
+
+//Key counts with values stored through slots
+static void check_slot_counts(MdslDict *dict, const char *present, int n_keys)
+{
+	MdslDictStats stats[1];
+	size_t n_present = 0;
+	int i;
+
+	for (i = 0; i < n_keys; i++)
+		n_present += present[i];
+
+	mdsl_dict_get_stats(dict, stats, 0);
+	if (stats->n_keys != n_present)
+		mdsl_error("n_keys is %lu instead of %lu", 
+				(unsigned long) stats->n_keys, (unsigned long) n_present);
+	mdsl_dict_get_stats(dict, stats, 1);
+	if (stats->n_keys != n_present)
+		mdsl_error("Walk found %lu keys instead of %lu", 
+				(unsigned long) stats->n_keys, (unsigned long) n_present);
+	check_order_stats(dict);
+}
+
+int test_dict_stats_slots(int n_ops)
+{
+	MdslDict *dict = mdsl_dict_new();
+	const char *keys[] = {"", "a", "ab", "abc", "abd", "b", "ba", "bab"};
+	int n_keys = sizeof(keys) / sizeof(keys[0]);
+	char present[sizeof(keys) / sizeof(keys[0])];
+	unsigned int seed = 21;
+	int i, op, pending = 0;
+
+	memset(present, 0, sizeof(present));
+
+	//Removing a key stored through a slot
+	*mdsl_dict_lookup_slot(dict, "abc", 3, 1) = (void *) keys[3];
+	present[3] = 1;
+	check_slot_counts(dict, present, n_keys);
+	mdsl_dict_set(dict, "abc", 3, NULL);
+	present[3] = 0;
+	check_slot_counts(dict, present, n_keys);
+
+	for (op = 0; op < n_ops; op++)
+	{
+		void **slot;
+
+		i = rand_r(&seed) % n_keys;
+		switch (rand_r(&seed) % 8)
+		{
+		case 0:
+		case 1:
+			slot = mdsl_dict_lookup_slot(dict, keys[i], strlen(keys[i]), 1);
+			*slot = (void *) keys[i];
+			present[i] = 1;
+			break;
+		case 2:
+			//Left as it is, removed by the next modification if NULL
+			mdsl_dict_lookup_slot(dict, keys[i], strlen(keys[i]), 1);
+			pending = ! present[i];
+			break;
+		case 3:
+			slot = mdsl_dict_lookup_slot(dict, keys[i], strlen(keys[i]), 0);
+			if ((slot != NULL) != present[i])
+				mdsl_error("Wrong slot for %s", keys[i]);
+			if (slot)
+			{
+				*slot = NULL;
+				present[i] = 0;
+				pending = 1;
+			}
+			break;
+		case 4:
+		case 5:
+			mdsl_dict_set_str(dict, keys[i], keys[i]);
+			present[i] = 1;
+			break;
+		case 6:
+		{
+			//Everything under the key, including itself
+			size_t len = strlen(keys[i]);
+			size_t n_removed = 0, n_expected = 0;
+			int j;
+
+			for (j = 0; j < n_keys; j++)
+			{
+				if (strncmp(keys[j], keys[i], len) == 0)
+				{
+					n_expected += present[j];
+					present[j] = 0;
+				}
+			}
+			n_removed = mdsl_dict_remove_prefix(dict, keys[i], len);
+			if (n_removed != n_expected)
+				mdsl_error("Removed %lu keys instead of %lu", 
+						(unsigned long) n_removed, 
+						(unsigned long) n_expected);
+			break;
+		}
+		default:
+			mdsl_dict_set_str(dict, keys[i], NULL);
+			present[i] = 0;
+			break;
+		}
+
+		//Counts agree with iteration once empty slots are settled
+		if (pending)
+		{
+			if (op % 2 == 0)
+				mdsl_dict_unref(mdsl_dict_snapshot(dict));
+			else
+				mdsl_dict_set_str(dict, "x", NULL);
+			pending = 0;
+		}
+		check_slot_counts(dict, present, n_keys);
+	}
+
+	mdsl_dict_unref(dict);
+
+	return 1;
+}
+
+//Keys going in and out under a shared prefix stop changing child tables
+int test_dict_map_churn(int n_children, int flags)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	MdslDictStats stats[1], before[1];
+	char key[8] = "s/?/x";
+	int i, round;
+
+	for (i = 0; i < n_children; i++)
+	{
+		key[2] = 1 + i;
+		mdsl_dict_set_str(dict, key, key);
+	}
+	mdsl_dict_get_stats(dict, stats, 0);
+	if (n_children > 4 && stats->n_map_grows == 0)
+		mdsl_error("Growth not counted");
+
+	for (round = 0; round < 10; round++)
+	{
+		if (round == 1)
+			mdsl_dict_get_stats(dict, before, 0);
+		for (i = 0; i < 2; i++)
+		{
+			key[2] = 1 + n_children + i;
+			mdsl_dict_set_str(dict, key, key);
+		}
+		for (i = 0; i < 2; i++)
+		{
+			key[2] = 1 + n_children + i;
+			mdsl_dict_set_str(dict, key, NULL);
+		}
+	}
+
+	mdsl_dict_get_stats(dict, stats, 0);
+	if (stats->n_map_grows != before->n_map_grows
+			|| stats->n_map_shrinks != before->n_map_shrinks
+			|| stats->n_map_resizes != before->n_map_resizes
+			|| stats->map_bytes != before->map_bytes)
+		mdsl_error("Child tables changed (%d grows, %d shrinks, %d resizes)",
+				(int) (stats->n_map_grows - before->n_map_grows),
+				(int) (stats->n_map_shrinks - before->n_map_shrinks),
+				(int) (stats->n_map_resizes - before->n_map_resizes));
+	if (stats->n_keys != (size_t) n_children)
+		mdsl_error("Wrong number of keys");
+
+	mdsl_dict_unref(dict);
+
+	return 1;
+}
+
+//Counting with slots should agree with counting with get and set
+int test_dict_lookup_slot(int n_ops, int max_len)
+{
+	MdslDict *dict = mdsl_dict_new();
+	MdslDict *cdict = mdsl_dict_new();
+	char key[64];
+	unsigned int seed = 6;
+	int i, j;
+
+	for (i = 0; i < n_ops; i++)
+	{
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "abc"[rand_r(&seed) % 3];
+
+		void **slot = mdsl_dict_lookup_slot(dict, key, len, 1);
+		if (! slot)
+			mdsl_error("mdsl_dict_lookup_slot() returned NULL");
+		*slot = (char *) *slot + 1;
+
+		char *count = (char *) mdsl_dict_get(cdict, key, len);
+		mdsl_dict_set(cdict, key, len, count + 1);
+	}
+	check_same_dump(dict, cdict);
+
+	//Lookup without creation
+	MdslDictIter iter[1];
+	mdsl_dict_iter_init(iter, cdict);
+	while (mdsl_dict_iter_next(iter))
+	{
+		void **slot = mdsl_dict_lookup_slot(dict, iter->key, iter->key_len, 0);
+		if (! slot || *slot != iter->value)
+			mdsl_error("Wrong slot");
+
+		//Prefixes may end at branches that hold no value
+		for (j = 0; j < (int) iter->key_len; j++)
+		{
+			slot = mdsl_dict_lookup_slot(dict, iter->key, j, 0);
+			if ((slot != NULL) != (mdsl_dict_get(cdict, iter->key, j) != NULL))
+				mdsl_error("Wrong slot for prefix");
+		}
+	}
+	mdsl_dict_iter_destroy(iter);
+	memset(key, 'd', max_len + 1);
+	if (mdsl_dict_lookup_slot(dict, key, max_len + 1, 0))
+		mdsl_error("Slot found for missing key");
+
+	//Slot left empty does not add the key
+	void **slot = mdsl_dict_lookup_slot(dict, key, max_len + 1, 1);
+	if (! slot || *slot)
+		mdsl_error("Wrong slot for new key");
+	check_same_dump(dict, cdict);
+	mdsl_dict_set(dict, key, max_len + 1, NULL);
+	check_same_dump(dict, cdict);
+
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+
+	return 1;
+}
+
+//Longest prefix match should agree with mdsl_dict_get() on every prefix
+int test_dict_longest_prefix(int n_strings, int max_len)
+{
+	MdslDict *dict = mdsl_dict_new();
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	char query[256];
+	unsigned int seed = 5;
+	int i, j, len;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "ab"[rand_r(&seed) % 2];
+		mdsl_dict_set(dict, key, len, key);
+	}
+
+	for (i = 0; i < n_strings * 4; i++)
+	{
+		int query_len = rand_r(&seed) % (max_len + 8);
+		for (j = 0; j < query_len; j++)
+			query[j] = "ab"[rand_r(&seed) % 2];
+
+		size_t matched_len = 1000;
+		void *res = mdsl_dict_get_longest_prefix
+			(dict, query, query_len, &matched_len);
+		void *cres = NULL;
+		for (len = query_len; len >= 0; len--)
+		{
+			cres = mdsl_dict_get(dict, query, len);
+			if (cres)
+				break;
+		}
+		if (res != cres || (res ? (int) matched_len != len : matched_len != 0))
+			mdsl_error("Wrong longest prefix match for %.*s "
+					"(res = %p, cres = %p, matched_len = %d)", 
+					query_len, query, res, cres, (int) matched_len);
+	}
+
+	mdsl_dict_unref(dict);
+	free(data);
+
+	return 1;
+}
+
+//Batched lookup should agree with mdsl_dict_get()
+int test_dict_get_many(int n_strings)
+{
+	MdslDict *dict = mdsl_dict_new();
+	const void **keys = (const void **) mdsl_alloc(sizeof(void *) * n_strings);
+	size_t *key_lens = (size_t *) mdsl_alloc(sizeof(size_t) * n_strings);
+	void **values = (void **) mdsl_alloc(sizeof(void *) * n_strings);
+	char *data = (char *) mdsl_alloc(n_strings * 40);
+	unsigned int seed = 2;
+	int i, j;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * 40;
+		key_lens[i] = rand_r(&seed) % 40;
+		for (j = 0; j < key_lens[i]; j++)
+			key[j] = "ab\xff"[rand_r(&seed) % 3];
+		keys[i] = key;
+		//Every other key is left out to test misses
+		if (i % 2)
+			mdsl_dict_set(dict, key, key_lens[i], key);
+	}
+
+	for (j = 0; j <= n_strings; j += 1 + j / 2)
+	{
+		mdsl_dict_get_many(dict, keys, key_lens, j, values);
+		for (i = 0; i < j; i++)
+		{
+			void *cres = mdsl_dict_get(dict, keys[i], key_lens[i]);
+			if (values[i] != cres)
+			{
+				mdsl_error("Wrong result (n = %d, i = %d, res = %p, cres = %p)",
+						j, i, values[i], cres);
+			}
+		}
+	}
+
+	mdsl_dict_unref(dict);
+	free(keys);
+	free(key_lens);
+	free(values);
+	free(data);
+
+	return 1;
+}
+
+//Source for bulk loading from array of strings
+typedef struct
+{
+	char **strings;
+	int i;
+} StringSource;
+
+static int string_source_next(void *user_data, const void **key_return,
+		size_t *key_len_return, const void **value_return)
+{
+	StringSource *source = (StringSource *) user_data;
+	char *str = source->strings[source->i];
+	if (! str)
+		return 0;
+	*key_return = str;
+	*key_len_return = strlen(str);
+	*value_return = str;
+	source->i++;
+	return 1;
+}
+
+int test_dict_bulk_load(int n_strings, int max_len)
+{
+	char **strings = (char **) mdsl_alloc(sizeof(char *) * (n_strings + 1));
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	unsigned int seed = 3;
+	int i, j, n_unique;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		int len = rand_r(&seed) % (max_len + 1);
+		strings[i] = data + i * (max_len + 1);
+		for (j = 0; j < len; j++)
+			strings[i][j] = "abc"[rand_r(&seed) % 3];
+		strings[i][len] = 0;
+	}
+	qsort(strings, n_strings, sizeof(char *), str_ptr_cmp);
+	for (i = 0, n_unique = 0; i < n_strings; i++)
+	{
+		if (n_unique == 0 || strcmp(strings[i], strings[n_unique - 1]) != 0)
+			strings[n_unique++] = strings[i];
+	}
+	strings[n_unique] = NULL;
+
+	//Bulk loaded and incrementally built dictionaries should be the same
+	MdslDict *dict = mdsl_dict_new();
+	MdslDict *cdict = mdsl_dict_new();
+	StringSource source = {strings, 0};
+	if (mdsl_dict_bulk_load(dict, string_source_next, &source) != MDSL_SUCCESS)
+		mdsl_error("Bulk loading failed");
+	for (i = 0; i < n_unique; i++)
+		mdsl_dict_set_str(cdict, strings[i], strings[i]);
+
+	FILE *stream;
+	char *dump = NULL, *cdump = NULL;
+	size_t dump_len = 0, cdump_len = 0;
+	stream = open_memstream(&dump, &dump_len);
+	mdsl_dict_fdump(dict, stream);
+	fclose(stream);
+	stream = open_memstream(&cdump, &cdump_len);
+	mdsl_dict_fdump(cdict, stream);
+	fclose(stream);
+	strip_node_addresses(dump);
+	strip_node_addresses(cdump);
+	if (strcmp(dump, cdump) != 0)
+	{
+		mdsl_error("Bulk loaded dictionary differs:\n%s\nExpected:\n%s", 
+				dump, cdump);
+	}
+	check_same_dump(dict, cdict);
+	check_order_stats(dict);
+	for (i = 0; i < n_unique; i++)
+	{
+		if (mdsl_dict_get_str(dict, strings[i]) != strings[i])
+			mdsl_error("Key %s not found", strings[i]);
+	}
+
+	//Deletion should work as usual
+	for (i = 0; i < n_unique; i += 2)
+		mdsl_dict_set_str(dict, strings[i], NULL);
+	for (i = 0; i < n_unique; i++)
+	{
+		if (mdsl_dict_get_str(dict, strings[i]) != (i % 2 ? strings[i] : NULL))
+			mdsl_error("Wrong value for %s after deletion", strings[i]);
+	}
+	check_order_stats(dict);
+
+	//Loading into non-empty dictionary fails
+	source.i = 0;
+	if (n_unique > 0 
+			&& mdsl_dict_bulk_load(cdict, string_source_next, &source) 
+			!= MDSL_FAILURE)
+		mdsl_error("Bulk loading into non-empty dictionary succeeded");
+
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+
+	//Unsorted input fails and leaves the dictionary empty
+	if (n_unique > 2)
+	{
+		char *tmp = strings[n_unique - 2];
+		strings[n_unique - 2] = strings[n_unique - 1];
+		strings[n_unique - 1] = tmp;
+
+		dict = mdsl_dict_new();
+		source.i = 0;
+		if (mdsl_dict_bulk_load(dict, string_source_next, &source) 
+				!= MDSL_FAILURE)
+			mdsl_error("Bulk loading unsorted keys succeeded");
+		for (i = 0; i < n_unique; i++)
+		{
+			if (mdsl_dict_get_str(dict, strings[i]))
+				mdsl_error("Key %s found after failure", strings[i]);
+		}
+		mdsl_dict_unref(dict);
+
+		//Duplicate keys fail too
+		strings[n_unique - 1] = strings[n_unique - 2];
+		dict = mdsl_dict_new();
+		source.i = 0;
+		if (mdsl_dict_bulk_load(dict, string_source_next, &source) 
+				!= MDSL_FAILURE)
+			mdsl_error("Bulk loading duplicate keys succeeded");
+		mdsl_dict_unref(dict);
+	}
+
+	free(dump);
+	free(cdump);
+	free(strings);
+	free(data);
+
+	return 1;
+}
+
+//Same nodes and layouts of child tables, ignoring node addresses
+static void check_same_structure(MdslDict *a, MdslDict *b)
+{
+	FILE *stream;
+	char *dump = NULL, *cdump = NULL;
+	size_t dump_len = 0, cdump_len = 0;
+
+	stream = open_memstream(&dump, &dump_len);
+	mdsl_dict_fdump(a, stream);
+	fclose(stream);
+	stream = open_memstream(&cdump, &cdump_len);
+	mdsl_dict_fdump(b, stream);
+	fclose(stream);
+	strip_node_addresses(dump);
+	strip_node_addresses(cdump);
+	if (strcmp(dump, cdump) != 0)
+		mdsl_error("Dictionaries differ:\n%s\nExpected:\n%s", dump, cdump);
+
+	free(dump);
+	free(cdump);
+}
+
+//Unsorted pairs with repeated keys and removals, against mdsl_dict_set()
+int test_dict_build_parallel(int n_pairs, int max_len, int n_threads, 
+		const char *alphabet, const char *prefix, int flags)
+{
+	int prefix_len = strlen(prefix);
+	char *data = (char *) mdsl_alloc(n_pairs * (prefix_len + max_len + 1) + 1);
+	const void **keys = (const void **) mdsl_alloc
+		(sizeof(void *) * (n_pairs + 1));
+	const void **values = (const void **) mdsl_alloc
+		(sizeof(void *) * (n_pairs + 1));
+	size_t *key_lens = (size_t *) mdsl_alloc(sizeof(size_t) * (n_pairs + 1));
+	int alphabet_len = strlen(alphabet);
+	unsigned int seed = 21;
+	int i, j;
+
+	for (i = 0; i < n_pairs; i++)
+	{
+		char *key = data + i * (prefix_len + max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		memcpy(key, prefix, prefix_len);
+		for (j = 0; j < len; j++)
+			key[prefix_len + j] = alphabet[rand_r(&seed) % alphabet_len];
+		keys[i] = key;
+		key_lens[i] = rand_r(&seed) % 50 == 0 ? 0 : prefix_len + len;
+		values[i] = rand_r(&seed) % 4 == 0 ? NULL : key;
+	}
+
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	MdslDict *cdict = mdsl_dict_new_with_flags(flags);
+	if (mdsl_dict_build_parallel(dict, keys, key_lens, values, n_pairs, 
+				n_threads) != MDSL_SUCCESS)
+		mdsl_error("Parallel build failed");
+	for (i = 0; i < n_pairs; i++)
+		mdsl_dict_set(cdict, keys[i], key_lens[i], values[i]);
+
+	check_same_structure(dict, cdict);
+	check_same_dump(dict, cdict);
+	check_stats(dict, cdict);
+	check_order_stats(dict);
+
+	//Child tables grown before a removal stay large, so layouts can only
+	//match a dictionary that never saw removed keys
+	MdslDict *idict = mdsl_dict_new();
+	MdslDictStats stats[1], istats[1];
+	MdslDictIter iter[1];
+	mdsl_dict_iter_init(iter, cdict);
+	while (mdsl_dict_iter_next(iter))
+		mdsl_dict_set(idict, iter->key, iter->key_len, iter->value);
+	mdsl_dict_iter_destroy(iter);
+	mdsl_dict_get_stats(dict, stats, 0);
+	mdsl_dict_get_stats(idict, istats, 0);
+	if (stats->map_bytes != istats->map_bytes)
+		mdsl_error("Child tables differ");
+	for (i = 0; i < MDSL_DICT_N_MAP_MODES; i++)
+		if (stats->map_modes[i] != istats->map_modes[i])
+			mdsl_error("Child tables differ");
+	mdsl_dict_unref(idict);
+
+	//The result can be modified as usual
+	for (i = 0; i < n_pairs; i += 3)
+	{
+		mdsl_dict_set(dict, keys[i], key_lens[i], NULL);
+		mdsl_dict_set(cdict, keys[i], key_lens[i], NULL);
+	}
+	check_same_dump(dict, cdict);
+	check_stats(dict, cdict);
+	check_order_stats(dict);
+
+	//Building into a non-empty dictionary fails
+	keys[n_pairs] = "x";
+	key_lens[n_pairs] = 1;
+	values[n_pairs] = "x";
+	mdsl_dict_set_str(cdict, "x", "x");
+	if (mdsl_dict_build_parallel(cdict, keys, key_lens, values, n_pairs + 1,
+				n_threads) != MDSL_FAILURE)
+		mdsl_error("Parallel build into non-empty dictionary succeeded");
+
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+	free(key_lens);
+	free(values);
+	free(keys);
+	free(data);
+
+	return 1;
+}
+
+//Order statistics through every kind of change, and in snapshots
+int test_dict_order_stats(int n_strings, int max_len, int flags)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	MdslDict *snapshot = NULL;
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	char *extra = (char *) mdsl_alloc(max_len + 2);
+	unsigned int seed = 19;
+	int i, j, round;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "abc"[rand_r(&seed) % 3];
+		key[len] = 0;
+	}
+
+	check_order_stats(dict);
+	for (round = 0; round < 6; round++)
+	{
+		for (i = 0; i < n_strings; i++)
+		{
+			char *key = data + i * (max_len + 1);
+			int op = rand_r(&seed) % 3;
+			if (op == 0)
+				mdsl_dict_set_str(dict, key, key);
+			else if (op == 1)
+				mdsl_dict_set_str(dict, key, NULL);
+		}
+		if (round == 2)
+			mdsl_dict_remove_prefix(dict, "ab", 2);
+		if (round == 4)
+			mdsl_dict_remove_prefix(dict, "", 0);
+		check_order_stats(dict);
+
+		//Snapshot taken in the previous round is unaffected
+		if (snapshot)
+		{
+			check_order_stats(snapshot);
+			mdsl_dict_unref(snapshot);
+			snapshot = NULL;
+		}
+		if (! (flags & MDSL_DICT_CONCURRENT))
+			snapshot = mdsl_dict_snapshot(dict);
+	}
+	if (snapshot)
+		mdsl_dict_unref(snapshot);
+
+	//Values stored through slots are counted like set ones
+	if (! (flags & MDSL_DICT_CONCURRENT))
+	{
+		size_t n = mdsl_dict_count_prefix(dict, "", 0);
+		memset(extra, 'd', max_len + 1);
+		extra[max_len + 1] = 0;
+
+		*mdsl_dict_lookup_slot(dict, extra, max_len + 1, 1) = extra;
+		if (mdsl_dict_count_prefix(dict, "", 0) != n + 1)
+			mdsl_error("Value stored through slot not counted");
+		check_order_stats(dict);
+		mdsl_dict_set_str(dict, extra, NULL);
+		if (mdsl_dict_count_prefix(dict, "", 0) != n)
+			mdsl_error("Removal of value stored through slot not counted");
+
+		//Slot left empty is removed by the next modification
+		mdsl_dict_lookup_slot(dict, extra, max_len + 1, 1);
+		mdsl_dict_set_str(dict, "e", NULL);
+		if (mdsl_dict_count_prefix(dict, "", 0) != n)
+			mdsl_error("Empty slot counted");
+		check_order_stats(dict);
+	}
+
+	mdsl_dict_unref(dict);
+	free(extra);
+	free(data);
+
+	return 1;
+}
+
+//Frozen images
+static uint64_t freeze_index(void *user_data, const void *value)
+{
+	return ((const char *) value) - ((const char *) user_data);
+}
+
+//Keys are stored with length in the first byte
+static void check_frozen(const void *image, size_t image_len, 
+		MdslDict *dict, char *data, int n_keys, int stride)
+{
+	int i;
+	uint64_t value;
+
+	if (mdsl_frozen_dict_check(image, image_len) != MDSL_SUCCESS)
+		mdsl_error("Frozen image check failed");
+
+	for (i = 0; i < n_keys; i++)
+	{
+		char *key = data + i * stride;
+		size_t key_len = (unsigned char) key[0];
+		char *cres = mdsl_dict_get(dict, key + 1, key_len);
+		int found = mdsl_frozen_dict_get(image, key + 1, key_len, &value);
+		if (found != (cres != NULL) || (found && value != cres - data))
+			mdsl_error("Wrong result for key %d in frozen image", i);
+	}
+}
+
+int test_dict_freeze(int n_keys, int max_len, int alphabet)
+{
+	int stride = max_len + 1;
+	char *data = (char *) mdsl_alloc(n_keys * stride);
+	MdslDict *dict = mdsl_dict_new();
+	unsigned int seed = 4;
+	int i, j;
+
+	//Only even keys are inserted, odd keys are mostly misses
+	for (i = 0; i < n_keys; i++)
+	{
+		char *key = data + i * stride;
+		key[0] = rand_r(&seed) % (max_len + 1);
+		for (j = 1; j <= (unsigned char) key[0]; j++)
+			key[j] = rand_r(&seed) % alphabet;
+		if (i % 2 == 0)
+			mdsl_dict_set(dict, key + 1, (unsigned char) key[0], key);
+	}
+
+	size_t image_len;
+	void *image = mdsl_dict_freeze(dict, freeze_index, data, &image_len);
+	check_frozen(image, image_len, dict, data, n_keys, stride);
+
+	//Through a file mapped to memory
+	FILE *file = tmpfile();
+	if (! file || fwrite(image, 1, image_len, file) != image_len 
+			|| fflush(file) != 0)
+		mdsl_error("Cannot write frozen image");
+	void *mapped = mmap(NULL, image_len, PROT_READ, MAP_PRIVATE, 
+			fileno(file), 0);
+	if (mapped == MAP_FAILED)
+		mdsl_error("mmap() failed");
+	check_frozen(mapped, image_len, dict, data, n_keys, stride);
+	munmap(mapped, image_len);
+	fclose(file);
+
+	//Corrupt images are rejected
+	((char *) image)[0] ^= 1;
+	if (mdsl_frozen_dict_check(image, image_len) != MDSL_FAILURE)
+		mdsl_error("Corrupt image accepted");
+
+	free(image);
+	mdsl_dict_unref(dict);
+	free(data);
+
+	return 1;
+}
+
+//Concurrent readers
+typedef struct
+{
+	MdslDict *dict;
+	char **strings;
+	int n_strings;
+	int *stop;
+} ConcurrentReader;
+
+static void *concurrent_reader(void *data)
+{
+	ConcurrentReader *reader = (ConcurrentReader *) data;
+	int i;
+
+	while (! __atomic_load_n(reader->stop, __ATOMIC_ACQUIRE))
+	{
+		//Keys at even indices are never deleted, 
+		//the others may or may not be present.
+		for (i = 0; i < reader->n_strings; i++)
+		{
+			char *res = mdsl_dict_get_str(reader->dict, reader->strings[i]);
+			if (res != reader->strings[i] && (i % 2 == 0 || res))
+				mdsl_error("Wrong value for %s", reader->strings[i]);
+		}
+
+		//Iteration must see a consistent sorted view
+		MdslDictIter iter[1];
+		char *prev = NULL;
+		int n_even = 0;
+		mdsl_dict_read_begin(reader->dict);
+		mdsl_dict_iter_init(iter, reader->dict);
+		while (mdsl_dict_iter_next(iter))
+		{
+			char *value = (char *) iter->value;
+			if (prev && strcmp(prev, value) >= 0)
+				mdsl_error("Iteration out of order");
+			if (((value - reader->strings[0]) / 16) % 2 == 0)
+				n_even++;
+			prev = value;
+		}
+		mdsl_dict_iter_destroy(iter);
+		mdsl_dict_read_end(reader->dict);
+		if (n_even != (reader->n_strings + 1) / 2)
+			mdsl_error("Iteration found %d of %d keys", 
+					n_even, (reader->n_strings + 1) / 2);
+	}
+
+	return NULL;
+}
+
+int test_dict_concurrent(int n_strings, int n_readers, int n_rounds)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(MDSL_DICT_CONCURRENT);
+	MdslDict *cdict = mdsl_dict_new();
+	char **strings = (char **) mdsl_alloc(sizeof(char *) * n_strings);
+	char *data = (char *) mdsl_alloc(n_strings * 16);
+	ConcurrentReader *readers 
+		= (ConcurrentReader *) mdsl_alloc(sizeof(ConcurrentReader) * n_readers);
+	pthread_t *threads 
+		= (pthread_t *) mdsl_alloc(sizeof(pthread_t) * n_readers);
+	unsigned int seed = 4;
+	int stop = 0;
+	int i, j;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		int len = 1 + rand_r(&seed) % 10;
+		strings[i] = data + i * 16;
+		for (j = 0; j < len; j++)
+			strings[i][j] = "abc"[rand_r(&seed) % 3];
+		strings[i][len] = 0;
+		//Make keys unique
+		sprintf(strings[i] + len, "%x", i);
+	}
+
+	for (i = 0; i < n_strings; i += 2)
+		mdsl_dict_set_str(dict, strings[i], strings[i]);
+
+	for (i = 0; i < n_readers; i++)
+	{
+		readers[i].dict = dict;
+		readers[i].strings = strings;
+		readers[i].n_strings = n_strings;
+		readers[i].stop = &stop;
+		if (pthread_create(threads + i, NULL, concurrent_reader, readers + i)
+				!= 0)
+			mdsl_error("pthread_create() failed");
+	}
+
+	//Insert and delete keys at odd indices
+	for (j = 0; j < n_rounds; j++)
+	{
+		for (i = 1; i < n_strings; i += 2)
+			mdsl_dict_set_str(dict, strings[i], strings[i]);
+		for (i = 1; i < n_strings; i += 2)
+			mdsl_dict_set_str(dict, strings[i], NULL);
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < n_readers; i++)
+		pthread_join(threads[i], NULL);
+
+	//Result should be same as that of a normal dictionary
+	for (i = 0; i < n_strings; i += 2)
+		mdsl_dict_set_str(cdict, strings[i], strings[i]);
+	for (i = 1; i < n_strings; i += 4)
+	{
+		mdsl_dict_set_str(dict, strings[i], strings[i]);
+		mdsl_dict_set_str(cdict, strings[i], strings[i]);
+	}
+	check_same_dump(dict, cdict);
+
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+	free(strings);
+	free(data);
+	free(readers);
+	free(threads);
+
+	return 1;
+}
+
+//Snapshots must keep their contents while the dictionary changes, and 
+//can be read from another thread while it is being changed
+typedef struct
+{
+	MdslDict *snapshot, *ref;
+} SnapshotReader;
+
+static void *snapshot_reader(void *data)
+{
+	SnapshotReader *reader = (SnapshotReader *) data;
+	int i;
+
+	for (i = 0; i < 20; i++)
+		check_same_dump(reader->snapshot, reader->ref);
+
+	return NULL;
+}
+
+int test_dict_snapshot(int n_strings, int max_len)
+{
+	MdslDict *dict = mdsl_dict_new();
+	MdslDict *snapshots[8], *refs[8];
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	unsigned int seed = 14;
+	int i, j, round, n_rounds = 8;
+	pthread_t thread;
+	SnapshotReader reader;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "abc"[rand_r(&seed) % 3];
+		key[len] = 0;
+	}
+
+	for (round = 0; round < n_rounds; round++)
+	{
+		//Take a snapshot and a plain copy
+		MdslDictIter iter[1];
+		snapshots[round] = mdsl_dict_snapshot(dict);
+		refs[round] = mdsl_dict_new();
+		mdsl_dict_iter_init(iter, dict);
+		while (mdsl_dict_iter_next(iter))
+			mdsl_dict_set(refs[round], iter->key, iter->key_len, iter->value);
+		mdsl_dict_iter_destroy(iter);
+
+		reader.snapshot = snapshots[round];
+		reader.ref = refs[round];
+		if (pthread_create(&thread, NULL, snapshot_reader, &reader) != 0)
+			mdsl_error("pthread_create() failed");
+
+		//Modify the dictionary
+		for (i = 0; i < n_strings; i++)
+		{
+			char *key = data + i * (max_len + 1);
+			int op = rand_r(&seed) % 4;
+			if (op == 0)
+				mdsl_dict_set_str(dict, key, key);
+			else if (op == 1)
+				mdsl_dict_set_str(dict, key, NULL);
+			else if (op == 2)
+				*mdsl_dict_lookup_slot(dict, key, strlen(key), 1) = key + 1;
+		}
+		if (round == 3)
+			mdsl_dict_remove_prefix(dict, "ab", 2);
+		if (round == 5)
+			mdsl_dict_remove_prefix(dict, "", 0);
+
+		pthread_join(thread, NULL);
+
+		//Drop some of the snapshots early
+		if (round == 4)
+		{
+			mdsl_dict_unref(snapshots[1]);
+			mdsl_dict_unref(refs[1]);
+			snapshots[1] = mdsl_dict_snapshot(snapshots[2]);
+			refs[1] = refs[2];
+			mdsl_dict_ref(refs[1]);
+		}
+
+		for (i = 0; i <= round; i++)
+			check_same_dump(snapshots[i], refs[i]);
+	}
+
+	//Snapshots outlive the dictionary
+	mdsl_dict_unref(dict);
+	for (i = 0; i < n_rounds; i += 2)
+		mdsl_dict_unref(snapshots[i]);
+	for (i = 1; i < n_rounds; i += 2)
+	{
+		MdslDictStats stats[1];
+		mdsl_dict_get_stats(snapshots[i], stats, 1);
+		check_same_dump(snapshots[i], refs[i]);
+		mdsl_dict_unref(snapshots[i]);
+	}
+	for (i = 0; i < n_rounds; i++)
+		mdsl_dict_unref(refs[i]);
+	free(data);
+
+	return 1;
+}
+
+//Integer values, including 0, against an array of counters
+int test_dict_u64(int n_strings, int max_len, int flags)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(MDSL_DICT_U64 | flags);
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	uint64_t *counts = (uint64_t *) mdsl_alloc(sizeof(uint64_t) * n_strings);
+	char *present = (char *) mdsl_alloc(n_strings + 1);
+	unsigned int seed = 15;
+	int i, j, n_present = 0;
+	uint64_t value;
+
+	//Keys are distinct
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "abc"[rand_r(&seed) % 3];
+		key[len] = 0;
+		for (j = 0; j < i; j++)
+			if (strcmp(key, data + j * (max_len + 1)) == 0)
+				break;
+		if (j < i)
+		{
+			i--;
+			continue;
+		}
+		counts[i] = 0;
+		present[i] = 0;
+	}
+
+	for (j = 0; j < n_strings * 8; j++)
+	{
+		i = rand_r(&seed) % n_strings;
+		char *key = data + i * (max_len + 1);
+		size_t len = strlen(key);
+		int op = rand_r(&seed) % 4;
+		if (op == 0)
+		{
+			if (mdsl_dict_u64_set(dict, key, len, 0) != present[i])
+				mdsl_error("Wrong presence for %s", key);
+			n_present += ! present[i];
+			counts[i] = 0;
+			present[i] = 1;
+		}
+		else if (op == 1)
+		{
+			if (mdsl_dict_u64_remove(dict, key, len, &value) != present[i])
+				mdsl_error("Wrong presence for %s", key);
+			if (present[i] && value != counts[i])
+				mdsl_error("Removed wrong value for %s", key);
+			n_present -= present[i];
+			counts[i] = 0;
+			present[i] = 0;
+		}
+		else
+		{
+			//Crosses the 32-bit boundary
+			uint64_t delta = op == 2 ? 1 : ((uint64_t) 1 << 32) - 1;
+			if (mdsl_dict_u64_add(dict, key, len, delta) != counts[i] + delta)
+				mdsl_error("Wrong sum for %s", key);
+			n_present += ! present[i];
+			counts[i] += delta;
+			present[i] = 1;
+		}
+	}
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		value = 1;
+		if (mdsl_dict_u64_get(dict, key, strlen(key), &value) != present[i]
+				|| (present[i] && value != counts[i]))
+			mdsl_error("Wrong value for %s", key);
+	}
+
+	//Iteration and frozen images see the same values
+	MdslDictIter iter[1];
+	size_t image_len;
+	void *image = mdsl_dict_freeze(dict, NULL, NULL, &image_len);
+	int n_found = 0;
+	mdsl_dict_iter_init(iter, dict);
+	while (mdsl_dict_iter_next(iter))
+	{
+		if (! mdsl_dict_u64_get(dict, iter->key, iter->key_len, &value)
+				|| value != iter->u64)
+			mdsl_error("Iterator returned wrong value");
+		if (! mdsl_frozen_dict_get(image, iter->key, iter->key_len, &value)
+				|| value != iter->u64)
+			mdsl_error("Frozen image has wrong value");
+		n_found++;
+	}
+	mdsl_dict_iter_destroy(iter);
+	if (n_found != n_present)
+		mdsl_error("Iteration found %d of %d keys", n_found, n_present);
+
+	MdslDictStats stats[1];
+	mdsl_dict_get_stats(dict, stats, 0);
+	if (stats->n_keys != n_present)
+		mdsl_error("Wrong number of keys in statistics");
+	check_order_stats(dict);
+
+	free(image);
+	mdsl_dict_unref(dict);
+	free(data);
+	free(counts);
+	free(present);
+
+	return 1;
+}
+
+//Lookups through the root table must agree with a plain dictionary 
+//through every kind of change
+int test_dict_root_table(int n_strings, int max_len, const char *alphabet)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(MDSL_DICT_ROOT_TABLE);
+	MdslDict *cdict = mdsl_dict_new();
+	MdslDict *snapshot = NULL;
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	const void **keys = (const void **) mdsl_alloc
+		(sizeof(void *) * n_strings * (max_len + 1));
+	size_t *key_lens = (size_t *) mdsl_alloc
+		(sizeof(size_t) * n_strings * (max_len + 1));
+	void **values = (void **) mdsl_alloc
+		(sizeof(void *) * n_strings * (max_len + 1));
+	int alphabet_len = strlen(alphabet);
+	unsigned int seed = 16;
+	int i, j, round, n_keys = 0;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = alphabet[rand_r(&seed) % alphabet_len];
+		key[len] = 0;
+
+		//All prefixes of all keys are looked up
+		for (j = 0; j <= len; j++)
+		{
+			keys[n_keys] = key;
+			key_lens[n_keys] = j;
+			n_keys++;
+		}
+	}
+
+	for (round = 0; round < 8; round++)
+	{
+		for (i = 0; i < n_strings; i++)
+		{
+			char *key = data + i * (max_len + 1);
+			size_t len = strlen(key);
+			int op = rand_r(&seed) % 5;
+			if (op == 0 || op == 1)
+			{
+				mdsl_dict_set(dict, key, len, key);
+				mdsl_dict_set(cdict, key, len, key);
+			}
+			else if (op == 2)
+			{
+				mdsl_dict_set(dict, key, len, NULL);
+				mdsl_dict_set(cdict, key, len, NULL);
+			}
+			else if (op == 3)
+			{
+				*mdsl_dict_lookup_slot(dict, key, len, 1) = key + 1;
+				mdsl_dict_set(cdict, key, len, key + 1);
+			}
+			else if (rand_r(&seed) % 10 == 0)
+			{
+				size_t prefix_len = rand_r(&seed) % 3;
+				if (prefix_len > len)
+					prefix_len = len;
+				mdsl_dict_remove_prefix(dict, key, prefix_len);
+				mdsl_dict_remove_prefix(cdict, key, prefix_len);
+			}
+		}
+
+		//Writes to a dictionary with a snapshot copy top level nodes
+		if (round == 4)
+			snapshot = mdsl_dict_snapshot(dict);
+
+		for (i = 0; i < n_keys; i++)
+		{
+			if (mdsl_dict_get(dict, keys[i], key_lens[i]) 
+					!= mdsl_dict_get(cdict, keys[i], key_lens[i]))
+				mdsl_error("Wrong value for key %.*s", 
+						(int) key_lens[i], (const char *) keys[i]);
+		}
+		mdsl_dict_get_many(dict, keys, key_lens, n_keys, values);
+		for (i = 0; i < n_keys; i++)
+		{
+			if (values[i] != mdsl_dict_get(cdict, keys[i], key_lens[i]))
+				mdsl_error("Wrong value from mdsl_dict_get_many()");
+		}
+		check_same_dump(dict, cdict);
+	}
+
+	if (snapshot)
+		mdsl_dict_unref(snapshot);
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+	free(data);
+	free(keys);
+	free(key_lens);
+	free(values);
+
+	return 1;
+}
+
+int main()
+{
+
+#if 0
+	run_test(test_permutator(2));
+	run_test(test_permutator(4));
+#endif
+
+	run_test(test_dict_insert(test_strings_1));
+	run_test(test_dict_insert(test_strings_2));
+	run_test(test_dict_insert(test_strings_3));
+	run_test(test_dict_insert(test_strings_4));
+
+	run_test(test_dict_insert_delete(test_strings_5, 4));
+	run_test(test_dict_insert_delete(test_strings_4, 4));
+
+	run_test(test_dict_iter(test_strings_1));
+	run_test(test_dict_iter(test_strings_4));
+	run_test(test_dict_iter(test_strings_5));
+	run_test(test_dict_iter_random(300, 12));
+	run_test(test_dict_iter_random(100, 80));
+	run_test(test_dict_iter_random(20, 3000));
+
+	run_test(test_dict_remove_prefix(1, 0, 0));
+	run_test(test_dict_remove_prefix(500, 6, 0));
+	run_test(test_dict_remove_prefix(500, 40, 0));
+	run_test(test_dict_remove_prefix(100, 2000, 0));
+	run_test(test_dict_remove_prefix(500, 6, MDSL_DICT_CONCURRENT));
+
+	run_test(test_dict_node_pool(10, 2));
+	run_test(test_dict_node_pool(5000, 100));
+	run_test(test_dict_stats(1, 1, 0));
+	run_test(test_dict_stats_slots(2000));
+	run_test(test_dict_stats(500, 8, 0));
+	run_test(test_dict_stats(300, 60, 0));
+	run_test(test_dict_stats(300, 8, MDSL_DICT_CONCURRENT));
+	run_test(test_dict_map_churn(3, 0));
+	run_test(test_dict_map_churn(47, 0));
+	run_test(test_dict_map_churn(100, 0));
+	run_test(test_dict_map_churn(223, 0));
+	run_test(test_dict_map_churn(100, MDSL_DICT_CONCURRENT));
+
+	run_test(test_dict_snapshot(1, 0));
+	run_test(test_dict_snapshot(500, 6));
+	run_test(test_dict_snapshot(300, 60));
+
+	run_test(test_dict_u64(1, 0, 0));
+	run_test(test_dict_u64(500, 6, 0));
+	run_test(test_dict_u64(300, 60, 0));
+	run_test(test_dict_u64(300, 6, MDSL_DICT_CONCURRENT));
+
+	run_test(test_dict_root_table(1, 1, "ab"));
+	run_test(test_dict_root_table(500, 5, "ab"));
+	run_test(test_dict_root_table(1000, 6, "abcdefgh"));
+	run_test(test_dict_root_table(2000, 12, 
+				"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"));
+
+	run_test(test_dict_lookup_slot(1, 0));
+	run_test(test_dict_lookup_slot(2000, 6));
+	run_test(test_dict_lookup_slot(2000, 40));
+
+	run_test(test_dict_longest_prefix(0, 4));
+	run_test(test_dict_longest_prefix(50, 6));
+	run_test(test_dict_longest_prefix(1000, 40));
+
+	run_test(test_dict_get_many(1000));
+
+	run_test(test_dict_bulk_load(0, 4));
+	run_test(test_dict_bulk_load(1, 0));
+	run_test(test_dict_bulk_load(200, 8));
+	run_test(test_dict_bulk_load(300, 100));
+	run_test(test_dict_bulk_load(100, 3000));
+
+	run_test(test_dict_build_parallel(0, 4, 2, "ab", "", 0));
+	run_test(test_dict_build_parallel(1, 0, 1, "ab", "", 0));
+	run_test(test_dict_build_parallel(500, 6, 1, "abc", "", 0));
+	run_test(test_dict_build_parallel(2000, 6, 4, "abc", "", 0));
+	run_test(test_dict_build_parallel(3000, 12, 3, 
+				"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ",
+				"", 0));
+	run_test(test_dict_build_parallel(300, 100, 8, "ab", "", 0));
+	run_test(test_dict_build_parallel(1000, 6, 3, "abc", "/", 0));
+	run_test(test_dict_build_parallel(1000, 3, 4, "ab", "/usr/lib/", 0));
+	run_test(test_dict_build_parallel(50, 1, 2, "a", "/usr/", 0));
+	run_test(test_dict_build_parallel(20, 0, 2, "a", "/usr", 0));
+	run_test(test_dict_build_parallel(1000, 4, 2, "abcdefgh", "", 
+				MDSL_DICT_ROOT_TABLE));
+	run_test(test_dict_build_parallel(1000, 6, 3, "abcd", "a",
+				MDSL_DICT_CONCURRENT));
+
+	run_test(test_dict_order_stats(1, 0, 0));
+	run_test(test_dict_order_stats(500, 6, 0));
+	run_test(test_dict_order_stats(300, 40, 0));
+	run_test(test_dict_order_stats(500, 6, MDSL_DICT_CONCURRENT));
+	run_test(test_dict_order_stats(500, 6, MDSL_DICT_ROOT_TABLE));
+
+	run_test(test_dict_freeze(1, 0, 2));
+	run_test(test_dict_freeze(2000, 6, 3));
+	run_test(test_dict_freeze(5000, 4, 256));
+	run_test(test_dict_freeze(500, 90, 2));
+
+	run_test(test_dict_concurrent(1, 2, 10));
+	run_test(test_dict_concurrent(500, 3, 20));
 	
 	return 0;
 }
@@ -34,216 +34,320 @@
 		} \
 	} while (0)
 
-static int avl_tree_check_sanity(MiniAvlNode *mem, int x, int l, int r)
+int byte_map_test(int start, int len, int stride)
 {
-	if (!x)
-		return 0;
-	if (mem[x].key <= l || mem[x].key >= r)
-	{
-		mdsl_error("Range error on node %d (key %d not in (%d, %d))",
-				x, (int) mem[x].key, l, r);
-	}
-	int lh = avl_tree_check_sanity(mem, mem[x].left, l, mem[x].key);
-	int rh = avl_tree_check_sanity(mem, mem[x].right, mem[x].key, r);
-	int check_height = (lh > rh ? lh : rh) + 1;	
-	if (mem[x].height != check_height)
+	void *cdata[256];
+	uint8_t targets[256];
+	int i, j, k;
+	for (i = 0; i < 256; i++)
 	{
-		mdsl_error("Incorrect height of node %d (%d vs %d)", 
-				x, (int) mem[x].height, check_height);
-		abort();
+		targets[i] = i;
+		cdata[i] = NULL;
 	}
-	int bf = rh - lh;
-	if (bf > 1 || bf < -1)
+
+	ByteMap m[1];
+	byte_map_init(m);
+
+	for (k = 0; k < 2; k++)
 	{
-		mdsl_error("Unbalanced node %d (lh = %d, rh = %d)",
-				x, lh, rh);
-		abort();
-	}
+		for (i = 0; i < len; i++)
+		{
+			int onekey = (start + i * stride) % 256;
+			void *oneval = k ? NULL : targets + onekey;
 
-	return check_height;
-}
+			byte_map_set(m, onekey, oneval);
+			cdata[onekey] = oneval;
 
-static int avl_tree_check_correctness
-	(MiniAvlNode *mem, int root, int *elements)
-{
-	avl_tree_check_sanity(mem, root, -1, 256);
+			for (j = 0; j < 256; j++)
+			{
+				void *val = byte_map_get(m, j);
+				void *cval = cdata[j];
+				if (val != cval)
+				{
+					mdsl_error("Inconsistent values "
+						"(k = %d, onekey = %d, j = %d, val = %p, cval = %p)", 
+						k, onekey, j, val, cval);
+				}
+			}
 
-	int i;
+			//Tuples should come out sorted by key
+			uint8_t keys[256];
+			void *values[256];
+			int n_tuples = byte_map_get_tuples(m, keys, values);
+			int n_check = 0;
+			for (j = 0; j < 256; j++)
+			{
+				if (! cdata[j])
+					continue;
+				if (n_check >= n_tuples 
+						|| keys[n_check] != j || values[n_check] != cdata[j])
+				{
+					mdsl_error("Inconsistent tuples "
+						"(k = %d, onekey = %d, j = %d)", k, onekey, j);
+				}
+				n_check++;
+			}
+			if (n_check != n_tuples || n_tuples != byte_map_get_size(m))
+			{
+				mdsl_error("Incorrect number of tuples (%d vs %d)",
+						n_tuples, n_check);
+			}
 
-	for (i = 0; i < 256; i++)
-	{
-		int iter = root;
-		while (iter)
-		{
-			if (i < mem[iter].key)
-				iter = mem[iter].left;
-			else if (i > mem[iter].key)
-				iter = mem[iter].right;
-			else
-				break;
-		}
-		if (elements[i] != iter)
-		{
-			mdsl_error("Contents check failed: %d --> %d vs %d", 
-					i, elements[i], iter);
+			//Ordered enumeration
+			for (j = 0; j <= 256; j++)
+			{
+				int ckey;
+				for (ckey = j; ckey < 256 && ! cdata[ckey]; ckey++)
+					;
+				uint8_t key = 0;
+				void *val = byte_map_next(m, j, &key);
+				void *cval = ckey < 256 ? cdata[ckey] : NULL;
+				if (val != cval || (val && key != ckey))
+				{
+					mdsl_error("Inconsistent enumeration "
+						"(k = %d, onekey = %d, j = %d, key = %d, ckey = %d)",
+						k, onekey, j, (int) key, ckey);
+				}
+			}
 		}
 	}
 
-	return 0;
+	byte_map_clear(m);
+
+	return 1;
 }
 
-#define INSERT 1
-#define REMOVE 2
-#define STOP -1
 
-static int avl_tree_test(int op, ...)
+//A map whose size goes up and down by one settles after the first round
+int byte_map_hysteresis_test()
 {
-	static int elements[256];
-	static MiniAvlNode mem[257];
-	int i;
-	int freelist = 1;;
-
-	for (i = 0; i < 256; i++)
-	{
-		elements[i] = 0;
-		mem[i + 1].left = mem[i + 1].right = mem[i + 1].height = 0;
-		mem[i + 1].key = i + 2;
-	}
-
-	int root = 0;
+	uint8_t targets[256];
+	int n, i;
 
-	va_list arglist;
-	va_start(arglist, op);
-	while (op >= 0)
+	for (n = 0; n < 256; n++)
 	{
-		int arg = va_arg(arglist, int);
+		ByteMap m[1];
+		void *storage = NULL;
+		int mode = 0;
+		size_t size = 0;
 
-		if (op == INSERT)
-		{
-			int alloc = freelist;
-			freelist = mem[freelist].key;
-			int tray = alloc;
-
-			root = avl_set_rec(mem, root, arg, &tray);
-			if (tray != elements[arg])
-			{
-				mdsl_error("Invalid response for set(%d) (%d vs expected %d)",
-						arg, tray, elements[arg]);
-			}
-			if (tray == 0)
-			{
-				elements[arg] = alloc;
-			}
-			else
-			{
-				mem[alloc].key = freelist;
-				freelist = alloc;
-			}
+		byte_map_init(m);
+		for (i = 0; i < n; i++)
+			byte_map_set(m, (i * 7) % 256, targets + i);
 
-			avl_tree_check_correctness(mem, root, elements);
-		}
-		else if (op == REMOVE)
+		for (i = 0; i < 4; i++)
 		{
-			int tray = 0;
-
-			root = avl_unset_rec(mem, root, arg, &tray);
-			if (tray != elements[arg])
-			{
-				mdsl_error("Invalid response for unset(%d) (%d vs expected %d)",
-						arg, tray, elements[arg]);
-			}
-			if (tray)
-			{
-				mem[tray].key = freelist;
-				freelist = tray;
-				elements[arg] = 0;
-			}
-
-			avl_tree_check_correctness(mem, root, elements);
-			
+			byte_map_set(m, (n * 7) % 256, targets + n);
+			byte_map_set(m, (n * 7) % 256, NULL);
+			if (i > 0 && (byte_map_storage(m) != storage
+						|| byte_map_get_mode(m) != mode
+						|| byte_map_storage_size(m) != size))
+				mdsl_error("Map of %d keys changed layout", n);
+			storage = byte_map_storage(m);
+			mode = byte_map_get_mode(m);
+			size = byte_map_storage_size(m);
 		}
+		if (byte_map_get_size(m) != n)
+			mdsl_error("Map of %d keys lost keys", n);
 
-		op = va_arg(arglist, int);
+		byte_map_clear(m);
 	}
-	va_end(arglist);
 
 	return 1;
 }
 
-#define avl_l1(op, base) op, (base), op, ((base) + 1)
-#define avl_l2(op, base) avl_l1(op, base), avl_l1(op, (base) + 2)
-#define avl_l3(op, base) avl_l2(op, base), avl_l2(op, (base) + 4)
-#define avl_l4(op, base) avl_l3(op, base), avl_l3(op, (base) + 8)
-#define avl_l5(op, base) avl_l4(op, base), avl_l4(op, (base) + 16)
-#define avl_l6(op, base) avl_l5(op, base), avl_l5(op, (base) + 32)
-#define avl_l7(op, base) avl_l6(op, base), avl_l6(op, (base) + 64)
+//Checks mode, size and contents of a map holding present[key] ? key : none
+static void byte_map_check(ByteMap *m, const uint8_t *present, 
+		uint8_t *targets, int n, int mode)
+{
+	int j;
 
+	if (byte_map_get_mode(m) != mode || byte_map_get_size(m) != n)
+		mdsl_error("Map of %d keys in mode %d instead of %d", 
+				n, byte_map_get_mode(m), mode);
 
-int byte_map_test(int start, int len, int stride)
-{
-	void *cdata[256];
-	uint8_t targets[256];
-	int i, j, k;
-	for (i = 0; i < 256; i++)
+	if (mode == BYTE_MAP_MODE_BITMAP)
 	{
-		targets[i] = i;
-		cdata[i] = NULL;
+		//Grown and shrunk in steps, never two steps of slack
+		if (m->capacity % BYTE_MAP_BITMAP_STEP != 0 || m->capacity < n
+				|| m->capacity - n >= 2 * BYTE_MAP_BITMAP_STEP
+				|| byte_map_storage_size(m) 
+					!= byte_map_bitmap_size(m->capacity))
+			mdsl_error("Bitmap of %d keys has capacity %d", n, m->capacity);
+	}
+
+	for (j = 0; j < 256; j++)
+	{
+		if (byte_map_get(m, j) != (present[j] ? targets + j : NULL))
+			mdsl_error("Wrong value for %d in map of %d keys", j, n);
 	}
 
+	for (j = 0; j <= 256; j++)
+	{
+		int ckey;
+		uint8_t key = 0;
+		for (ckey = j; ckey < 256 && ! present[ckey]; ckey++)
+			;
+		void *val = byte_map_next(m, j, &key);
+		if (ckey == 256 ? val != NULL : (val != targets + ckey || key != ckey))
+			mdsl_error("byte_map_next(%d) wrong in map of %d keys", j, n);
+	}
+}
+
+//Every layout boundary of the bitmap mode, going up one key at a time 
+//and back down
+int byte_map_bitmap_test(int stride)
+{
+	uint8_t targets[256], present[256];
 	ByteMap m[1];
+	int i, n, mode;
+
+	memset(present, 0, sizeof(present));
 	byte_map_init(m);
 
-	for (k = 0; k < 2; k++)
+	for (n = 1; n <= 256; n++)
 	{
-		for (i = 0; i < len; i++)
-		{
-			int onekey = (start + i * stride) % 256;
-			void *oneval = k ? NULL : targets + onekey;
+		int key = (n * stride) % 256;
+		byte_map_set(m, key, targets + key);
+		present[key] = 1;
+
+		if (n <= 48)
+			mode = n == 1 ? 1 : n <= 4 ? BYTE_MAP_MODE_NODE4 
+				: n <= 16 ? BYTE_MAP_MODE_NODE16 : BYTE_MAP_MODE_NODE48;
+		else
+			mode = n <= 224 ? BYTE_MAP_MODE_BITMAP : BYTE_MAP_MODE_NODE256;
+		byte_map_check(m, present, targets, n, mode);
+
+		//Capacity grows by one step at a time
+		if (mode == BYTE_MAP_MODE_BITMAP && m->capacity 
+				!= (n + BYTE_MAP_BITMAP_STEP - 1) 
+					/ BYTE_MAP_BITMAP_STEP * BYTE_MAP_BITMAP_STEP)
+			mdsl_error("Bitmap of %d keys grew to %d", n, m->capacity);
+	}
 
-			byte_map_set(m, onekey, oneval);
-			cdata[onekey] = oneval;
+	//Node256 stays until the slack below the bitmap capacity is reached, 
+	//the bitmap until a Node16 is enough, which then stays down to a 
+	//single key
+	for (n = 255, i = 0; n >= 0; n--, i++)
+	{
+		int key = (i * 101 + 7) % 256;
+		byte_map_set(m, key, NULL);
+		present[key] = 0;
+
+		if (n > 224 - BYTE_MAP_BITMAP_SLACK)
+			mode = BYTE_MAP_MODE_NODE256;
+		else if (n > 16)
+			mode = BYTE_MAP_MODE_BITMAP;
+		else if (n > 1)
+			mode = BYTE_MAP_MODE_NODE16;
+		else
+			mode = n;
+		byte_map_check(m, present, targets, n, mode);
+	}
 
-			for (j = 0; j < 256; j++)
+	byte_map_clear(m);
+
+	return 1;
+}
+
+//Buffers are allocated with exact sizes so that memory checkers catch 
+//reads past the end
+int mismatch_test(int max_len)
+{
+	unsigned int seed = 1;
+	int len, pos, offset, i;
+
+	for (len = 0; len <= max_len; len++)
+	{
+		for (offset = 0; offset < 4; offset++)
+		{
+			size_t size = len + offset > 0 ? len + offset : 1;
+			uint8_t *a_mem = (uint8_t *) mdsl_alloc(size);
+			uint8_t *b_mem = (uint8_t *) mdsl_alloc(size);
+			uint8_t *a = a_mem + offset, *b = b_mem + offset;
+
+			for (pos = 0; pos <= len; pos++)
 			{
-				void *val = byte_map_get(m, j);
-				void *cval = cdata[j];
-				if (val != cval)
+				for (i = 0; i < len; i++)
+					a[i] = b[i] = rand_r(&seed);
+				//Differences after the first one do not matter
+				for (i = pos; i < len; i++)
 				{
-					mdsl_error("Inconsistent values "
-						"(k = %d, onekey = %d, j = %d, val = %p, cval = %p)", 
-						k, onekey, j, val, cval);
+					if (i == pos || rand_r(&seed) % 2)
+						b[i] = ~a[i];
 				}
+
+				size_t res = mdsl_mismatch(a, b, len);
+				if (res != pos)
+				{
+					mdsl_error("mdsl_mismatch(len = %d) returned %d, "
+							"expected %d", len, (int) res, pos);
+				}
+				if (mdsl_equal(a, b, len) != (pos == len))
+					mdsl_error("mdsl_equal(len = %d) failed", len);
 			}
+
+			free(a_mem);
+			free(b_mem);
 		}
 	}
 
-	byte_map_clear(m);
-
 	return 1;
 }
 
+//The instruction where the CPU has it, then the bit parallel count
+int popcount_test()
+{
+	unsigned int seed = 1;
+	int pass, i, j;
+
+	mdsl_popcount_init();
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 0; i < 1000; i++)
+		{
+			uint64_t x = ((uint64_t) rand_r(&seed) << 40)
+				^ ((uint64_t) rand_r(&seed) << 20) ^ rand_r(&seed);
+			if (i <= 64)
+				x = i == 64 ? ~((uint64_t) 0) : (((uint64_t) 1) << i) - 1;
+
+			int expected = 0;
+			for (j = 0; j < 64; j++)
+				expected += (x >> j) & 1;
+			if (mdsl_popcount64(x) != expected)
+				mdsl_error("mdsl_popcount64(%llx) returned %d, expected %d",
+						(unsigned long long) x, mdsl_popcount64(x), expected);
+		}
+#ifdef MDSL_HAVE_POPCNT_DISPATCH
+		mdsl_have_popcnt = 0;
+#endif
+	}
+
+	return 1;
+}
 
 int main()
 {
-	run_test(avl_tree_test(INSERT, 0, INSERT, 1, INSERT, 2,
-				REMOVE, 1, REMOVE, 2, REMOVE, 0, STOP));	
-	run_test(avl_tree_test(REMOVE, 0, INSERT, 0, INSERT, 0,
-				REMOVE, 0, REMOVE, 0, STOP));
-	run_test(avl_tree_test(REMOVE, 255, INSERT, 255, INSERT, 255,
-				REMOVE, 255, REMOVE, 255, STOP));
-	run_test(avl_tree_test(avl_l7(INSERT, 0), avl_l7(INSERT, 128), 
-				avl_l7(REMOVE, 0), avl_l7(REMOVE, 128), STOP));
-
 	run_test(byte_map_test(0, 2, 1));
 	run_test(byte_map_test(0, 256, 1));
+	run_test(byte_map_test(255, 256, 255));
 	run_test(byte_map_test(0, 5, 5));
-	run_test(byte_map_test(0, 5, 11));
-	run_test(byte_map_test(0, 5, 23));
-	run_test(byte_map_test(0, 5, 59));
+	run_test(byte_map_test(0, 17, 11));
+	run_test(byte_map_test(0, 49, 23));
 	run_test(byte_map_test(0, 50, 5));
 	run_test(byte_map_test(0, 50, 11));
 	run_test(byte_map_test(0, 50, 23));
 	run_test(byte_map_test(0, 50, 59));
+	run_test(byte_map_test(7, 100, 13));
+	run_test(byte_map_test(0, 200, 7));
+	run_test(byte_map_test(3, 230, 11));
+	run_test(byte_map_test(128, 250, 3));
+	run_test(byte_map_bitmap_test(1));
+	run_test(byte_map_bitmap_test(37));
+	run_test(byte_map_hysteresis_test());
+
+	run_test(mismatch_test(200));
+	run_test(popcount_test());
 	
 	return 0;
 }
@@ -0,0 +1,228 @@
+/* scanner.c
+ * Unit test for multi-pattern scanner
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdsl/incl.h>
+
+#include <string.h>
+
+#define run_test(x) \
+	do { \
+		fprintf(stderr, "Running test %s\n", #x); \
+		int res = x; \
+		if (! res) \
+		{ \
+			mdsl_error("Test %s failed", #x); \
+		} \
+	} while (0)
+
+mdsl_declare_array(MdslDictMatch, MatchArray, match_array);
+
+typedef struct
+{
+	MatchArray matches;
+	size_t limit;
+} MatchCollector;
+
+static int collect_match(void *user_data, const MdslDictMatch *match)
+{
+	MatchCollector *collector = (MatchCollector *) user_data;
+	match_array_append(&(collector->matches), *match);
+	return match_array_size(&(collector->matches)) < collector->limit;
+}
+
+//Matches found by looking up every substring, in the order the scanner 
+//reports them
+static void find_matches(MdslDict *dict, int u64, const char *text, 
+		size_t len, size_t max_key_len, MatchArray *matches)
+{
+	size_t end, key_len;
+
+	match_array_init(matches);
+	for (end = 1; end <= len; end++)
+	{
+		key_len = end < max_key_len ? end : max_key_len;
+		for (; key_len > 0; key_len--)
+		{
+			MdslDictMatch match;
+			const char *key = text + end - key_len;
+			int found;
+
+			match.offset = end - key_len;
+			match.len = key_len;
+			match.value = NULL;
+			match.u64 = 0;
+			if (u64)
+				found = mdsl_dict_u64_get(dict, key, key_len, &(match.u64));
+			else
+				found = (match.value = mdsl_dict_get(dict, key, key_len)) 
+					!= NULL;
+			if (found)
+				match_array_append(matches, match);
+		}
+	}
+}
+
+static void check_scan(MdslDictScanner *scanner, MdslDict *dict, int u64,
+		const char *text, size_t max_key_len)
+{
+	size_t len = strlen(text);
+	MatchCollector collector;
+	MatchArray expected;
+	size_t i, n;
+
+	find_matches(dict, u64, text, len, max_key_len, &expected);
+	match_array_init(&(collector.matches));
+	collector.limit = SIZE_MAX;
+	n = mdsl_dict_scanner_scan(scanner, text, len, collect_match, &collector);
+
+	if (n != match_array_size(&expected) 
+			|| n != match_array_size(&(collector.matches)))
+		mdsl_error("Found %d matches, expected %d", 
+				(int) n, (int) match_array_size(&expected));
+	for (i = 0; i < n; i++)
+	{
+		MdslDictMatch *a = collector.matches.data + i;
+		MdslDictMatch *b = expected.data + i;
+		if (a->offset != b->offset || a->len != b->len 
+				|| (u64 ? a->u64 != b->u64 : a->value != b->value))
+			mdsl_error("Match %d is %.*s at %d, expected %.*s at %d", (int) i,
+					(int) a->len, text + a->offset, (int) a->offset,
+					(int) b->len, text + b->offset, (int) b->offset);
+	}
+	if (mdsl_dict_scanner_scan(scanner, text, len, NULL, NULL) != n)
+		mdsl_error("Counting found a different number of matches");
+
+	//Stopping early
+	if (n > 1)
+	{
+		match_array_resize(&(collector.matches), 0);
+		collector.limit = n / 2;
+		if (mdsl_dict_scanner_scan(scanner, text, len, 
+					collect_match, &collector) != n / 2)
+			mdsl_error("Scanning did not stop");
+	}
+
+	free(expected.data);
+	free(collector.matches.data);
+}
+
+//Textbook example with keys that overlap and nest
+int test_scanner_basic()
+{
+	MdslDict *dict = mdsl_dict_new();
+	MdslDictScanner *scanner;
+	char *keys[] = {"he", "she", "his", "hers", NULL};
+	int i;
+
+	for (i = 0; keys[i]; i++)
+		mdsl_dict_set_str(dict, keys[i], keys[i]);
+	scanner = mdsl_dict_scanner_new(dict, 1);
+	if (mdsl_dict_scanner_get_n_states(scanner) != 10)
+		mdsl_error("Wrong number of states");
+	check_scan(scanner, dict, 0, "ushers", 4);
+	check_scan(scanner, dict, 0, "ahishers hehe shis", 4);
+	check_scan(scanner, dict, 0, "", 4);
+	if (mdsl_dict_scanner_scan(scanner, "ushers", 6, NULL, NULL) != 3)
+		mdsl_error("Wrong number of matches");
+	mdsl_dict_scanner_unref(scanner);
+
+	//Empty key is not matched
+	mdsl_dict_remove_prefix(dict, "", 0);
+	mdsl_dict_set(dict, "", 0, "empty");
+	scanner = mdsl_dict_scanner_new(dict, 4);
+	if (mdsl_dict_scanner_scan(scanner, "ushers", 6, NULL, NULL) != 0)
+		mdsl_error("Empty key matched");
+	mdsl_dict_scanner_unref(scanner);
+
+	mdsl_dict_unref(dict);
+
+	return 1;
+}
+
+//Random keys and text over a small alphabet, so that failure chains are 
+//long. The scanner keeps the keys it was built with.
+int test_scanner_random(int n_keys, int max_len, int text_len, 
+		const char *alphabet, size_t n_dense, int flags)
+{
+	MdslDict *dict = mdsl_dict_new_with_flags(flags);
+	MdslDict *cdict = mdsl_dict_new_with_flags(flags & MDSL_DICT_U64);
+	int u64 = (flags & MDSL_DICT_U64) != 0;
+	int alphabet_len = strlen(alphabet);
+	char *data = (char *) mdsl_alloc(n_keys * (max_len + 1) + 1);
+	char *text = (char *) mdsl_alloc(text_len + 1);
+	unsigned int seed = 31;
+	int i, j;
+
+	for (i = 0; i < n_keys; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = alphabet[rand_r(&seed) % alphabet_len];
+		key[len] = 0;
+		if (u64)
+		{
+			mdsl_dict_u64_set(dict, key, len, i);
+			mdsl_dict_u64_set(cdict, key, len, i);
+		}
+		else
+		{
+			mdsl_dict_set_str(dict, key, key);
+			mdsl_dict_set_str(cdict, key, key);
+		}
+	}
+	for (i = 0; i < text_len; i++)
+		text[i] = alphabet[rand_r(&seed) % alphabet_len];
+	text[text_len] = 0;
+
+	MdslDictScanner *scanner = mdsl_dict_scanner_new(dict, n_dense);
+	check_scan(scanner, cdict, u64, text, max_len);
+
+	//Changes to the dictionary do not affect the scanner
+	mdsl_dict_remove_prefix(dict, "", 0);
+	check_scan(scanner, cdict, u64, text, max_len);
+
+	mdsl_dict_scanner_unref(scanner);
+	mdsl_dict_unref(dict);
+	mdsl_dict_unref(cdict);
+	free(text);
+	free(data);
+
+	return 1;
+}
+
+int main()
+{
+	run_test(test_scanner_basic());
+
+	run_test(test_scanner_random(0, 4, 100, "ab", 1, 0));
+	run_test(test_scanner_random(20, 4, 2000, "ab", 1, 0));
+	run_test(test_scanner_random(20, 4, 2000, "ab", 1000, 0));
+	run_test(test_scanner_random(300, 8, 5000, "abc", 1, 0));
+	run_test(test_scanner_random(300, 8, 5000, "abc", 17, 0));
+	run_test(test_scanner_random(2000, 30, 20000, "abcd", 64, 0));
+	run_test(test_scanner_random(1000, 6, 5000, 
+				"abcdefghijklmnopqrstuvwxyz", 256, 0));
+	run_test(test_scanner_random(300, 8, 5000, "abc", 8, MDSL_DICT_U64));
+	run_test(test_scanner_random(300, 8, 5000, "abc", 8, 
+				MDSL_DICT_CONCURRENT));
+
+	return 0;
+}
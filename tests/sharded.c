@@ -0,0 +1,273 @@
+/* sharded.c
+ * Unit test for sharded dictionary
+ * 
+ * Copyright 2015-2020 Akash Rawal
+ * This file is part of Modular Middleware.
+ * 
+ * Modular Middleware is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * Modular Middleware is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with Modular Middleware.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mdsl/incl.h>
+
+#include <string.h>
+#include <pthread.h>
+
+#define run_test(x) \
+	do { \
+		fprintf(stderr, "Running test %s\n", #x); \
+		int res = x; \
+		if (! res) \
+		{ \
+			mdsl_error("Test %s failed", #x); \
+		} \
+	} while (0)
+
+//Random keys, duplicates allowed
+static char *make_keys(int n_strings, int max_len, unsigned int seed)
+{
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1) + 1);
+	int i, j;
+
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		int len = rand_r(&seed) % (max_len + 1);
+		for (j = 0; j < len; j++)
+			key[j] = "abcxyz"[rand_r(&seed) % 6];
+		key[len] = 0;
+	}
+
+	return data;
+}
+
+//Merged iteration must see the same sequence as a plain dictionary
+static void check_same_iter(MdslShardedDict *sdict, MdslDict *dict)
+{
+	MdslShardedDictIter siter[1];
+	MdslDictIter iter[1];
+	size_t n_keys = 0;
+
+	mdsl_sharded_dict_iter_init(siter, sdict);
+	mdsl_dict_iter_init(iter, dict);
+	while (mdsl_dict_iter_next(iter))
+	{
+		if (! mdsl_sharded_dict_iter_next(siter))
+			mdsl_error("Merged iteration ended early");
+		if (siter->key_len != iter->key_len
+				|| memcmp(siter->key, iter->key, iter->key_len) != 0)
+			mdsl_error("Merged iteration out of order");
+		if (siter->value != iter->value || siter->u64 != iter->u64)
+			mdsl_error("Merged iteration returned a wrong value");
+		n_keys++;
+	}
+	if (mdsl_sharded_dict_iter_next(siter))
+		mdsl_error("Merged iteration returned extra keys");
+	mdsl_dict_iter_destroy(iter);
+	mdsl_sharded_dict_iter_destroy(siter);
+
+	if (mdsl_sharded_dict_get_n_keys(sdict) != n_keys)
+		mdsl_error("Wrong number of keys");
+}
+
+//Single thread, against a plain dictionary
+int test_sharded_dict(int n_strings, int max_len, int n_shards,
+		MdslShardMode mode, int flags)
+{
+	MdslShardedDict *sdict = mdsl_sharded_dict_new(n_shards, mode, flags);
+	MdslDict *dict = mdsl_dict_new();
+	char *data = make_keys(n_strings, max_len, 7);
+	unsigned int seed = 11;
+	int i, j;
+
+	for (j = 0; j < n_strings * 4; j++)
+	{
+		i = rand_r(&seed) % n_strings;
+		char *key = data + i * (max_len + 1);
+		size_t len = strlen(key);
+		void *value = rand_r(&seed) % 3 == 0 ? NULL : key;
+
+		if (mdsl_sharded_dict_set(sdict, key, len, value)
+				!= mdsl_dict_set(dict, key, len, value))
+			mdsl_error("Different old value for %s", key);
+
+		i = rand_r(&seed) % n_strings;
+		key = data + i * (max_len + 1);
+		if (mdsl_sharded_dict_get_str(sdict, key)
+				!= mdsl_dict_get_str(dict, key))
+			mdsl_error("Different value for %s", key);
+
+		if (j % (n_strings / 4 + 1) == 0)
+			check_same_iter(sdict, dict);
+	}
+	check_same_iter(sdict, dict);
+
+	mdsl_sharded_dict_unref(sdict);
+	mdsl_dict_unref(dict);
+	free(data);
+
+	return 1;
+}
+
+//Several writers at once
+typedef struct
+{
+	MdslShardedDict *sdict;
+	MdslShardedDict *counter;
+	char *data;
+	int max_len, begin, end;
+	int n_rounds;
+} ShardedWriter;
+
+static void *sharded_writer(void *arg)
+{
+	ShardedWriter *w = (ShardedWriter *) arg;
+	int round, i;
+
+	for (round = 0; round < w->n_rounds; round++)
+	{
+		//Insert own keys, then remove every other one
+		for (i = w->begin; i < w->end; i++)
+		{
+			char *key = w->data + i * (w->max_len + 1);
+			mdsl_sharded_dict_set_str(w->sdict, key, key);
+			mdsl_sharded_dict_u64_add(w->counter, "total", 5, 1);
+		}
+		for (i = w->begin + (round % 2); i < w->end; i += 2)
+		{
+			char *key = w->data + i * (w->max_len + 1);
+			mdsl_sharded_dict_set_str(w->sdict, key, NULL);
+		}
+	}
+
+	return NULL;
+}
+
+//Readers iterate while writers are busy, order must hold
+static void *sharded_reader(void *arg)
+{
+	ShardedWriter *w = (ShardedWriter *) arg;
+	int round;
+
+	for (round = 0; round < w->n_rounds; round++)
+	{
+		MdslShardedDictIter iter[1];
+		char *prev = NULL;
+		size_t prev_len = 0;
+
+		mdsl_sharded_dict_iter_init(iter, w->sdict);
+		while (mdsl_sharded_dict_iter_next(iter))
+		{
+			if (prev)
+			{
+				size_t len = prev_len < iter->key_len
+					? prev_len : iter->key_len;
+				int cmp = memcmp(prev, iter->key, len);
+				if (cmp > 0 || (cmp == 0 && prev_len >= iter->key_len))
+					mdsl_error("Merged iteration out of order");
+				free(prev);
+			}
+			prev_len = iter->key_len;
+			prev = (char *) mdsl_alloc(prev_len + 1);
+			memcpy(prev, iter->key, prev_len);
+		}
+		free(prev);
+		mdsl_sharded_dict_iter_destroy(iter);
+	}
+
+	return NULL;
+}
+
+int test_sharded_dict_threads(int n_writers, int n_per_writer,
+		int n_shards, MdslShardMode mode, int flags)
+{
+	int max_len = 12;
+	int n_strings = n_writers * n_per_writer;
+	int n_rounds = 5;
+	MdslShardedDict *sdict = mdsl_sharded_dict_new(n_shards, mode, flags);
+	MdslShardedDict *counter = mdsl_sharded_dict_new
+		(n_shards, mode, MDSL_DICT_U64 | flags);
+	char *data = (char *) mdsl_alloc(n_strings * (max_len + 1));
+	ShardedWriter *writers
+		= (ShardedWriter *) mdsl_alloc(sizeof(ShardedWriter) * n_writers);
+	pthread_t *threads
+		= (pthread_t *) mdsl_alloc(sizeof(pthread_t) * (n_writers + 1));
+	ShardedWriter reader;
+	uint64_t total;
+	int i;
+
+	for (i = 0; i < n_strings; i++)
+		sprintf(data + i * (max_len + 1), "%c%d", 'a' + i % 7, i);
+
+	for (i = 0; i < n_writers; i++)
+	{
+		writers[i].sdict = sdict;
+		writers[i].counter = counter;
+		writers[i].data = data;
+		writers[i].max_len = max_len;
+		writers[i].begin = i * n_per_writer;
+		writers[i].end = (i + 1) * n_per_writer;
+		writers[i].n_rounds = n_rounds;
+		if (pthread_create(threads + i, NULL, sharded_writer, writers + i)
+				!= 0)
+			mdsl_error("pthread_create() failed");
+	}
+	reader = writers[0];
+	if (pthread_create(threads + n_writers, NULL, sharded_reader, &reader)
+			!= 0)
+		mdsl_error("pthread_create() failed");
+	for (i = 0; i <= n_writers; i++)
+		pthread_join(threads[i], NULL);
+
+	//Last round is even, so odd positions survive
+	for (i = 0; i < n_strings; i++)
+	{
+		char *key = data + i * (max_len + 1);
+		char *expected = (i % n_per_writer) % 2 ? key : NULL;
+		if (mdsl_sharded_dict_get_str(sdict, key) != expected)
+			mdsl_error("Wrong value for %s", key);
+	}
+	if (! mdsl_sharded_dict_u64_get(counter, "total", 5, &total))
+		mdsl_error("Counter missing");
+	if (total != (uint64_t) n_strings * n_rounds)
+		mdsl_error("Lost increments: %lu", (unsigned long) total);
+	if (mdsl_sharded_dict_get_n_keys(sdict) != (size_t) n_strings / 2)
+		mdsl_error("Wrong number of keys");
+
+	mdsl_sharded_dict_unref(sdict);
+	mdsl_sharded_dict_unref(counter);
+	free(threads);
+	free(writers);
+	free(data);
+
+	return 1;
+}
+
+int main()
+{
+	run_test(test_sharded_dict(1, 0, 1, MDSL_SHARD_BY_HASH, 0));
+	run_test(test_sharded_dict(500, 6, 1, MDSL_SHARD_BY_HASH, 0));
+	run_test(test_sharded_dict(500, 6, 7, MDSL_SHARD_BY_HASH, 0));
+	run_test(test_sharded_dict(500, 6, 7, MDSL_SHARD_BY_FIRST_BYTE, 0));
+	run_test(test_sharded_dict(300, 40, 256, MDSL_SHARD_BY_FIRST_BYTE, 0));
+	run_test(test_sharded_dict(500, 6, 16, MDSL_SHARD_BY_HASH,
+				MDSL_DICT_CONCURRENT));
+
+	run_test(test_sharded_dict_threads(4, 500, 8, MDSL_SHARD_BY_HASH, 0));
+	run_test(test_sharded_dict_threads(4, 500, 3,
+				MDSL_SHARD_BY_FIRST_BYTE, 0));
+	run_test(test_sharded_dict_threads(4, 500, 8, MDSL_SHARD_BY_HASH,
+				MDSL_DICT_CONCURRENT));
+
+	return 0;
+}